@@ -25,6 +25,11 @@ project "Ray-shooter"
 
    files { "**.h", "**.c"}
 
+   filter "system:linux"
+      links { "pthread", "m", "dl" }
+
+   filter {}
+
    filter "configurations:Debug"
       kind "ConsoleApp"
       defines { "DEBUG", "_CRT_SECURE_NO_WARNINGS" }
@@ -0,0 +1,1836 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "g_common.h"
+#include "r_common.h"
+#include "u_math.h"
+#include "u_sys.h"
+
+#define BENCH_SEED 1337
+#define BENCH_PLANE_LENGTH 0.66
+
+typedef struct
+{
+	float x, y;
+	float dir_x, dir_y;
+	float plane_x, plane_y;
+} BenchFrame;
+
+typedef struct
+{
+	float frame_ms;
+	float world_ms;
+	float imbalance;
+	int num_steals;
+} BenchTiming;
+
+static int CompareFloats(const void* a, const void* b)
+{
+	float arg1 = *(const float*)a;
+	float arg2 = *(const float*)b;
+
+	if (arg1 < arg2) return -1;
+	if (arg1 > arg2) return 1;
+
+	return 0;
+}
+
+static void Bench_SetFrameAngle(BenchFrame* frame, float angle, float aspect)
+{
+	frame->dir_x = cos(angle);
+	frame->dir_y = sin(angle);
+	frame->plane_x = frame->dir_y * BENCH_PLANE_LENGTH * aspect;
+	frame->plane_y = -frame->dir_x * BENCH_PLANE_LENGTH * aspect;
+}
+
+static BenchFrame* Bench_LoadPath(const char* filename, float aspect, int* r_num_frames)
+{
+	FILE* file = fopen(filename, "r");
+
+	if (!file)
+	{
+		printf("Failed to open camera path %s\n", filename);
+		return NULL;
+	}
+
+	int capacity = 256;
+	int num_frames = 0;
+	BenchFrame* frames = malloc(sizeof(BenchFrame) * capacity);
+
+	if (!frames)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	char line[256];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+		{
+			continue;
+		}
+
+		BenchFrame frame;
+		float angle = 0;
+
+		int count = sscanf(line, "%f %f %f %f %f %f", &frame.x, &frame.y, &frame.dir_x, &frame.dir_y, &frame.plane_x, &frame.plane_y);
+
+		if (count == 3)
+		{
+			angle = frame.dir_x;
+			Bench_SetFrameAngle(&frame, angle * (Math_PI / 180.0), aspect);
+		}
+		else if (count != 6)
+		{
+			printf("Skipping bad camera path line: %s", line);
+			continue;
+		}
+
+		if (num_frames >= capacity)
+		{
+			capacity *= 2;
+
+			BenchFrame* new_frames = realloc(frames, sizeof(BenchFrame) * capacity);
+
+			if (!new_frames)
+			{
+				break;
+			}
+
+			frames = new_frames;
+		}
+
+		frames[num_frames++] = frame;
+	}
+
+	fclose(file);
+
+	*r_num_frames = num_frames;
+
+	return frames;
+}
+
+//full turn around the spawn point
+static BenchFrame* Bench_GeneratePath(int num_frames, float aspect)
+{
+	BenchFrame* frames = malloc(sizeof(BenchFrame) * num_frames);
+
+	if (!frames)
+	{
+		return NULL;
+	}
+
+	float x, y, dir_x, dir_y, plane_x, plane_y;
+	Player_GetView(&x, &y, &dir_x, &dir_y, &plane_x, &plane_y);
+
+	float start_angle = atan2(dir_y, dir_x);
+
+	for (int i = 0; i < num_frames; i++)
+	{
+		BenchFrame* frame = &frames[i];
+
+		frame->x = x + 0.5;
+		frame->y = y + 0.5;
+
+		Bench_SetFrameAngle(frame, start_angle + (2.0 * Math_PI * i) / num_frames, aspect);
+	}
+
+	return frames;
+}
+
+static bool Bench_WriteCSV(const char* filename, const BenchTiming* timings, int num_timings)
+{
+	FILE* file = fopen(filename, "w");
+
+	if (!file)
+	{
+		printf("Failed to write %s\n", filename);
+		return false;
+	}
+
+	fprintf(file, "frame,frame_ms,world_ms,imbalance,steals\n");
+
+	for (int i = 0; i < num_timings; i++)
+	{
+		const BenchTiming* t = &timings[i];
+
+		fprintf(file, "%i,%.4f,%.4f,%.3f,%i\n", i, t->frame_ms, t->world_ms, t->imbalance, t->num_steals);
+	}
+
+	return fclose(file) == 0;
+}
+
+static void Bench_PrintSummary(const char* name, float* values, int count)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	double total = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		total += values[i];
+	}
+
+	qsort(values, count, sizeof(float), CompareFloats);
+
+	printf("%-6s mean %.3f ms  median %.3f ms  p95 %.3f ms  min %.3f ms  max %.3f ms\n", name, total / count, values[count / 2], values[(count * 95) / 100], values[0], values[count - 1]);
+}
+
+static bool Bench_SetColumnKernel(const char* name)
+{
+	if (!name)
+	{
+		return true;
+	}
+
+	for (int i = 0; i < COLUMN_KERNEL__MAX; i++)
+	{
+		if (!strcmp(name, Video_GetColumnKernelName(i)))
+		{
+			if (!Video_SetColumnKernel(i))
+			{
+				printf("Column kernel %s is not supported on this cpu\n", name);
+				return false;
+			}
+			return true;
+		}
+	}
+
+	printf("Unknown column kernel %s\n", name);
+
+	return false;
+}
+
+void Bench_DefaultConfig(BenchConfig* config)
+{
+	memset(config, 0, sizeof(BenchConfig));
+
+	config->map_path = "assets/map/map0.json";
+	config->scale = 1;
+	config->frames = 240;
+	config->warmup = 10;
+	config->mode = "bench";
+}
+
+//headless renderer, assets and the map, ready to render the camera path
+static bool Bench_LoadLevel(const BenchConfig* config, int width, int height)
+{
+	if (!Render_InitHeadless(width, height))
+	{
+		printf("Failed to init headless renderer\n");
+		return false;
+	}
+
+	Render_SetThreadCount(config->threads);
+	Render_SetPaletteMode(config->palette);
+	Video_SetMipmaps(!config->no_mipmaps);
+	Video_SetSpriteOcclusion(!config->no_sprite_culling);
+
+	if (!Bench_SetColumnKernel(config->column_kernel))
+	{
+		Render_ShutDown();
+		return false;
+	}
+
+	if (!Game_LoadAssets())
+	{
+		printf("Failed to load game assets\n");
+		Render_ShutDown();
+		return false;
+	}
+
+	if (!Map_Load(config->map_path))
+	{
+		printf("Failed to load map %s\n", config->map_path);
+		Game_DestructAssets();
+		Render_ShutDown();
+		return false;
+	}
+
+	Player_Init(false);
+	Game_SetState(GS__LEVEL);
+
+	return true;
+}
+
+static BenchFrame* Bench_LoadFrames(const BenchConfig* config, float aspect, int* r_num_frames)
+{
+	if (config->path_file)
+	{
+		return Bench_LoadPath(config->path_file, aspect, r_num_frames);
+	}
+
+	*r_num_frames = max(config->frames, 1);
+
+	return Bench_GeneratePath(*r_num_frames, aspect);
+}
+
+//what the benches that run on the level get, set up and torn down by Bench_RunMode
+typedef struct
+{
+	int width, height;
+	BenchFrame* frames;
+	int num_frames;
+} BenchLevel;
+
+//one timed pass of a method, returns the seconds spent in the measured part
+typedef double (*BenchPassFun)(void* data, int method);
+
+/*
+	Runs every method passes times and keeps the best time of each.
+	The methods take turns within a pass, so they all see about the same cache and clock state.
+*/
+static void Bench_BestTimes(int passes, int num_methods, BenchPassFun fun, void* data, double* r_best_times)
+{
+	for (int method = 0; method < num_methods; method++)
+	{
+		r_best_times[method] = 1e9;
+	}
+
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (int method = 0; method < num_methods; method++)
+		{
+			r_best_times[method] = min(r_best_times[method], fun(data, method));
+		}
+	}
+}
+
+static int Bench_SetupFailed(const char* name)
+{
+	printf("Failed to set up the %s bench\n", name);
+	return -1;
+}
+
+static void Bench_RenderFrames(const BenchConfig* config, const BenchLevel* level, BenchTiming* timings, float* values)
+{
+	const BenchFrame* frames = level->frames;
+	int num_frames = level->num_frames;
+
+	printf("Bench: %s, %i frames at %ix%i, %i render threads, %s columns%s%s%s\n", config->map_path, num_frames, level->width, level->height, Render_GetStats()->num_threads, Video_GetColumnKernelName(Video_GetColumnKernel()), (config->palette) ? ", 8 bit palette" : "", (config->no_mipmaps) ? ", no mipmaps" : "", (config->no_sprite_culling) ? ", no sprite culling" : "");
+
+	//warm up caches and let the thread pool settle
+	for (int i = 0; i < config->warmup; i++)
+	{
+		const BenchFrame* frame = &frames[i % num_frames];
+
+		Map_UpdateObjectViews(frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y);
+		Render_View(frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y);
+	}
+
+	double start_time = Sys_GetTime();
+
+	for (int i = 0; i < num_frames; i++)
+	{
+		const BenchFrame* frame = &frames[i];
+
+		Map_UpdateObjectViews(frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y);
+		Render_View(frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y);
+
+		const RenderStats* stats = Render_GetStats();
+
+		timings[i].frame_ms = stats->frame_ms;
+		timings[i].world_ms = stats->world_ms;
+		timings[i].imbalance = stats->imbalance;
+		timings[i].num_steals = stats->num_steals;
+
+		if (config->dump_dir)
+		{
+			char filename[512];
+			snprintf(filename, sizeof(filename), "%s/frame_%04i.ppm", config->dump_dir, i);
+
+			if (!Image_SaveToPath(Render_GetFramebuffer(), filename))
+			{
+				printf("Failed to write %s\n", filename);
+			}
+		}
+	}
+
+	double total_time = Sys_GetTime() - start_time;
+
+	printf("Rendered %i frames in %.3f s\n", num_frames, total_time);
+
+	for (int i = 0; i < num_frames; i++) values[i] = timings[i].frame_ms;
+	Bench_PrintSummary("frame", values, num_frames);
+
+	for (int i = 0; i < num_frames; i++) values[i] = timings[i].world_ms;
+	Bench_PrintSummary("world", values, num_frames);
+
+	if (config->csv_path)
+	{
+		Bench_WriteCSV(config->csv_path, timings, num_frames);
+	}
+}
+
+//renders the camera path and prints the frame times
+static int Bench_RunFrames(const BenchConfig* config, const BenchLevel* level)
+{
+	BenchTiming* timings = calloc(level->num_frames, sizeof(BenchTiming));
+	float* values = calloc(level->num_frames, sizeof(float));
+
+	int result = (timings && values) ? 0 : Bench_SetupFailed("frame");
+
+	if (result == 0)
+	{
+		Bench_RenderFrames(config, level, timings, values);
+	}
+
+	free(timings);
+	free(values);
+
+	return result;
+}
+
+typedef struct
+{
+	int map_x, map_y;
+	int side;
+	float wall_dist;
+} BenchRayHit;
+
+//the walk Video_SetupSpans did before the ray table, every column divides in double and float
+static void Bench_CastRaysFloat(const BenchFrame* frame, int width, int map_width, int map_height, BenchRayHit* r_hits)
+{
+	for (int x = 0; x < width; x++)
+	{
+		double cam_x = 2.0 * x / (double)width - 1.0;
+
+		float ray_dir_x = frame->dir_x + frame->plane_x * cam_x;
+		float ray_dir_y = frame->dir_y + frame->plane_y * cam_x;
+
+		float delta_dist_x = (ray_dir_x == 0) ? 1e30 : fabs(1.0 / ray_dir_x);
+		float delta_dist_y = (ray_dir_y == 0) ? 1e30 : fabs(1.0 / ray_dir_y);
+
+		int map_x = (int)frame->x;
+		int map_y = (int)frame->y;
+
+		int step_x = (ray_dir_x < 0) ? -1 : 1;
+		int step_y = (ray_dir_y < 0) ? -1 : 1;
+
+		float side_dist_x = (ray_dir_x < 0) ? (frame->x - map_x) * delta_dist_x : (map_x + 1.0 - frame->x) * delta_dist_x;
+		float side_dist_y = (ray_dir_y < 0) ? (frame->y - map_y) * delta_dist_y : (map_y + 1.0 - frame->y) * delta_dist_y;
+
+		BenchRayHit* hit = &r_hits[x];
+		int side = 0;
+
+		hit->side = -1;
+
+		while (true)
+		{
+			if (side_dist_x < side_dist_y)
+			{
+				side_dist_x += delta_dist_x;
+				map_x += step_x;
+				side = 0;
+			}
+			else
+			{
+				side_dist_y += delta_dist_y;
+				map_y += step_y;
+				side = 1;
+			}
+
+			if (map_x < 0 || map_y < 0 || map_x >= map_width || map_y >= map_height)
+			{
+				break;
+			}
+			if (Map_GetTile(map_x, map_y) != EMPTY_TILE)
+			{
+				hit->map_x = map_x;
+				hit->map_y = map_y;
+				hit->side = side;
+				hit->wall_dist = (side == 0) ? side_dist_x - delta_dist_x : side_dist_y - delta_dist_y;
+				break;
+			}
+		}
+	}
+}
+
+//same walk as Video_SetupSpans
+static void Bench_CastRaysFixed(const BenchFrame* frame, const RayTable* ray_table, int width, int map_width, int map_height, BenchRayHit* r_hits)
+{
+	Ray rays[RAY_BATCH];
+
+	for (int x = 0; x < width; x++)
+	{
+		int batch_index = x % RAY_BATCH;
+
+		if (batch_index == 0)
+		{
+			Video_SetupRays(ray_table, x, min(RAY_BATCH, width - x), frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y, rays);
+		}
+
+		const Ray* ray = &rays[batch_index];
+
+		int32_t side_dist_x = ray->side_x;
+		int32_t side_dist_y = ray->side_y;
+
+		int map_x = (int)frame->x;
+		int map_y = (int)frame->y;
+
+		int step_x = (ray->dir_x < 0) ? -1 : 1;
+		int step_y = (ray->dir_y < 0) ? -1 : 1;
+
+		BenchRayHit* hit = &r_hits[x];
+		int side = 0;
+
+		hit->side = -1;
+
+		while (true)
+		{
+			if (side_dist_x < side_dist_y)
+			{
+				side_dist_x += ray->delta_x;
+				map_x += step_x;
+				side = 0;
+			}
+			else
+			{
+				side_dist_y += ray->delta_y;
+				map_y += step_y;
+				side = 1;
+			}
+
+			if (map_x < 0 || map_y < 0 || map_x >= map_width || map_y >= map_height)
+			{
+				break;
+			}
+			if (Map_GetTile(map_x, map_y) != EMPTY_TILE)
+			{
+				hit->map_x = map_x;
+				hit->map_y = map_y;
+				hit->side = side;
+				hit->wall_dist = ((side == 0) ? side_dist_x - ray->delta_x : side_dist_y - ray->delta_y) * (1.0f / (1 << RAY_FRAC_BITS));
+				break;
+			}
+		}
+	}
+}
+
+typedef struct
+{
+	const BenchLevel* level;
+	const RayTable* ray_table;
+	int map_width, map_height;
+	BenchRayHit* hits[2]; //float, fixed
+} BenchRaycastPass;
+
+static double Bench_RaycastPass(void* data, int method)
+{
+	BenchRaycastPass* pass = data;
+	const BenchLevel* level = pass->level;
+
+	double start_time = Sys_GetTime();
+
+	for (int i = 0; i < level->num_frames; i++)
+	{
+		if (method == 0)
+		{
+			Bench_CastRaysFloat(&level->frames[i], level->width, pass->map_width, pass->map_height, pass->hits[0]);
+		}
+		else
+		{
+			Bench_CastRaysFixed(&level->frames[i], pass->ray_table, level->width, pass->map_width, pass->map_height, pass->hits[1]);
+		}
+	}
+
+	return Sys_GetTime() - start_time;
+}
+
+static void Bench_CompareRaycasts(const BenchConfig* config, BenchRaycastPass* pass, int passes)
+{
+	const BenchLevel* level = pass->level;
+	int width = level->width;
+
+	printf("Raycast bench: %s, %i frames, %i columns, best of %i passes\n", config->map_path, level->num_frames, width, passes);
+
+	//hits that land on another tile or side, and the largest distance error of the rest
+	int mismatches = 0;
+	float max_error = 0;
+
+	for (int i = 0; i < level->num_frames; i++)
+	{
+		Bench_CastRaysFloat(&level->frames[i], width, pass->map_width, pass->map_height, pass->hits[0]);
+		Bench_CastRaysFixed(&level->frames[i], pass->ray_table, width, pass->map_width, pass->map_height, pass->hits[1]);
+
+		for (int x = 0; x < width; x++)
+		{
+			BenchRayHit* a = &pass->hits[0][x];
+			BenchRayHit* b = &pass->hits[1][x];
+
+			if (a->side != b->side || (a->side >= 0 && (a->map_x != b->map_x || a->map_y != b->map_y)))
+			{
+				mismatches++;
+			}
+			else if (a->side >= 0)
+			{
+				max_error = max(max_error, fabsf(a->wall_dist - b->wall_dist));
+			}
+		}
+	}
+
+	double best_times[2];
+	Bench_BestTimes(passes, 2, Bench_RaycastPass, pass, best_times);
+
+	const char* names[2] = { "float", "fixed 16.16" };
+
+	for (int method = 0; method < 2; method++)
+	{
+		double frame_ms = (best_times[method] * 1000.0) / level->num_frames;
+
+		printf("  %-12s %.3f ms per frame  %.1f ns per ray  %.2fx float\n", names[method], frame_ms, (frame_ms * 1e6) / width, best_times[0] / best_times[method]);
+	}
+
+	printf("  %i of %i rays hit another tile, largest distance difference %f\n", mismatches, level->num_frames * width, max_error);
+}
+
+/*
+	Casts every column of the camera path at render scale 3 against the map walls,
+	with the old per column float setup and with the ray table and 16.16 walk.
+	Only the walk to the first wall is timed, doors, lighting and drawing are left out.
+*/
+static int Bench_RunRaycast(const BenchConfig* config, const BenchLevel* level)
+{
+	const int passes = 20;
+
+	RayTable ray_table = { 0 };
+	BenchRaycastPass pass = { 0 };
+
+	pass.level = level;
+	pass.ray_table = &ray_table;
+	pass.hits[0] = malloc(sizeof(BenchRayHit) * level->width);
+	pass.hits[1] = malloc(sizeof(BenchRayHit) * level->width);
+
+	Map_GetSize(&pass.map_width, &pass.map_height);
+
+	int result = (pass.hits[0] && pass.hits[1] && Video_CreateRayTable(&ray_table, level->width)) ? 0 : Bench_SetupFailed("raycast");
+
+	if (result == 0)
+	{
+		Bench_CompareRaycasts(config, &pass, passes);
+	}
+
+	free(pass.hits[0]);
+	free(pass.hits[1]);
+	Video_DestroyRayTable(&ray_table);
+
+	return result;
+}
+
+static void Bench_SetupColumns(ColumnDraw* columns, unsigned char* target, float* depth_buffer, const unsigned char* texture, int tex_size, int width, int height, bool column_major)
+{
+	srand(BENCH_SEED);
+
+	for (int x = 0; x < width; x++)
+	{
+		ColumnDraw* col = &columns[x];
+
+		float wall_dist = 0.25 + Math_randf() * 8.0;
+		int column_height = (int)(height / wall_dist);
+		int draw_start = max(height / 2 - column_height / 2, 0);
+		int draw_end = min(height / 2 + column_height / 2, height);
+
+		float step = (float)tex_size / column_height;
+
+		int pixel = (column_major) ? draw_start + x * height : x + draw_start * width;
+
+		col->dst = target + pixel * 4;
+		col->depth = depth_buffer + pixel;
+		col->stride = (column_major) ? 1 : width;
+		col->count = draw_end - draw_start;
+		col->tex = texture + (x & (tex_size - 1)) * 4;
+		col->tex_stride = tex_size * 4;
+		col->tex_mask = tex_size - 1;
+		col->v = (uint32_t)(int)((draw_start - height / 2 + column_height / 2) * step * 65536.0f);
+		col->v_step = (uint32_t)(int)(step * 65536.0f);
+		col->light = 32 + (rand() % 224);
+		col->wall_dist = wall_dist;
+	}
+}
+
+typedef struct
+{
+	ColumnDraw* columns;
+	unsigned char* target;
+	float* depth_buffer;
+	int width, height;
+	int kernel;
+} BenchColumnPass;
+
+static double Bench_ColumnPass(void* data, int method)
+{
+	BenchColumnPass* pass = data;
+
+	memset(pass->target, 0, pass->width * pass->height * 4);
+	memset(pass->depth_buffer, (int)DEPTH_CLEAR, sizeof(float) * pass->width * pass->height);
+
+	double start_time = Sys_GetTime();
+
+	for (int x = 0; x < pass->width; x++)
+	{
+		Video_DrawColumnWith(pass->kernel, &pass->columns[x]);
+	}
+
+	return Sys_GetTime() - start_time;
+}
+
+static void Bench_CompareColumnKernels(BenchColumnPass* pass, unsigned char* reference, const unsigned char* texture, int tex_size, int passes)
+{
+	int width = pass->width;
+	int height = pass->height;
+
+	for (int layout = 0; layout < 2; layout++)
+	{
+		bool column_major = (layout == 1);
+
+		Bench_SetupColumns(pass->columns, pass->target, pass->depth_buffer, texture, tex_size, width, height, column_major);
+
+		long long total_pixels = 0;
+
+		for (int x = 0; x < width; x++)
+		{
+			total_pixels += pass->columns[x].count;
+		}
+
+		printf("Column bench, %s target: %i columns, %lli pixels per pass, best of %i passes\n", (column_major) ? "column major" : "row major", width, total_pixels, passes);
+
+		double scalar_time = 0;
+
+		for (int k = 0; k < COLUMN_KERNEL__MAX; k++)
+		{
+			if (!Video_IsColumnKernelSupported(k))
+			{
+				continue;
+			}
+
+			double best_time;
+
+			pass->kernel = k;
+			Bench_BestTimes(passes, 1, Bench_ColumnPass, pass, &best_time);
+
+			bool matches = true;
+
+			if (k == COLUMN_KERNEL__SCALAR)
+			{
+				scalar_time = best_time;
+				memcpy(reference, pass->target, width * height * 4);
+			}
+			else
+			{
+				matches = !memcmp(reference, pass->target, width * height * 4);
+			}
+
+			printf("  %-6s %.3f ms  %.1f Mpix/s  %.2fx scalar%s\n", Video_GetColumnKernelName(k), best_time * 1000.0, (total_pixels / best_time) / 1e6, scalar_time / best_time, (matches) ? "" : "  OUTPUT MISMATCH");
+		}
+	}
+}
+
+/*
+	Draws random wall columns into a render scale 3 sized target with every supported kernel.
+	The row major target is what Video_DrawCollumn draws into, the column major one shows
+	the kernels with contiguous stores.
+*/
+static int Bench_RunColumnKernels(const BenchConfig* config, const BenchLevel* level)
+{
+	const int tex_size = 64;
+	const int passes = 20;
+
+	int width = level->width;
+	int height = level->height;
+
+	Video_Setup();
+
+	BenchColumnPass pass = { 0 };
+
+	pass.width = width;
+	pass.height = height;
+	pass.target = malloc(width * height * 4);
+	pass.depth_buffer = malloc(sizeof(float) * width * height);
+	pass.columns = malloc(sizeof(ColumnDraw) * width);
+
+	unsigned char* reference = malloc(width * height * 4);
+	unsigned char* texture = malloc(tex_size * tex_size * 4);
+
+	int result = (pass.target && pass.depth_buffer && pass.columns && reference && texture) ? 0 : Bench_SetupFailed("column");
+
+	if (result == 0)
+	{
+		for (int i = 0; i < tex_size * tex_size * 4; i++)
+		{
+			texture[i] = rand() & 255;
+		}
+
+		Bench_CompareColumnKernels(&pass, reference, texture, tex_size, passes);
+	}
+
+	free(pass.target);
+	free(pass.depth_buffer);
+	free(pass.columns);
+	free(reference);
+	free(texture);
+
+	return result;
+}
+
+static volatile uint32_t s_benchSink;
+
+typedef struct
+{
+	int tex_x;
+	int tex_y;
+	int count;
+	uint32_t v;
+	uint32_t v_step;
+} BenchTexColumn;
+
+#define BENCH_LINE_SET_SIZE (1 << 17)
+
+//distinct cache lines touched over a whole pass, open addressing on the line address
+typedef struct
+{
+	uintptr_t* lines;
+	int count;
+} BenchLineSet;
+
+static void Bench_AddLine(BenchLineSet* set, uintptr_t line)
+{
+	if (!set->lines || set->count >= BENCH_LINE_SET_SIZE / 2)
+	{
+		return;
+	}
+
+	//zero marks an empty slot
+	line += 1;
+
+	uint32_t slot = (uint32_t)((line * 2654435761u) & (BENCH_LINE_SET_SIZE - 1));
+
+	while (set->lines[slot] != 0)
+	{
+		if (set->lines[slot] == line)
+		{
+			return;
+		}
+		slot = (slot + 1) & (BENCH_LINE_SET_SIZE - 1);
+	}
+
+	set->lines[slot] = line;
+	set->count++;
+}
+
+//reads every column like the wall and sprite drawers do, returns a checksum so the reads are not optimized out
+static uint32_t Bench_ReadTextureColumns(Image* img, const BenchTexColumn* columns, int num_columns, int rect_height, bool mipmapped, long long* r_cache_lines, BenchLineSet* r_touched)
+{
+	const int channels = img->numChannels;
+
+	uint32_t sum = 0;
+	long long cache_lines = 0;
+
+	for (int i = 0; i < num_columns; i++)
+	{
+		const BenchTexColumn* col = &columns[i];
+
+		//same level selection as the wall drawer
+		int level = (mipmapped) ? Image_SelectMipLevel(img, col->v_step / 65536.0f) : 0;
+
+		Image* mip = Image_GetMipLevel(img, level);
+
+		const int tex_stride = Image_YStride(mip) * channels;
+		const int last_row = (rect_height >> level) - 1;
+
+		const unsigned char* tex_column = mip->data + Image_PixelIndex(mip, col->tex_x >> level, col->tex_y >> level) * channels;
+
+		uintptr_t last_line = 0;
+		uint32_t v = col->v >> level;
+		uint32_t v_step = col->v_step >> level;
+
+		for (int y = 0; y < col->count; y++)
+		{
+			int row = (int)(v >> 16);
+
+			if (row > last_row) row = last_row;
+
+			const unsigned char* texel = tex_column + row * tex_stride;
+
+			sum += texel[0] + texel[channels - 1];
+
+			if (r_cache_lines)
+			{
+				uintptr_t line = (uintptr_t)texel / CACHE_LINE_SIZE;
+
+				if (y == 0 || line != last_line)
+				{
+					cache_lines++;
+
+					if (r_touched)
+					{
+						Bench_AddLine(r_touched, line);
+					}
+				}
+				last_line = line;
+			}
+
+			v += v_step;
+		}
+	}
+
+	if (r_cache_lines)
+	{
+		*r_cache_lines = cache_lines;
+	}
+
+	return sum;
+}
+
+typedef struct
+{
+	Image* img;
+	const BenchTexColumn* columns;
+	int num_columns;
+	int rect_height;
+	bool mipmapped;
+} BenchTexturePass;
+
+static double Bench_TexturePass(void* data, int method)
+{
+	BenchTexturePass* pass = data;
+
+	double start_time = Sys_GetTime();
+
+	s_benchSink += Bench_ReadTextureColumns(pass->img, pass->columns, pass->num_columns, pass->rect_height, pass->mipmapped, NULL, NULL);
+
+	return Sys_GetTime() - start_time;
+}
+
+static int Bench_RunTextureLayout(const char* path, int h_frames, int v_frames, int width, int height, int passes)
+{
+	//row major, column major, column major with mip levels
+	Image images[3];
+
+	if (!Image_CreateFromPath(&images[0], path))
+	{
+		printf("Failed to load %s\n", path);
+		return -1;
+	}
+	for (int i = 1; i < 3; i++)
+	{
+		if (!Image_CreateFromPath(&images[i], path))
+		{
+			for (int k = 0; k < i; k++)
+			{
+				Image_Destruct(&images[k]);
+			}
+			printf("Failed to load %s\n", path);
+			return -1;
+		}
+	}
+
+	images[2].h_frames = h_frames;
+	images[2].v_frames = v_frames;
+
+	Image_GenerateMipmaps(&images[2]);
+
+	Image_SetColumnMajor(&images[1], true);
+	Image_SetColumnMajor(&images[2], true);
+
+	int rect_width = images[0].width / max(h_frames, 1);
+	int rect_height = images[0].height / max(v_frames, 1);
+
+	BenchTexColumn* columns = malloc(sizeof(BenchTexColumn) * width);
+
+	if (!columns)
+	{
+		Image_Destruct(&images[0]);
+		Image_Destruct(&images[1]);
+		Image_Destruct(&images[2]);
+		return -1;
+	}
+
+	srand(BENCH_SEED);
+
+	long long total_texels = 0;
+
+	//random frames and distances, neighbouring screen columns read neighbouring texture columns like a wall does
+	for (int x = 0; x < width; x++)
+	{
+		BenchTexColumn* col = &columns[x];
+
+		//squared so near walls stay common, the tail reaches across a large open map
+		float dist = 0.25 + Math_randf() * Math_randf() * 64.0;
+		int column_height = max((int)(height / dist), 1);
+
+		int frame_x = rand() % max(h_frames, 1);
+		int frame_y = rand() % max(v_frames, 1);
+
+		col->tex_x = frame_x * rect_width + (x % rect_width);
+		col->tex_y = frame_y * rect_height;
+		col->count = min(column_height, height);
+		col->v = (uint32_t)(((column_height - col->count) / 2) * ((double)rect_height / column_height) * 65536.0);
+		col->v_step = (uint32_t)(((double)rect_height / column_height) * 65536.0);
+
+		total_texels += col->count;
+	}
+
+	printf("%s: %ix%i, %i columns, %lli texels per pass\n", path, images[0].width, images[0].height, width, total_texels);
+
+	double row_time = 0;
+	uint32_t checksums[2];
+
+	for (int layout = 0; layout < 3; layout++)
+	{
+		Image* img = &images[layout];
+		bool mipmapped = (layout == 2);
+
+		long long cache_lines = 0;
+		BenchLineSet touched;
+
+		touched.lines = calloc(BENCH_LINE_SET_SIZE, sizeof(uintptr_t));
+		touched.count = 0;
+
+		uint32_t checksum = Bench_ReadTextureColumns(img, columns, width, rect_height, mipmapped, &cache_lines, &touched);
+
+		int touched_lines = touched.count;
+
+		free(touched.lines);
+
+		if (!mipmapped)
+		{
+			checksums[layout] = checksum;
+		}
+
+		BenchTexturePass pass = { img, columns, width, rect_height, mipmapped };
+		double best_time;
+
+		Bench_BestTimes(passes, 1, Bench_TexturePass, &pass, &best_time);
+
+		if (layout == 0)
+		{
+			row_time = best_time;
+		}
+
+		const char* name = (mipmapped) ? "mipmapped" : (img->column_major) ? "column major" : "row major";
+
+		printf("  %-12s %.3f ms  %.1f Mtexel/s  %.1f cache lines per column  %i KB touched  %.2fx row major\n", name, best_time * 1000.0, (total_texels / best_time) / 1e6, (double)cache_lines / width, (touched_lines * CACHE_LINE_SIZE) / 1024, row_time / best_time);
+	}
+
+	if (checksums[0] != checksums[1])
+	{
+		printf("  LAYOUT MISMATCH\n");
+	}
+
+	free(columns);
+	Image_Destruct(&images[0]);
+	Image_Destruct(&images[1]);
+	Image_Destruct(&images[2]);
+
+	return 0;
+}
+
+/*
+	Reads wall and monster texture columns from row major and column major copies of the same image,
+	and from a column major copy that picks a mip level per column like the renderer.
+	Cache lines per column counts the distinct lines a column walk touches, which is the miss count on a cold cache.
+	KB touched is the distinct lines of the whole pass, the memory traffic when the texture does not fit in cache.
+*/
+static int Bench_RunTextureLayouts(const BenchConfig* config, const BenchLevel* level)
+{
+	const int width = level->width;
+	const int height = level->height;
+	const int passes = 20;
+
+	printf("Texture layout bench, best of %i passes\n", passes);
+
+	int result = 0;
+
+	result |= Bench_RunTextureLayout("assets/textures/walls.png", 7, 1, width, height, passes);
+	result |= Bench_RunTextureLayout("assets/textures/bruiser.png", 12, 7, width, height, passes);
+	result |= Bench_RunTextureLayout("assets/textures/pinky_sheet.png", 8, 6, width, height, passes);
+
+	return result;
+}
+
+#define BENCH_HITSCAN_SHOTS 12 //a shotgun blast and a few machinegun bullets per frame
+#define BENCH_HITSCAN_RANGE 10
+#define BENCH_CROWD_RADIUS 12
+
+//the closest monster near the crosshair, scanning every sorted object again after a blocked line, as Player_TraceBullet did
+static Object* Bench_TraceBulletScan(Object* src, int render_w)
+{
+	int half_w = render_w / 2;
+	int center_x = (half_w) - 1;
+	int shoot_delta = render_w / 8;
+
+	Map* map = Map_GetMap();
+
+	Object* closest = NULL;
+	Object* prev_closest = NULL;
+
+	float max_dist = FLT_MAX;
+
+	while (true)
+	{
+		prev_closest = closest;
+
+		for (int i = 0; i < map->num_sorted_objects; i++)
+		{
+			Object* object = Map_GetSortedObject(i);
+
+			float view_x, view_y;
+			Map_GetObjectView(object, &view_x, &view_y);
+
+			if (view_y <= 0)
+			{
+				continue;
+			}
+
+			int screen_x = (int)((half_w) * (1 + view_x / view_y));
+
+			if (object->type == OT__MONSTER && object->hp > 0 && abs(screen_x - center_x) < shoot_delta)
+			{
+				float dist = (src->x - object->x) * (src->x - object->x) + (src->y - object->y) * (src->y - object->y);
+
+				if (dist < max_dist)
+				{
+					max_dist = dist;
+					closest = object;
+				}
+			}
+		}
+
+		if (closest == prev_closest)
+		{
+			return NULL;
+		}
+
+		if (Object_CheckLineToTarget(src, closest))
+		{
+			break;
+		}
+	}
+
+	if (max_dist >= BENCH_HITSCAN_RANGE * BENCH_HITSCAN_RANGE)
+	{
+		return NULL;
+	}
+
+	return closest;
+}
+
+//fills empty tiles around a point with monsters until there are num_monsters of them
+static int Bench_SpawnCrowd(float center_x, float center_y, int sub_type, int num_monsters, int num_spawned)
+{
+	int map_width, map_height;
+	Map_GetSize(&map_width, &map_height);
+
+	int tries = 0;
+
+	while (num_spawned < num_monsters && tries++ < num_monsters * 64)
+	{
+		int x = (int)center_x + (rand() % (BENCH_CROWD_RADIUS * 2 + 1)) - BENCH_CROWD_RADIUS;
+		int y = (int)center_y + (rand() % (BENCH_CROWD_RADIUS * 2 + 1)) - BENCH_CROWD_RADIUS;
+
+		if (x < 0 || y < 0 || x >= map_width || y >= map_height)
+		{
+			continue;
+		}
+		if (Map_GetTile(x, y) != EMPTY_TILE || Map_GetObjectAtTile(x, y))
+		{
+			continue;
+		}
+
+		Object* monster = Object_Spawn(OT__MONSTER, sub_type, x + 0.5, y + 0.5);
+
+		if (!monster)
+		{
+			break;
+		}
+
+		Map_UpdateObjectTile(monster);
+		num_spawned++;
+	}
+
+	return num_spawned;
+}
+
+typedef struct
+{
+	const BenchLevel* level;
+	Object* player;
+} BenchHitscanPass;
+
+//moves the player to the frame, the views are updated outside the timed part, the game does that every frame anyway
+static float Bench_AimHitscan(Object* player, const BenchFrame* frame)
+{
+	player->x = frame->x;
+	player->y = frame->y;
+
+	Map_UpdateObjectViews(frame->x, frame->y, frame->dir_x, frame->dir_y, frame->plane_x, frame->plane_y);
+
+	return 0.25f * sqrtf(frame->plane_x * frame->plane_x + frame->plane_y * frame->plane_y) / sqrtf(frame->dir_x * frame->dir_x + frame->dir_y * frame->dir_y);
+}
+
+static double Bench_HitscanPass(void* data, int method)
+{
+	BenchHitscanPass* pass = data;
+	const BenchLevel* level = pass->level;
+
+	double time = 0;
+
+	for (int i = 0; i < level->num_frames; i++)
+	{
+		const BenchFrame* frame = &level->frames[i];
+
+		float spread = Bench_AimHitscan(pass->player, frame);
+
+		double start_time = Sys_GetTime();
+
+		for (int shot = 0; shot < BENCH_HITSCAN_SHOTS; shot++)
+		{
+			if (method == 0)
+			{
+				Bench_TraceBulletScan(pass->player, level->width);
+			}
+			else
+			{
+				Trace_Hitscan(pass->player, frame->dir_x, frame->dir_y, spread, BENCH_HITSCAN_RANGE, NULL);
+			}
+		}
+
+		time += Sys_GetTime() - start_time;
+	}
+
+	return time;
+}
+
+/*
+	Fires a shotgun blast and a few machinegun bullets every frame of the camera path into growing crowds of monsters,
+	once with the old scan over every sorted object and once with the grid walk of Trace_Hitscan.
+*/
+static int Bench_RunHitscan(const BenchConfig* config, const BenchLevel* level)
+{
+	const int passes = 5;
+	const int crowds[] = { 16, 64, 256, 1024 };
+
+	BenchHitscanPass pass = { level, Player_GetObj() };
+
+	if (!pass.player)
+	{
+		return Bench_SetupFailed("hitscan");
+	}
+
+	printf("Hitscan bench: %s, %i frames, %i shots per frame, best of %i passes\n", config->map_path, level->num_frames, BENCH_HITSCAN_SHOTS, passes);
+
+	int num_spawned = 0;
+
+	for (size_t c = 0; c < sizeof(crowds) / sizeof(crowds[0]); c++)
+	{
+		num_spawned = Bench_SpawnCrowd(pass.player->x, pass.player->y, SUB__MOB_IMP, crowds[c], num_spawned);
+
+		int mismatches = 0;
+		int hits = 0;
+
+		for (int i = 0; i < level->num_frames; i++)
+		{
+			const BenchFrame* frame = &level->frames[i];
+
+			float spread = Bench_AimHitscan(pass.player, frame);
+
+			Object* scan_hit = Bench_TraceBulletScan(pass.player, level->width);
+			Object* trace_hit = Trace_Hitscan(pass.player, frame->dir_x, frame->dir_y, spread, BENCH_HITSCAN_RANGE, NULL);
+
+			if (trace_hit) hits++;
+			if (scan_hit != trace_hit) mismatches++;
+		}
+
+		double best_times[2];
+		Bench_BestTimes(passes, 2, Bench_HitscanPass, &pass, best_times);
+
+		int num_shots = level->num_frames * BENCH_HITSCAN_SHOTS;
+
+		printf("  %5i monsters  scan %8.3f us per shot  grid walk %8.3f us per shot  %6.2fx  %i of %i frames hit, %i picked another monster\n", num_spawned,
+			(best_times[0] * 1e6) / num_shots, (best_times[1] * 1e6) / num_shots, best_times[0] / max(best_times[1], 1e-9), hits, level->num_frames, mismatches);
+	}
+
+	return 0;
+}
+
+#define BENCH_SIGHT_INVALIDATE_TICKS 30 //a door opening or closing about every half second
+
+typedef struct
+{
+	const BenchLevel* level;
+	Object* player;
+	int num_visible[2]; //traced, cached
+} BenchSightPass;
+
+static double Bench_SightPass(void* data, int method)
+{
+	BenchSightPass* pass = data;
+	const BenchLevel* level = pass->level;
+	Object* player = pass->player;
+	Map* map = Map_GetMap();
+
+	Sight_SetCache(method == 1);
+
+	int num_visible = 0;
+
+	double start_time = Sys_GetTime();
+
+	for (int i = 0; i < level->num_frames; i++)
+	{
+		player->x = level->frames[i].x;
+		player->y = level->frames[i].y;
+
+		if (i % BENCH_SIGHT_INVALIDATE_TICKS == 0)
+		{
+			Sight_Invalidate();
+		}
+
+		for (int k = 0; k < map->num_sorted_objects; k++)
+		{
+			Object* obj = Map_GetSortedObject(k);
+
+			if (obj->type == OT__MONSTER)
+			{
+				Sight_QueueLine(obj, player);
+			}
+		}
+
+		Sight_ResolveQueue();
+
+		for (int k = 0; k < map->num_sorted_objects; k++)
+		{
+			Object* obj = Map_GetSortedObject(k);
+
+			if (obj->type == OT__MONSTER && Object_CheckLineToTarget(obj, player))
+			{
+				num_visible++;
+			}
+		}
+	}
+
+	double time = Sys_GetTime() - start_time;
+
+	pass->num_visible[method] = num_visible;
+
+	return time;
+}
+
+/*
+	Every monster checks the line to the player every frame of the camera path, as idle monsters do,
+	once tracing every line and once with the sight cache, the lines queued and traced together before the checks.
+	The cache is dropped every BENCH_SIGHT_INVALIDATE_TICKS frames, as if a door moved.
+*/
+static int Bench_RunSight(const BenchConfig* config, const BenchLevel* level)
+{
+	const int passes = 5;
+	const int crowds[] = { 16, 64, 256, 1024 };
+
+	BenchSightPass pass = { level, Player_GetObj() };
+
+	if (!pass.player)
+	{
+		return Bench_SetupFailed("sight");
+	}
+
+	printf("Sight bench: %s, %i frames, %i render threads, best of %i passes\n", config->map_path, level->num_frames, Render_GetStats()->num_threads, passes);
+
+	int num_spawned = 0;
+
+	for (size_t c = 0; c < sizeof(crowds) / sizeof(crowds[0]); c++)
+	{
+		num_spawned = Bench_SpawnCrowd(pass.player->x, pass.player->y, SUB__MOB_IMP, crowds[c], num_spawned);
+
+		double best_times[2];
+		Bench_BestTimes(passes, 2, Bench_SightPass, &pass, best_times);
+
+		printf("  %5i monsters  traced %8.3f us per frame  cached %8.3f us per frame  %6.2fx  %i and %i lines clear\n", num_spawned,
+			(best_times[0] * 1e6) / level->num_frames, (best_times[1] * 1e6) / level->num_frames, best_times[0] / max(best_times[1], 1e-9), pass.num_visible[0], pass.num_visible[1]);
+	}
+
+	Sight_SetCache(true);
+
+	return 0;
+}
+
+#define BENCH_FLOW_TICKS 1800 //thirty seconds at 60 ticks per second
+#define BENCH_FLOW_REBUILDS 200
+#define BENCH_FLOW_CROWD_OFFSET 14 //the crowd starts south of the player, on the test maps that is behind a wall with a door
+
+/*
+	Every monster of a crowd chases the player for BENCH_FLOW_TICKS game ticks, once heading straight at the player
+	and once following the flow field. A tick where the walk of a monster was blocked counts as stuck, those lead to Move_Unstuck.
+	The level is loaded again for each run so both start from the same crowd.
+*/
+static int Bench_RunFlow(const BenchConfig* config, const BenchLevel* level)
+{
+	const int crowds[] = { 16, 64, 256 };
+	const float delta = 1.0f / 60.0f;
+
+	printf("Flow bench: %s, %i ticks, %i render threads\n", config->map_path, BENCH_FLOW_TICKS, Render_GetStats()->num_threads);
+
+	int result = 0;
+
+	for (size_t c = 0; c < sizeof(crowds) / sizeof(crowds[0]) && result == 0; c++)
+	{
+		double tick_times[2] = { 0, 0 };
+		int stuck_ticks[2] = { 0, 0 };
+		double mean_dist[2] = { 0, 0 };
+		int num_spawned = 0;
+		double rebuild_time = 0;
+
+		for (int method = 0; method < 2; method++)
+		{
+			if (!Map_Load(config->map_path))
+			{
+				printf("Failed to load map %s\n", config->map_path);
+				result = -1;
+				break;
+			}
+
+			Player_Init(false);
+
+			Object* player = Player_GetObj();
+			Map* map = Map_GetMap();
+
+			if (!player)
+			{
+				result = -1;
+				break;
+			}
+
+			//the crowd only comes for the player, it should not die halfway
+			player->hp = 1 << 30;
+
+			//open every door for good, the crowd has to find them
+			for (int k = 0; k < map->num_objects; k++)
+			{
+				Object* obj = Map_GetObjectByIndex(k);
+
+				if (obj->type == OT__DOOR)
+				{
+					obj->state = DOOR_OPEN;
+					obj->flags |= OBJ_FLAG__DOOR_NEVER_CLOSE;
+				}
+			}
+
+			srand(BENCH_SEED);
+			num_spawned = Bench_SpawnCrowd(player->x, player->y + BENCH_FLOW_CROWD_OFFSET, SUB__MOB_PINKY, crowds[c], 0);
+
+			Flow_SetEnabled(method == 1);
+
+			//the crowd is spawned, later objects are missiles and particles
+			int num_objects = map->num_objects;
+			float* last_stuck = malloc(sizeof(float) * num_objects);
+
+			if (!last_stuck)
+			{
+				result = -1;
+				break;
+			}
+
+			for (int k = 0; k < num_objects; k++)
+			{
+				Object* obj = Map_GetObjectByIndex(k);
+
+				if (obj && obj->type == OT__MONSTER)
+				{
+					obj->target = player;
+					last_stuck[k] = obj->stuck_timer;
+				}
+			}
+
+			for (int tick = 0; tick < BENCH_FLOW_TICKS; tick++)
+			{
+				double start_time = Sys_GetTime();
+
+				Map_UpdateObjects(delta);
+
+				tick_times[method] += Sys_GetTime() - start_time;
+
+				for (int k = 0; k < num_objects; k++)
+				{
+					Object* obj = Map_GetObjectByIndex(k);
+
+					if (!obj || obj->type != OT__MONSTER || obj->hp <= 0)
+					{
+						continue;
+					}
+
+					//the timer only grows when the walk is blocked
+					if (obj->stuck_timer > last_stuck[k])
+					{
+						stuck_ticks[method]++;
+					}
+
+					last_stuck[k] = obj->stuck_timer;
+				}
+			}
+
+			int num_monsters = 0;
+
+			for (int k = 0; k < num_objects; k++)
+			{
+				Object* obj = Map_GetObjectByIndex(k);
+
+				if (obj && obj->type == OT__MONSTER)
+				{
+					mean_dist[method] += sqrtf((obj->x - player->x) * (obj->x - player->x) + (obj->y - player->y) * (obj->y - player->y));
+					num_monsters++;
+				}
+			}
+
+			mean_dist[method] /= max(num_monsters, 1);
+
+			free(last_stuck);
+
+			//a full search from the player's tile, as when a door moves
+			if (method == 1)
+			{
+				double start_time = Sys_GetTime();
+
+				for (int i = 0; i < BENCH_FLOW_REBUILDS; i++)
+				{
+					Flow_Invalidate();
+					Flow_Update(player);
+				}
+
+				rebuild_time = (Sys_GetTime() - start_time) / BENCH_FLOW_REBUILDS;
+			}
+		}
+
+		if (result != 0)
+		{
+			break;
+		}
+
+		printf("  %5i monsters  direct %8.2f us per tick %7i stuck ticks %6.2f tiles away  flow %8.2f us per tick %7i stuck ticks %6.2f tiles away  %.2f us per search\n", num_spawned,
+			(tick_times[0] * 1e6) / BENCH_FLOW_TICKS, stuck_ticks[0], mean_dist[0], (tick_times[1] * 1e6) / BENCH_FLOW_TICKS, stuck_ticks[1], mean_dist[1], rebuild_time * 1e6);
+	}
+
+	Flow_SetEnabled(true);
+
+	return result;
+}
+
+#define BENCH_LIGHT_TICKS 600
+#define BENCH_LIGHT_RADIUS 2 //the glow of a missile
+
+typedef struct
+{
+	const int* open_tiles;
+	int num_open_tiles;
+	int map_w, map_h;
+	int num_lights;
+	long long lit_tiles;
+} BenchTempLightPass;
+
+static double Bench_TempLightPass(void* data, int method)
+{
+	BenchTempLightPass* pass = data;
+	Map* map = Map_GetMap();
+
+	int map_w = pass->map_w;
+
+	srand(BENCH_SEED);
+
+	pass->lit_tiles = 0;
+
+	double start_time = Sys_GetTime();
+
+	for (int tick = 0; tick < BENCH_LIGHT_TICKS; tick++)
+	{
+		int back = !map->temp_light_front;
+
+		if (method == 0)
+		{
+			Render_LockThreadsMutex();
+			memset(map->temp_lights[back], 0, (size_t)map_w * pass->map_h);
+			Render_UnlockThreadsMutex();
+
+			map->num_temp_light_tiles[back] = 0;
+		}
+
+		for (int i = 0; i < pass->num_lights; i++)
+		{
+			int tile = pass->open_tiles[rand() % pass->num_open_tiles];
+
+			Map_SetTempLight(tile % map_w, tile / map_w, BENCH_LIGHT_RADIUS, 255);
+		}
+
+		pass->lit_tiles += map->num_temp_light_tiles[back];
+
+		if (method == 0)
+		{
+			map->temp_light_front = back;
+			map->num_temp_light_tiles[back] = 0;
+		}
+		else
+		{
+			Map_SwapTempLights();
+		}
+	}
+
+	return Sys_GetTime() - start_time;
+}
+
+static void Bench_CompareTempLights(const BenchConfig* config, BenchTempLightPass* pass, int passes)
+{
+	const int num_lights[] = { 1, 4, 16, 64 };
+
+	printf("Temp light bench: %s, %ix%i tiles, %i ticks, best of %i passes\n", config->map_path, pass->map_w, pass->map_h, BENCH_LIGHT_TICKS, passes);
+
+	for (size_t c = 0; c < sizeof(num_lights) / sizeof(num_lights[0]); c++)
+	{
+		double best_times[2];
+
+		pass->num_lights = num_lights[c];
+		Bench_BestTimes(passes, 2, Bench_TempLightPass, pass, best_times);
+
+		printf("  %3i lights  %6.1f tiles lit  full clear %8.3f us per tick  lit tiles only %8.3f us per tick  %6.2fx\n", num_lights[c], (double)pass->lit_tiles / BENCH_LIGHT_TICKS,
+			(best_times[0] * 1e6) / BENCH_LIGHT_TICKS, (best_times[1] * 1e6) / BENCH_LIGHT_TICKS, best_times[0] / max(best_times[1], 1e-9));
+	}
+}
+
+/*
+	A number of temp lights, like missiles in flight, move to random open tiles every tick.
+	Once the old way, the whole layer cleared under the render thread lock before it is lit again,
+	and once with the lit tiles kept per buffer and only those cleared.
+*/
+static int Bench_RunTempLight(const BenchConfig* config, const BenchLevel* level)
+{
+	const int passes = 5;
+
+	BenchTempLightPass pass = { 0 };
+	Map_GetSize(&pass.map_w, &pass.map_h);
+
+	int* open_tiles = malloc(sizeof(int) * pass.map_w * pass.map_h);
+
+	for (int i = 0; open_tiles && i < pass.map_w * pass.map_h; i++)
+	{
+		if (Map_GetTile(i % pass.map_w, i / pass.map_w) == EMPTY_TILE)
+		{
+			open_tiles[pass.num_open_tiles++] = i;
+		}
+	}
+
+	pass.open_tiles = open_tiles;
+
+	int result = (open_tiles && pass.num_open_tiles > 0 && Map_GetMap()->temp_lights[0]) ? 0 : Bench_SetupFailed("temp light");
+
+	if (result == 0)
+	{
+		Bench_CompareTempLights(config, &pass, passes);
+	}
+
+	free(open_tiles);
+
+	return result;
+}
+
+#define BENCH_BAKE_MAX_THREADS 64
+
+typedef struct
+{
+	LightTile* serial_tiles;
+	LightTile* parallel_tiles;
+	size_t size;
+	bool same; //every parallel bake so far matched the serial one
+} BenchBakePass;
+
+static double Bench_SerialBakePass(void* data, int method)
+{
+	BenchBakePass* pass = data;
+
+	double start_time = Sys_GetTime();
+
+	Map_BakeLight(pass->serial_tiles, false);
+
+	return Sys_GetTime() - start_time;
+}
+
+static double Bench_ParallelBakePass(void* data, int method)
+{
+	BenchBakePass* pass = data;
+
+	double start_time = Sys_GetTime();
+
+	Map_BakeLight(pass->parallel_tiles, true);
+
+	double time = Sys_GetTime() - start_time;
+
+	pass->same = pass->same && !memcmp(pass->serial_tiles, pass->parallel_tiles, pass->size);
+
+	return time;
+}
+
+static void Bench_CompareLightBakes(const BenchConfig* config, BenchBakePass* pass, int passes)
+{
+	int map_w, map_h;
+	Map_GetSize(&map_w, &map_h);
+
+	int num_lights = 0;
+
+	for (int i = 0; i < Map_GetMap()->num_objects; i++)
+	{
+		Object* obj = Map_GetObjectByIndex(i);
+
+		if (obj && obj->type == OT__LIGHT)
+		{
+			num_lights++;
+		}
+	}
+
+	printf("Light bake bench: %s, %ix%i tiles, %i lights, best of %i passes\n", config->map_path, map_w, map_h, num_lights, passes);
+
+	double serial_time;
+	Bench_BestTimes(passes, 1, Bench_SerialBakePass, pass, &serial_time);
+
+	printf("  serial           %8.3f ms\n", serial_time * 1000.0);
+
+	int max_threads = min(max(Sys_GetNumCores(), 1), BENCH_BAKE_MAX_THREADS);
+
+	for (int threads = 1; threads <= max_threads; threads *= 2)
+	{
+		Render_SetThreadCount(threads);
+
+		double best_time;
+
+		pass->same = true;
+		Bench_BestTimes(passes, 1, Bench_ParallelBakePass, pass, &best_time);
+
+		//the calling thread works too
+		printf("  %2i render threads %8.3f ms  %6.2fx  %s\n", Render_GetStats()->num_threads, best_time * 1000.0, serial_time / max(best_time, 1e-9), (pass->same) ? "same as serial" : "DIFFERS FROM SERIAL");
+	}
+}
+
+/*
+	Bakes the light of the map again, once on the calling thread alone and then on a growing number of
+	render threads. Every parallel bake is checked against the serial one.
+*/
+static int Bench_RunLightBake(const BenchConfig* config, const BenchLevel* level)
+{
+	const int passes = 5;
+
+	int map_w, map_h;
+	Map_GetSize(&map_w, &map_h);
+
+	BenchBakePass pass = { 0 };
+
+	pass.size = sizeof(LightTile) * map_w * map_h;
+	pass.serial_tiles = malloc(pass.size);
+	pass.parallel_tiles = malloc(pass.size);
+
+	int result = (pass.serial_tiles && pass.parallel_tiles && Map_BakeLight(pass.serial_tiles, false)) ? 0 : Bench_SetupFailed("light bake");
+
+	if (result == 0)
+	{
+		Bench_CompareLightBakes(config, &pass, passes);
+	}
+
+	free(pass.serial_tiles);
+	free(pass.parallel_tiles);
+
+	return result;
+}
+
+typedef int (*BenchModeFun)(const BenchConfig* config, const BenchLevel* level);
+
+typedef struct
+{
+	const char* name; //the command line flag without the dash
+	BenchModeFun fun;
+	int scale; //render scale, 0 takes the one from the config
+	bool on_level; //needs the assets, the map and the camera path
+} BenchMode;
+
+static const BenchMode BENCH_MODES[] =
+{
+	{ "bench", Bench_RunFrames, 0, true },
+	{ "colbench", Bench_RunColumnKernels, MAX_RENDER_SCALE, false }, //the column kernel microbenchmark
+	{ "texbench", Bench_RunTextureLayouts, MAX_RENDER_SCALE, false }, //row and column major texture reads
+	{ "raybench", Bench_RunRaycast, MAX_RENDER_SCALE, true }, //the ray walk on its own
+	{ "hitbench", Bench_RunHitscan, 1, true }, //bullet traces into crowds of monsters
+	{ "sightbench", Bench_RunSight, 1, true }, //the monster line of sight checks
+	{ "flowbench", Bench_RunFlow, 1, true }, //monsters chasing with and without the flow field
+	{ "lightbench", Bench_RunTempLight, 1, true }, //the temp lights
+	{ "bakebench", Bench_RunLightBake, 1, true }, //the light bake on growing thread counts
+};
+
+static const BenchMode* Bench_FindMode(const char* name)
+{
+	for (size_t i = 0; name && i < sizeof(BENCH_MODES) / sizeof(BENCH_MODES[0]); i++)
+	{
+		if (!strcmp(name, BENCH_MODES[i].name))
+		{
+			return &BENCH_MODES[i];
+		}
+	}
+
+	return NULL;
+}
+
+bool Bench_IsMode(const char* name)
+{
+	return Bench_FindMode(name) != NULL;
+}
+
+int Bench_RunMode(const BenchConfig* config)
+{
+	const BenchMode* mode = Bench_FindMode(config->mode);
+
+	if (!mode)
+	{
+		printf("Unknown bench %s\n", (config->mode) ? config->mode : "");
+		return -1;
+	}
+
+	int scale = (mode->scale > 0) ? mode->scale : config->scale;
+
+	if (scale < 1) scale = 1;
+	else if (scale > MAX_RENDER_SCALE) scale = MAX_RENDER_SCALE;
+
+	BenchLevel level = { 0 };
+
+	level.width = BASE_RENDER_WIDTH * scale;
+	level.height = BASE_RENDER_HEIGHT * scale;
+
+	srand(BENCH_SEED);
+
+	if (!mode->on_level)
+	{
+		return mode->fun(config, &level);
+	}
+
+	if (!Bench_LoadLevel(config, level.width, level.height))
+	{
+		return -1;
+	}
+
+	level.frames = Bench_LoadFrames(config, (float)level.width / (float)level.height, &level.num_frames);
+
+	int result = -1;
+
+	if (!level.frames || level.num_frames <= 0)
+	{
+		printf("No camera frames to render\n");
+	}
+	else
+	{
+		result = mode->fun(config, &level);
+	}
+
+	free(level.frames);
+	Map_Destruct();
+	Game_DestructAssets();
+	Render_ShutDown();
+
+	return result;
+}
@@ -0,0 +1,28 @@
+#ifndef BENCH_H
+#define BENCH_H
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct
+{
+	const char* map_path;
+	const char* path_file; //camera path, one frame per line as "x y dir_x dir_y plane_x plane_y" or "x y angle"
+	const char* dump_dir; //write every frame as a ppm when set
+	const char* csv_path; //per frame timings when set
+	int scale;
+	int threads; //0 means one per core
+	int frames; //length of the generated path when no path file is given
+	int warmup;
+	const char* column_kernel; //force a column kernel by name
+	bool palette; //draw the world with the 8 bit palette pipeline
+	bool no_mipmaps; //always sample the full size textures
+	bool no_sprite_culling; //draw the sprites that are hidden behind walls too
+	const char* mode; //which bench runs, named like its command line flag, "bench" renders the camera path
+} BenchConfig;
+
+void Bench_DefaultConfig(BenchConfig* config);
+bool Bench_IsMode(const char* name);
+int Bench_RunMode(const BenchConfig* config);
+
+#endif
@@ -11,8 +11,6 @@
 //For shadow casting
 #define SHADOW_CHECK_OCTS 8
 #define SHADOW_CHECK_HISTORY_MAX 1000
-
-static uint64_t SHADOW_CHECK_HISTORY_BITSET[SHADOW_CHECK_HISTORY_MAX];
 static const int SHADOW_MULTIPLES[4][8] = 
 {
 	{1,  0,  0, -1, -1,  0,  0,  1},
@@ -34,31 +32,32 @@ void Explosion(Object* obj, float size, int damage)
 	{
 		for (int y = y1; y < y2; y++)
 		{
-			Object* tile_object = Map_GetObjectAtTile(x, y);
+			Object* next = NULL;
 
-			if (!tile_object)
+			//take the next object first, hurting can delete this one
+			for (Object* tile_object = Map_GetObjectAtTile(x, y); tile_object; tile_object = next)
 			{
-				continue;
-			}
+				next = Map_GetNextTileObject(tile_object);
 
-			//ignore self
-			if (tile_object == obj)
-			{
-				continue;
-			}
-			//ignore owner
-			if (tile_object == obj->owner)
-			{
-				continue;
-			}
+				//ignore self
+				if (tile_object == obj)
+				{
+					continue;
+				}
+				//ignore owner
+				if (tile_object == obj->owner)
+				{
+					continue;
+				}
 
-			//only affects monsters and player
-			if (tile_object->type == OT__MONSTER) 
-			{
-				//check straight line between explosion center and object
-				if (Object_CheckLineToTarget(obj, tile_object))
+				//only affects monsters and player
+				if (tile_object->type == OT__MONSTER)
 				{
-					Object_Hurt(tile_object, obj, damage);
+					//check straight line between explosion center and object
+					if (Object_CheckLineToTarget(obj, tile_object))
+					{
+						Object_Hurt(tile_object, obj, damage);
+					}
 				}
 			}
 		}
@@ -85,9 +84,7 @@ bool Move_CheckStep(Object* obj, float p_stepX, float p_stepY, float p_size)
 				return false;
 			}
 
-			Object* tile_object = Map_GetObjectAtTile(x, y);
-
-			if (tile_object != NULL)
+			for (Object* tile_object = Map_GetObjectAtTile(x, y); tile_object; tile_object = Map_GetNextTileObject(tile_object))
 			{
 				//ignore self
 				if (tile_object == obj)
@@ -183,9 +180,7 @@ bool Move_CheckArea(Object* obj, float x, float y, float size)
 				return false;
 			}
 
-			Object* tile_object = Map_GetObjectAtTile(x, y);
-
-			if (tile_object != NULL)
+			for (Object* tile_object = Map_GetObjectAtTile(x, y); tile_object; tile_object = Map_GetNextTileObject(tile_object))
 			{
 				//ignore self
 				if (tile_object == obj)
@@ -343,26 +338,24 @@ bool Move_Door(Object* obj, float delta)
 	{
 		just_moved = true;
 
-		Map* map = Map_GetMap();
-		
-		//lazy check all objects if we can move safely
-		//since we dont allow objects to take doors tile
-		//need to seperate static and moving tiles
-		for (int i = 0; i < map->num_objects; i++)
+		//anything standing in the doorway keeps the door from moving
+		for (Object* tile_obj = Map_GetObjectAtTile(obj->x, obj->y); tile_obj; tile_obj = Map_GetNextTileObject(tile_obj))
 		{
-			Object* map_obj = &map->objects[i];
-
-			if (map_obj == obj)
+			if (tile_obj == obj)
 			{
 				continue;
 			}
-	
-			if ((int)map_obj->x == obj->x && (int)map_obj->y == (int)obj->y || obj->col_object == map_obj)
-			{
-				obj->state = DOOR_SLEEP;
-				obj->stop_timer = 0;
-				return false;
-			}
+
+			obj->state = DOOR_SLEEP;
+			obj->stop_timer = 0;
+			return false;
+		}
+
+		if (obj->col_object && obj->col_object != obj)
+		{
+			obj->state = DOOR_SLEEP;
+			obj->stop_timer = 0;
+			return false;
 		}
 	}
 
@@ -452,8 +445,8 @@ void Missile_Update(Object* obj, float delta)
 		return;
 	}
 
-	//Map_SetDirtyTempLight();
-	//Map_SetTempLight(obj->x, obj->y, 2, 255);
+	//glow around the missile, only lasts this update
+	Map_SetTempLight(obj->x, obj->y, 2, 255);
 
 	float speed = missile_info->speed * delta;
 
@@ -592,7 +585,164 @@ bool Trace_LineVsObject(float p_x, float p_y, float p_endX, float p_endY, Object
 	return true;
 }
 
-static void ShadowCastRecursive(int x, int y, int x_max, int y_max, int radius, int octant, int row, float start_slope, float end_slope, int xx, int xy, int yx, int yy, IsVisibleFun is_visible_fun)
+#define HITSCAN_MAX_REJECTED 16
+
+static Object* Trace_HitscanTile(Object* src, int x, int y, float p_x, float p_y, float dir_x, float dir_y, float spread, float range, Object* best, float* r_bestAlong, Object** rejected, int* r_numRejected)
+{
+	for (Object* tile_obj = Map_GetObjectAtTile(x, y); tile_obj; tile_obj = Map_GetNextTileObject(tile_obj))
+	{
+		if (tile_obj->type != OT__MONSTER || tile_obj->hp <= 0 || tile_obj == src || tile_obj == best)
+		{
+			continue;
+		}
+
+		float to_x = tile_obj->x - p_x;
+		float to_y = tile_obj->y - p_y;
+
+		//distance along the ray and away from it
+		float along = to_x * dir_x + to_y * dir_y;
+		float across = fabsf(to_x * dir_y - to_y * dir_x);
+
+		if (along <= 0 || along > range || along >= *r_bestAlong)
+		{
+			continue;
+		}
+		if (across > along * spread)
+		{
+			continue;
+		}
+
+		//neighbouring tiles are looked at more than once, don't trace the same line again
+		bool was_rejected = false;
+
+		for (int i = 0; i < *r_numRejected; i++)
+		{
+			if (rejected[i] == tile_obj)
+			{
+				was_rejected = true;
+				break;
+			}
+		}
+
+		if (was_rejected)
+		{
+			continue;
+		}
+
+		if (!Object_CheckLineToTarget(src, tile_obj))
+		{
+			if (*r_numRejected < HITSCAN_MAX_REJECTED)
+			{
+				rejected[(*r_numRejected)++] = tile_obj;
+			}
+			continue;
+		}
+
+		best = tile_obj;
+		*r_bestAlong = along;
+	}
+
+	return best;
+}
+
+/*
+	Walks the ray from src once with a grid DDA and returns the nearest living monster that src can see,
+	that is within range and inside the cone of the ray. The cone widens by spread tiles per tile of distance.
+	Monsters are linked to the tile of their center, so every tile of the walk also looks at the tiles around it
+	as far as the cone reaches. The walk stops at the first wall, closed door or special tile,
+	or once it is past the best monster found so far.
+*/
+Object* Trace_Hitscan(Object* src, float dir_x, float dir_y, float spread, float range, float* r_along)
+{
+	float length = sqrtf(dir_x * dir_x + dir_y * dir_y);
+
+	if (length <= 0)
+	{
+		return NULL;
+	}
+
+	dir_x /= length;
+	dir_y /= length;
+
+	const float p_x = src->x;
+	const float p_y = src->y;
+
+	int map_w, map_h;
+	Map_GetSize(&map_w, &map_h);
+
+	float delta_dist_x = (dir_x == 0) ? 1e30 : fabsf(1.0f / dir_x);
+	float delta_dist_y = (dir_y == 0) ? 1e30 : fabsf(1.0f / dir_y);
+
+	int map_x = (int)p_x;
+	int map_y = (int)p_y;
+
+	int step_x = (dir_x < 0) ? -1 : 1;
+	int step_y = (dir_y < 0) ? -1 : 1;
+
+	float side_dist_x = (dir_x < 0) ? (p_x - map_x) * delta_dist_x : (map_x + 1.0f - p_x) * delta_dist_x;
+	float side_dist_y = (dir_y < 0) ? (p_y - map_y) * delta_dist_y : (map_y + 1.0f - p_y) * delta_dist_y;
+
+	Object* best = NULL;
+	float best_along = FLT_MAX;
+
+	Object* rejected[HITSCAN_MAX_REJECTED];
+	int num_rejected = 0;
+
+	float tile_enter = 0;
+
+	while (tile_enter <= range && tile_enter < best_along)
+	{
+		if (map_x < 0 || map_y < 0 || map_x >= map_w || map_y >= map_h)
+		{
+			break;
+		}
+
+		//walls and closed doors end the walk
+		if (Map_GetTile(map_x, map_y) != EMPTY_TILE)
+		{
+			break;
+		}
+
+		Object* tile_obj = Map_GetObjectAtTile(map_x, map_y);
+
+		if (tile_obj && tile_obj != src && Object_IsSpecialCollidableTile(tile_obj))
+		{
+			break;
+		}
+
+		float tile_exit = min(side_dist_x, side_dist_y);
+
+		//how many tiles around this one the cone can reach
+		int reach = 1 + (int)(min(tile_exit, range) * spread);
+
+		for (int y = map_y - reach; y <= map_y + reach; y++)
+		{
+			for (int x = map_x - reach; x <= map_x + reach; x++)
+			{
+				best = Trace_HitscanTile(src, x, y, p_x, p_y, dir_x, dir_y, spread, range, best, &best_along, rejected, &num_rejected);
+			}
+		}
+
+		tile_enter = tile_exit;
+
+		if (side_dist_x < side_dist_y)
+		{
+			side_dist_x += delta_dist_x;
+			map_x += step_x;
+		}
+		else
+		{
+			side_dist_y += delta_dist_y;
+			map_y += step_y;
+		}
+	}
+
+	if (r_along) *r_along = best_along;
+
+	return best;
+}
+
+static void ShadowCastRecursive(int x, int y, int x_max, int y_max, int radius, int octant, int row, float start_slope, float end_slope, int xx, int xy, int yx, int yy, uint64_t* history, IsVisibleFun is_visible_fun, void* data)
 {
 	if (start_slope < end_slope)
 	{
@@ -669,15 +819,15 @@ static void ShadowCastRecursive(int x, int y, int x_max, int y_max, int radius,
 				//bounds check just in case, but probably should be enough
 				if (mask_index < SHADOW_CHECK_HISTORY_MAX)
 				{
-					if (!(SHADOW_CHECK_HISTORY_BITSET[mask_index] & mask))
+					if (!(history[mask_index] & mask))
 					{
-						SHADOW_CHECK_HISTORY_BITSET[mask_index] |= mask;
-						is_visible_fun(x, y, ax, ay);
+						history[mask_index] |= mask;
+						is_visible_fun(x, y, ax, ay, data);
 					}
 				}
 				else
 				{
-					is_visible_fun(x, y, ax, ay);
+					is_visible_fun(x, y, ax, ay, data);
 				}
 				
 			}
@@ -699,7 +849,7 @@ static void ShadowCastRecursive(int x, int y, int x_max, int y_max, int radius,
 			{
 				blocked = true;
 				next_start_slope = r_slope;
-				ShadowCastRecursive(x, y, x_max, y_max, radius, octant, i + 1, start_slope, l_slope, xx, xy, yx, yy, is_visible_fun);
+				ShadowCastRecursive(x, y, x_max, y_max, radius, octant, i + 1, start_slope, l_slope, xx, xy, yx, yy, history, is_visible_fun, data);
 			}
 		}
 		
@@ -711,15 +861,26 @@ static void ShadowCastRecursive(int x, int y, int x_max, int y_max, int radius,
 	}
 }
 
-void Trace_ShadowCast(int x, int y, int radius, IsVisibleFun is_visible_fun)
+void Trace_ShadowCast(int x, int y, int radius, IsVisibleFun is_visible_fun, void* data)
 {
 	//adapted from https://jordansavant.com/book/algorithms/shadowcasting.md
-	is_visible_fun(x, y, x, y);
+	is_visible_fun(x, y, x, y, data);
+
+	//on the stack, lights are cast from several threads at once
+	uint64_t history[SHADOW_CHECK_HISTORY_MAX];
 
 	int dim = radius * 2 - 1;
 	int size = dim * dim;
 
-	memset(SHADOW_CHECK_HISTORY_BITSET, 0, sizeof(SHADOW_CHECK_HISTORY_BITSET));
+	//only the words of the square around the center are used
+	int num_words = (size + 63) / 64;
+
+	if (num_words > SHADOW_CHECK_HISTORY_MAX)
+	{
+		num_words = SHADOW_CHECK_HISTORY_MAX;
+	}
+
+	memset(history, 0, sizeof(uint64_t) * num_words);
 
 	int map_w, map_h;
 	Map_GetSize(&map_w, &map_h);
@@ -729,7 +890,7 @@ void Trace_ShadowCast(int x, int y, int radius, IsVisibleFun is_visible_fun)
 
 	for (int oct = 0; oct < SHADOW_CHECK_OCTS; oct++)
 	{
-		ShadowCastRecursive(x, y, x_max, y_max, radius, oct, 1, 1.0, 0.0, SHADOW_MULTIPLES[0][oct], SHADOW_MULTIPLES[1][oct], SHADOW_MULTIPLES[2][oct], SHADOW_MULTIPLES[3][oct], is_visible_fun);
+		ShadowCastRecursive(x, y, x_max, y_max, radius, oct, 1, 1.0, 0.0, SHADOW_MULTIPLES[0][oct], SHADOW_MULTIPLES[1][oct], SHADOW_MULTIPLES[2][oct], SHADOW_MULTIPLES[3][oct], history, is_visible_fun, data);
 	}
 }
 
@@ -7,14 +7,26 @@
 #include <GLFW/glfw3.h>
 
 #include "r_common.h"
+#include "u_sys.h"
 
 
 #define EMPTY_TILE 0
 #define DOOR_TILE 2
 #define NULL_INDEX -1
-#define MAX_OBJECTS 1024
 #define TILE_SIZE 64
 
+//objects are allocated in chunks that never move, so object pointers stay valid when the pool grows
+#define OBJECT_CHUNK_SHIFT 8
+#define OBJECT_CHUNK_SIZE (1 << OBJECT_CHUNK_SHIFT)
+#define MAX_OBJECT_CHUNKS 1024
+#define MAX_OBJECTS (OBJECT_CHUNK_SIZE * MAX_OBJECT_CHUNKS)
+
+//an object id is the pool index in the low bits and the generation of the slot above it,
+//an id that is kept after its object is deleted doesn't resolve to the next object in the slot
+#define OBJECT_INDEX_BITS 18
+#define OBJECT_INDEX_MASK ((1 << OBJECT_INDEX_BITS) - 1)
+#define OBJECT_GENERATION_MASK ((1 << (31 - OBJECT_INDEX_BITS)) - 1)
+
 #define DOOR_SLEEP 0
 #define DOOR_OPEN 1
 #define DOOR_CLOSE 2
@@ -25,7 +37,7 @@
 #define MAX_RENDER_SCALE 3
 
 typedef int8_t TileID;
-typedef int16_t ObjectID;
+typedef int32_t ObjectID;
 
 typedef enum
 {
@@ -220,18 +232,18 @@ typedef enum
 	OBJ_FLAG__GODMODE = 1 << 5,
 } ObjectFlag;
 
-typedef struct
+typedef struct Object
 {
 	int map_id; 
 
 	int tile_index;
+	ObjectID tile_prev, tile_next; //other objects in the same tile
 	ObjectID id;
 	Sprite sprite;
 	ObjectType type;
 	SubType sub_type;
 
 	float x, y;
-	float view_x, view_y;
 	float dir_x, dir_y;
 	float size;
 	float speed;
@@ -263,12 +275,51 @@ typedef struct
 
 typedef struct
 {
-	uint8_t light;
-	uint8_t light_north;
-	uint8_t light_west;
-	uint8_t light_south;
-	uint8_t light_east;
-	uint8_t temp_light;
+	//what the view pass reads and writes every frame, kept out of the objects so the camera
+	//transform walks contiguous arrays instead of pulling whole objects through the cache
+	float sprite_x[OBJECT_CHUNK_SIZE];
+	float sprite_y[OBJECT_CHUNK_SIZE];
+	float view_x[OBJECT_CHUNK_SIZE]; //camera space, view_y is the depth
+	float view_y[OBJECT_CHUNK_SIZE];
+
+	Object objects[OBJECT_CHUNK_SIZE];
+	uint16_t generations[OBJECT_CHUNK_SIZE];
+
+	//the free and sorted lists are split over the chunks as well, entry i lives in chunk i / OBJECT_CHUNK_SIZE
+	ObjectID free_list[OBJECT_CHUNK_SIZE];
+	ObjectID sorted_list[OBJECT_CHUNK_SIZE];
+	int sorted_slots[OBJECT_CHUNK_SIZE]; //where the object is in the sorted list, NULL_INDEX if it isn't in it
+} ObjectChunk;
+
+/*
+	Baked light of a tile, sampled LIGHTMAP_SAMPLES times along each edge so the renderer can blend between the samples.
+	Open tiles keep a grid of samples for the floor and ceiling, the corners of the cells a tile is split into.
+	Wall tiles keep a row of samples for each face. Samples on a shared edge are stored by both tiles,
+	so a tile is blended without looking at its neighbours. A tile fills half a cache line.
+*/
+#define LIGHTMAP_SHIFT 2
+#define LIGHTMAP_CELLS (1 << LIGHTMAP_SHIFT)
+#define LIGHTMAP_SAMPLES (LIGHTMAP_CELLS + 1)
+#define LIGHTMAP_CENTER ((LIGHTMAP_SAMPLES * LIGHTMAP_SAMPLES) / 2)
+
+typedef enum
+{
+	LIGHT_FACE__WEST, //x = tile x
+	LIGHT_FACE__EAST, //x = tile x + 1
+	LIGHT_FACE__NORTH, //y = tile y
+	LIGHT_FACE__SOUTH, //y = tile y + 1
+	LIGHT_FACE__MAX
+} LightFace;
+
+typedef struct
+{
+	union
+	{
+		uint8_t floor[LIGHTMAP_SAMPLES * LIGHTMAP_SAMPLES]; //row by row
+		uint8_t faces[LIGHT_FACE__MAX][LIGHTMAP_SAMPLES]; //along x or y
+	};
+	uint8_t light; //tile center, for sprites
+	uint8_t padding[32 - LIGHTMAP_SAMPLES * LIGHTMAP_SAMPLES - 1];
 } LightTile;
 
 typedef struct
@@ -284,13 +335,26 @@ typedef struct
 
 	LightTile* light_tiles;
 
-	int num_objects;
-	Object objects[MAX_OBJECTS];
+	//region to region visibility, one bit per pair of regions. One set with every door open and one with every door closed
+	uint64_t* pvs_open;
+	uint64_t* pvs_closed;
+	int pvs_width, pvs_height;
+	int pvs_row_words;
+	int num_open_doors;
+
+	//light that only lasts a frame, like a missile's glow. Double buffered, the game thread lights the back buffer while the
+	//renderer reads the front one, and only the tiles a buffer lit are cleared before it is lit again
+	uint8_t* temp_lights[2];
+	int* temp_light_tiles[2];
+	int num_temp_light_tiles[2];
+	int temp_light_front;
+
+	//object pool, chunks are allocated as the level needs them
+	ObjectChunk* object_chunks[MAX_OBJECT_CHUNKS];
+	int num_object_chunks;
+	int num_objects; //slots handed out so far
 
-	ObjectID free_list[MAX_OBJECTS];
 	int num_free_list;
-
-	ObjectID sorted_list[MAX_OBJECTS];
 	int num_sorted_objects;
 
 	ObjectID* object_tiles;
@@ -303,21 +367,48 @@ typedef struct
 
 	int num_non_empty_tiles;
 
-	bool dirty_temp_light;
+	//set when the tiles and light tiles point into a compiled map
+	MappedFile file;
 } Map;
 
-void Map_SetDirtyTempLight();
+typedef struct
+{
+	bool compiled;
+	bool prefetched; //read on the loader thread
+	double read_ms;
+	double parse_ms;
+	double objects_ms;
+	double light_ms;
+	double pvs_ms;
+	double total_ms;
+	double stall_ms; //time the game thread spent on the load
+} MapLoadTimes;
+
 int Map_GetLevelIndex();
 Map* Map_GetMap();
 Object* Map_NewObject(ObjectType type);
+Object* Map_GetObject(ObjectID id);
+Object* Map_GetObjectByIndex(int index);
+Object* Map_GetSortedObject(int index);
+void Map_GetObjectView(const Object* obj, float* r_view_x, float* r_view_y);
 bool Map_LoadFromIndex(int index);
 bool Map_Load(const char* filename);
+void Map_CancelPrefetch();
+bool Map_Compile(const char* json_path, const char* out_path);
+bool Map_CompileFile(const char* json_path);
+bool Map_CompileLevels();
+const MapLoadTimes* Map_GetLoadTimes();
 TileID Map_GetTile(int x, int y);
 TileID Map_GetFloorTile(int x, int y);
 TileID Map_GetCeilTile(int x, int y);
 Object* Map_GetObjectAtTile(int x, int y);
+Object* Map_GetNextTileObject(const Object* obj);
 LightTile* Map_GetLightTile(int x, int y);
+bool Map_BakeLight(LightTile* light_tiles, bool parallel);
 void Map_SetTempLight(int x, int y, int size, int light);
+int Map_GetTempLight(int x, int y);
+void Map_SwapTempLights();
+bool Map_CheckPVS(float x, float y, float target_x, float target_y);
 TileID Map_Raycast(float p_x, float p_y, float dir_x, float dir_y, float* r_hitX, float* r_hitY);
 void Map_GetSize(int* r_width, int* r_height);
 void Map_GetSpawnPoint(int* r_x, int* r_y, float* r_rot);
@@ -326,6 +417,7 @@ int Map_GetTotalTiles();
 int Map_GetTotalNonEmptyTiles();
 void Map_DrawObjects(Image* image, float* depth_buffer, DrawSpan* draw_spans, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY);
 void Map_UpdateObjects(float delta);
+void Map_UpdateObjectViews(float view_x, float view_y, float dir_x, float dir_y, float plane_x, float plane_y);
 void Map_DeleteObject(Object* obj);
 void Map_Destruct();
 
@@ -364,9 +456,24 @@ void Missile_Explode(Object* obj);
 
 //Trace stuff
 bool Trace_LineVsObject(float p_x, float p_y, float p_endX, float p_endY, Object* obj, float* r_interX, float* r_interY);
+Object* Trace_Hitscan(Object* src, float dir_x, float dir_y, float spread, float range, float* r_along);
+bool Trace_CheckLine(float p_x, float p_y, float target_x, float target_y);
+
+typedef void (*IsVisibleFun)(int center_x, int center_y, int x, int y, void* data);
+void Trace_ShadowCast(int x, int y, int radius, IsVisibleFun is_visible_fun, void* data);
+
+//Sight stuff
+bool Sight_CheckLine(float x, float y, float target_x, float target_y);
+void Sight_QueueLine(Object* obj, Object* target);
+void Sight_ResolveQueue();
+void Sight_Invalidate();
+void Sight_SetCache(bool enable);
 
-typedef void (*IsVisibleFun)(int center_x, int center_y, int x, int y);
-void Trace_ShadowCast(int x, int y, int radius, IsVisibleFun is_visible_fun);
+//Flow stuff
+void Flow_Update(Object* target);
+bool Flow_GetStep(Object* obj, int* r_step_x, int* r_step_y);
+void Flow_Invalidate();
+void Flow_SetEnabled(bool enable);
 
 //Object stuff
 void Object_Hurt(Object* obj, Object* src_obj, int damage);
@@ -394,6 +501,7 @@ void Particle_Update(Object* obj, float delta);
 void Monster_Spawn(Object* obj);
 void Monster_SetState(Object* obj, int state);
 void Monster_Update(Object* obj, float delta);
+void Monster_QueueSight(Object* obj);
 void Monster_Imp_FireBall(Object* obj);
 void Monster_Bruiser_FireBall(Object* obj);
 void Monster_Melee(Object* obj);
@@ -0,0 +1,367 @@
+#include "g_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	Flow field toward the player. A monster is 0.5 in size, so its box always touches a 2x2 block of tiles.
+	The field is made of those blocks, one per tile with the tile in the top left corner, and a block is open
+	when all of its tiles are. A breadth first search from the blocks around the player's tile stores the walking
+	distance of every block it reaches, and a chasing monster steps to its neighbour with the lowest distance.
+	The search is shared by every monster and only runs again when the player enters another tile. The open blocks
+	are only found again when a door opens or closes or a static object is added or removed.
+	The search stops at FLOW_MAX_DISTANCE, monsters further away head straight at the player like before.
+	Blocks are stamped with the search they were reached in, so nothing has to be cleared between searches.
+*/
+
+#define FLOW_MAX_DISTANCE 256
+#define FLOW_BLOCK_SIZE 2
+
+typedef struct
+{
+	uint32_t epoch; //block was reached in this search
+	uint16_t distance;
+} FlowTile;
+
+typedef struct
+{
+	FlowTile* tiles;
+	bool* open_blocks;
+	int* queue;
+	int width, height;
+
+	int source_x, source_y;
+	uint32_t epoch;
+	bool dirty; //blocks have to be found again
+	bool searched;
+	bool disabled;
+} FlowField;
+
+static FlowField s_flow = { .dirty = true };
+
+static const int FLOW_STEPS_X[4] = { 1, -1, 0, 0 };
+static const int FLOW_STEPS_Y[4] = { 0, 0, 1, -1 };
+
+//static objects that stop a monster, mirrors Object_HandleObjectCollision
+static bool Flow_IsBlockingObject(Object* obj)
+{
+	if (obj->type == OT__PARTICLE || obj->type == OT__TARGET || obj->hp <= 0)
+	{
+		return false;
+	}
+
+	switch (obj->type)
+	{
+	case OT__DOOR:
+	{
+		return Object_IsSpecialCollidableTile(obj);
+	}
+	case OT__SPECIAL_TILE:
+	{
+		return obj->sub_type != SUB__SPECIAL_TILE_FAKE;
+	}
+	case OT__TRIGGER:
+	{
+		return obj->sub_type == SUB__TRIGGER_SWITCH;
+	}
+	case OT__LIGHT:
+	{
+		return obj->sub_type != SUB__LIGHT_LAMP;
+	}
+	//moving objects are not part of the field
+	case OT__PICKUP:
+	case OT__MISSILE:
+	case OT__MONSTER:
+	case OT__PLAYER:
+	{
+		return false;
+	}
+	default:
+		break;
+	}
+
+	return true;
+}
+
+static bool Flow_IsPassableTile(int x, int y)
+{
+	if (Map_GetTile(x, y) != EMPTY_TILE)
+	{
+		return false;
+	}
+
+	for (Object* obj = Map_GetObjectAtTile(x, y); obj; obj = Map_GetNextTileObject(obj))
+	{
+		if (Flow_IsBlockingObject(obj))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void Flow_Free()
+{
+	if (s_flow.tiles) free(s_flow.tiles);
+	if (s_flow.open_blocks) free(s_flow.open_blocks);
+	if (s_flow.queue) free(s_flow.queue);
+
+	s_flow.tiles = NULL;
+	s_flow.open_blocks = NULL;
+	s_flow.queue = NULL;
+	s_flow.width = 0;
+	s_flow.height = 0;
+}
+
+static bool Flow_Resize(int width, int height)
+{
+	if (s_flow.tiles && s_flow.width == width && s_flow.height == height)
+	{
+		return true;
+	}
+
+	Flow_Free();
+
+	s_flow.tiles = calloc((size_t)width * height, sizeof(FlowTile));
+	s_flow.open_blocks = malloc(sizeof(bool) * width * height);
+	s_flow.queue = malloc(sizeof(int) * width * height);
+
+	if (!s_flow.tiles || !s_flow.open_blocks || !s_flow.queue)
+	{
+		Flow_Free();
+		return false;
+	}
+
+	s_flow.width = width;
+	s_flow.height = height;
+	s_flow.epoch = 0;
+	s_flow.dirty = true;
+	s_flow.searched = false;
+
+	return true;
+}
+
+static void Flow_FindOpenBlocks()
+{
+	//tiles first, every tile is in up to four blocks
+	for (int y = 0; y < s_flow.height; y++)
+	{
+		for (int x = 0; x < s_flow.width; x++)
+		{
+			s_flow.open_blocks[x + y * s_flow.width] = Flow_IsPassableTile(x, y);
+		}
+	}
+
+	//in place, a block only looks at tiles below and to the right of it
+	for (int y = 0; y < s_flow.height; y++)
+	{
+		for (int x = 0; x < s_flow.width; x++)
+		{
+			bool open = (x + FLOW_BLOCK_SIZE <= s_flow.width) && (y + FLOW_BLOCK_SIZE <= s_flow.height);
+
+			for (int by = 0; by < FLOW_BLOCK_SIZE && open; by++)
+			{
+				for (int bx = 0; bx < FLOW_BLOCK_SIZE && open; bx++)
+				{
+					open = s_flow.open_blocks[(x + bx) + (y + by) * s_flow.width];
+				}
+			}
+
+			s_flow.open_blocks[x + y * s_flow.width] = open;
+		}
+	}
+}
+
+static inline const FlowTile* Flow_GetReachedTile(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= s_flow.width || y >= s_flow.height)
+	{
+		return NULL;
+	}
+
+	const FlowTile* tile = &s_flow.tiles[x + y * s_flow.width];
+
+	return (s_flow.searched && tile->epoch == s_flow.epoch) ? tile : NULL;
+}
+
+static void Flow_Search(int source_x, int source_y)
+{
+	s_flow.epoch++;
+
+	//wrapped around, old stamps could match again
+	if (s_flow.epoch == 0)
+	{
+		memset(s_flow.tiles, 0, sizeof(FlowTile) * s_flow.width * s_flow.height);
+		s_flow.epoch = 1;
+	}
+
+	int head = 0;
+	int tail = 0;
+
+	//every block the player's tile is in
+	for (int y = source_y - FLOW_BLOCK_SIZE + 1; y <= source_y; y++)
+	{
+		for (int x = source_x - FLOW_BLOCK_SIZE + 1; x <= source_x; x++)
+		{
+			if (x < 0 || y < 0 || !s_flow.open_blocks[x + y * s_flow.width])
+			{
+				continue;
+			}
+
+			FlowTile* tile = &s_flow.tiles[x + y * s_flow.width];
+
+			tile->epoch = s_flow.epoch;
+			tile->distance = 0;
+			s_flow.queue[tail++] = x + y * s_flow.width;
+		}
+	}
+
+	while (head < tail)
+	{
+		int index = s_flow.queue[head++];
+		int distance = s_flow.tiles[index].distance + 1;
+
+		if (distance > FLOW_MAX_DISTANCE)
+		{
+			continue;
+		}
+
+		int x = index % s_flow.width;
+		int y = index / s_flow.width;
+
+		for (int i = 0; i < 4; i++)
+		{
+			int nx = x + FLOW_STEPS_X[i];
+			int ny = y + FLOW_STEPS_Y[i];
+
+			if (nx < 0 || ny < 0 || nx >= s_flow.width || ny >= s_flow.height)
+			{
+				continue;
+			}
+
+			int next = nx + ny * s_flow.width;
+
+			if (s_flow.tiles[next].epoch == s_flow.epoch || !s_flow.open_blocks[next])
+			{
+				continue;
+			}
+
+			s_flow.tiles[next].epoch = s_flow.epoch;
+			s_flow.tiles[next].distance = distance;
+			s_flow.queue[tail++] = next;
+		}
+	}
+
+	s_flow.searched = true;
+}
+
+void Flow_Update(Object* target)
+{
+	if (s_flow.disabled || !target)
+	{
+		return;
+	}
+
+	int map_w, map_h;
+	Map_GetSize(&map_w, &map_h);
+
+	if (map_w <= 0 || map_h <= 0 || !Flow_Resize(map_w, map_h))
+	{
+		return;
+	}
+
+	int x = (int)target->x;
+	int y = (int)target->y;
+
+	if (x < 0 || y < 0 || x >= map_w || y >= map_h)
+	{
+		return;
+	}
+
+	if (s_flow.dirty)
+	{
+		Flow_FindOpenBlocks();
+	}
+	else if (s_flow.searched && x == s_flow.source_x && y == s_flow.source_y)
+	{
+		return;
+	}
+
+	Flow_Search(x, y);
+
+	s_flow.source_x = x;
+	s_flow.source_y = y;
+	s_flow.dirty = false;
+}
+
+bool Flow_GetStep(Object* obj, int* r_step_x, int* r_step_y)
+{
+	//top left tile of the box
+	float x = obj->x - obj->size;
+	float y = obj->y - obj->size;
+
+	if (s_flow.disabled || x < 0 || y < 0)
+	{
+		return false;
+	}
+
+	int tile_x = (int)x;
+	int tile_y = (int)y;
+
+	const FlowTile* tile = Flow_GetReachedTile(tile_x, tile_y);
+
+	if (!tile || tile->distance == 0)
+	{
+		return false;
+	}
+
+	int best_distance = tile->distance;
+	int best_x = 0;
+	int best_y = 0;
+
+	for (int step_y = -1; step_y <= 1; step_y++)
+	{
+		for (int step_x = -1; step_x <= 1; step_x++)
+		{
+			const FlowTile* next = Flow_GetReachedTile(tile_x + step_x, tile_y + step_y);
+
+			if (!next || next->distance >= best_distance)
+			{
+				continue;
+			}
+
+			//don't cut a corner, both sides of a diagonal step have to be open
+			if (step_x != 0 && step_y != 0 && (!Flow_GetReachedTile(tile_x + step_x, tile_y) || !Flow_GetReachedTile(tile_x, tile_y + step_y)))
+			{
+				continue;
+			}
+
+			best_distance = next->distance;
+			best_x = step_x;
+			best_y = step_y;
+		}
+	}
+
+	if (best_x == 0 && best_y == 0)
+	{
+		return false;
+	}
+
+	*r_step_x = best_x;
+	*r_step_y = best_y;
+
+	return true;
+}
+
+void Flow_Invalidate()
+{
+	s_flow.dirty = true;
+}
+
+void Flow_SetEnabled(bool enable)
+{
+	s_flow.disabled = !enable;
+	s_flow.dirty = true;
+	s_flow.searched = false;
+}
@@ -40,6 +40,7 @@ bool Game_Init()
 
 void Game_Exit()
 {
+	Map_CancelPrefetch();
 	Map_Destruct();
 
 	Game_DestructAssets();
@@ -142,13 +143,45 @@ bool Game_LoadAssets()
 	Image_GenerateFrameInfo(&assets.pistol_texture);
 	Image_GenerateFrameInfo(&assets.devastator_texture);
 
+	//mip levels for everything the world pass samples at a distance
 	Image_GenerateMipmaps(&assets.wall_textures);
+	Image_GenerateMipmaps(&assets.object_textures);
+	Image_GenerateMipmaps(&assets.imp_texture);
+	Image_GenerateMipmaps(&assets.missile_textures);
+	Image_GenerateMipmaps(&assets.pinky_texture);
+	Image_GenerateMipmaps(&assets.bruiser_texture);
+	Image_GenerateMipmaps(&assets.particle_textures);
+
+	//walls and world sprites are drawn in vertical columns, so store them column by column
+	Image_SetColumnMajor(&assets.wall_textures, true);
+	Image_SetColumnMajor(&assets.object_textures, true);
+	Image_SetColumnMajor(&assets.imp_texture, true);
+	Image_SetColumnMajor(&assets.missile_textures, true);
+	Image_SetColumnMajor(&assets.pinky_texture, true);
+	Image_SetColumnMajor(&assets.bruiser_texture, true);
+	Image_SetColumnMajor(&assets.particle_textures, true);
+
+	//palette for the 8 bit world pipeline
+	Image* world_textures[] =
+	{
+		&assets.wall_textures,
+		&assets.object_textures,
+		&assets.imp_texture,
+		&assets.missile_textures,
+		&assets.pinky_texture,
+		&assets.bruiser_texture,
+		&assets.particle_textures
+	};
+
+	Video_BuildPalette(world_textures, sizeof(world_textures) / sizeof(world_textures[0]));
 
 	return true;
 }
 
 void Game_DestructAssets()
 {
+	Video_DestroyPalette();
+
 	Image_Destruct(&assets.wall_textures);
 	Image_Destruct(&assets.object_textures);
 	Image_Destruct(&assets.shotgun_texture);
@@ -305,9 +338,8 @@ void Game_ChangeLevel()
 	}
 	else
 	{
-		const char* level = LEVELS[map->level_index];
-
-		Map_Load(level);
+		//usually read in the background while the last level was played
+		Map_LoadFromIndex(map->level_index);
 		Player_Init(true);
 
 		Game_SetState(GS__LEVEL_END);
@@ -334,9 +366,7 @@ void Game_Reset(bool to_start)
 		index = Map_GetLevelIndex();
 	}
 
-	const char* level = LEVELS[index];
-
-	Map_Load(level);
+	Map_LoadFromIndex(index);
 
 	Player_Init(false);
 
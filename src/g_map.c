@@ -5,76 +5,200 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <cjson/cJSON.h>
 #include "u_math.h"
 #include "game_info.h"
 
 #include "utility.h"
+#include "u_sys.h"
+#include "u_json.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MAP_X86
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MAP_NEON
+#include <arm_neon.h>
+#endif
 
 static Map s_map;
 
-static int CompareSpriteDistances(const void* a, const void* b)
+static inline Object* Map_ObjectAt(int index)
+{
+	return &s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT]->objects[index & (OBJECT_CHUNK_SIZE - 1)];
+}
+
+static inline ObjectID* Map_SortedListEntry(int index)
 {
-	Sprite* arg1 = *(Sprite**)a;
-	Sprite* arg2 = *(Sprite**)b;
+	return &s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT]->sorted_list[index & (OBJECT_CHUNK_SIZE - 1)];
+}
 
-	if (arg1->dist > arg2->dist) return -1;
-	if (arg1->dist < arg2->dist) return 1;
+static inline ObjectID* Map_FreeListEntry(int index)
+{
+	return &s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT]->free_list[index & (OBJECT_CHUNK_SIZE - 1)];
+}
 
-	return 0;
+static inline int* Map_SortedSlot(int index)
+{
+	return &s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT]->sorted_slots[index & (OBJECT_CHUNK_SIZE - 1)];
 }
 
-static void Map_ClearTempLight()
+//the player is left out, it's updated and drawn on its own
+static void Map_AddToSortedList(const Object* obj)
 {
-	Render_LockThreadsMutex();
+	int index = obj->id & OBJECT_INDEX_MASK;
 
-	for (int x = 0; x < s_map.width; x++)
+	if (obj->type == OT__NONE
+		|| obj->type == OT__PLAYER)
 	{
-		for (int y = 0; y < s_map.height; y++)
-		{
-			LightTile* light_tile = Map_GetLightTile(x, y);
+		*Map_SortedSlot(index) = NULL_INDEX;
+		return;
+	}
 
-			light_tile->temp_light = 0;
-		}
+	*Map_SortedListEntry(s_map.num_sorted_objects) = obj->id;
+	*Map_SortedSlot(index) = s_map.num_sorted_objects++;
+}
+
+//the last entry is moved into the hole, so the list isn't kept in index order
+static void Map_RemoveFromSortedList(int index)
+{
+	int slot = *Map_SortedSlot(index);
+
+	if (slot < 0)
+	{
+		return;
+	}
+
+	int last = --s_map.num_sorted_objects;
+
+	if (slot != last)
+	{
+		ObjectID moved_id = *Map_SortedListEntry(last);
+
+		*Map_SortedListEntry(slot) = moved_id;
+		*Map_SortedSlot(moved_id & OBJECT_INDEX_MASK) = slot;
 	}
 
-	Render_UnlockThreadsMutex();
-	Render_RedrawWalls();
+	*Map_SortedSlot(index) = NULL_INDEX;
 }
-static void Map_UpdateSortedList()
+
+/*
+	Every tile keeps a list of the objects whose center is in it, linked through the objects.
+	Objects that never move go to the front, so the doors, triggers and special tiles that
+	Map_GetObjectAtTile callers look for come first. Moving objects are added at the back.
+*/
+static inline bool Map_IsMovingObject(const Object* obj)
 {
-	int index = 0;
-	int max_index = 0;
+	return obj->type == OT__PLAYER || obj->type == OT__MONSTER || obj->type == OT__MISSILE;
+}
 
-	for (int i = 0; i < s_map.num_objects; i++)
+static inline Object* Map_GetTileObject(ObjectID id)
+{
+	if (id == NULL_INDEX)
 	{
-		Object* obj = &s_map.objects[i];
+		return NULL;
+	}
 
-		if (obj->type == OT__NONE
-			|| obj->type == OT__PLAYER)
-		{
-			continue;
-		}
+	return Map_ObjectAt(id & OBJECT_INDEX_MASK);
+}
+
+static void Map_UnlinkTileObject(Object* obj)
+{
+	if (obj->tile_index == NULL_INDEX)
+	{
+		return;
+	}
+
+	Object* prev = Map_GetTileObject(obj->tile_prev);
+	Object* next = Map_GetTileObject(obj->tile_next);
+
+	if (prev)
+	{
+		prev->tile_next = obj->tile_next;
+	}
+	else
+	{
+		s_map.object_tiles[obj->tile_index] = obj->tile_next;
+	}
+
+	if (next)
+	{
+		next->tile_prev = obj->tile_prev;
+	}
+
+	//only the static objects at the head of a list can block a line or a path
+	if (!Map_IsMovingObject(obj))
+	{
+		Sight_Invalidate();
+		Flow_Invalidate();
+	}
+
+	obj->tile_index = NULL_INDEX;
+	obj->tile_prev = NULL_INDEX;
+	obj->tile_next = NULL_INDEX;
+}
+
+static void Map_LinkTileObject(Object* obj, int index)
+{
+	Object* head = Map_GetTileObject(s_map.object_tiles[index]);
+
+	obj->tile_index = index;
+	obj->tile_prev = NULL_INDEX;
+	obj->tile_next = NULL_INDEX;
+
+	bool moves = Map_IsMovingObject(obj);
 
-		s_map.sorted_list[index++] = i;
+	//only the static objects at the head of a list can block a line or a path
+	if (!moves)
+	{
+		Sight_Invalidate();
+		Flow_Invalidate();
+	}
+
+	if (!head || !moves)
+	{
+		obj->tile_next = s_map.object_tiles[index];
 
-		if (i > max_index)
+		if (head)
 		{
-			max_index = i;
+			head->tile_prev = obj->id;
 		}
+
+		s_map.object_tiles[index] = obj->id;
+		return;
+	}
+
+	Object* tail = head;
+
+	while (tail->tile_next != NULL_INDEX)
+	{
+		tail = Map_GetTileObject(tail->tile_next);
 	}
 
-	//s_map.num_objects = max_index + 1;
-	s_map.num_sorted_objects = index;
+	obj->tile_prev = tail->id;
+	tail->tile_next = obj->id;
 }
 
 static void Map_UpdateObjectTilemap()
 {
 	memset(s_map.object_tiles, NULL_INDEX, sizeof(ObjectID) * s_map.width * s_map.height);
 
+	//cached lines and paths belong to the old tiles
+	Sight_Invalidate();
+	Flow_Invalidate();
+
+	//the lists are rebuilt from scratch
+	for (int i = 0; i < s_map.num_objects; i++)
+	{
+		Object* obj = Map_ObjectAt(i);
+
+		obj->tile_index = NULL_INDEX;
+		obj->tile_prev = NULL_INDEX;
+		obj->tile_next = NULL_INDEX;
+	}
+
 	for (int i = 0; i < s_map.num_objects; i++)
 	{
-		Object* obj = &s_map.objects[i];
+		Object* obj = Map_ObjectAt(i);
 
 		if (obj->type == OT__NONE || obj->type == OT__PARTICLE)
 		{
@@ -87,19 +211,19 @@ static void Map_ConnectTriggersToTargets()
 {
 	for (int i = 0; i < s_map.num_objects; i++)
 	{
-		Object* obj = &s_map.objects[i];
+		Object* obj = Map_ObjectAt(i);
 
 		if (obj->type != OT__TRIGGER)
 		{
 			continue;
 		}
 
-		int target_id = (int)obj->target;
+		int target_id = (int)(intptr_t)obj->target;
 		obj->target = NULL;
 
 		for (int k = 0; k < s_map.num_objects; k++)
 		{
-			Object* target_obj = &s_map.objects[k];
+			Object* target_obj = Map_ObjectAt(k);
 
 			if (target_obj->type == OT__TARGET || target_obj->type == OT__DOOR)
 			{
@@ -117,7 +241,7 @@ static void Map_ConnectTriggersToTargets()
 		{
 			GameAssets* assets = Game_GetAssets();
 
-			ObjectInfo* object_info = Info_GetObjectInfo(OT__TARGET, SUB__TARGET_TELEPORT);
+			const ObjectInfo* object_info = Info_GetObjectInfo(OT__TARGET, SUB__TARGET_TELEPORT);
 
 			obj->sprite.img = &assets->object_textures;
 			obj->sprite.frame_count = object_info->anim_info.frame_count;
@@ -133,31 +257,53 @@ static void Map_ConnectTriggersToTargets()
 	}
 }
 
-static float calc_light_attenuation(float distance, float inv_range, float decay)
+/*
+	Lights are baked into the lightmap of every tile their shadow cast reaches. Each sample is lit by its own
+	distance to the center of the light's tile, wall faces only by lights in front of them.
+	Temp lights are still one value per tile, taken at the tile center.
+*/
+typedef struct
 {
-	float nd = distance * inv_range;
-	nd *= nd;
-	nd *= nd;
-	nd = max(1.0 - nd, 0.0);
-	nd *= nd;
-	return nd * pow(max(distance, 0.0001), -decay);
+	float x, y; //center of the light's tile
+	float radius_sq;
+	float inv_radius_sq;
+	float decay;
+	float scale;
+} LightSource;
+
+static void Map_SetLightSource(LightSource* source, int tile_x, int tile_y, float radius, float decay, float scale)
+{
+	source->x = tile_x + 0.5f;
+	source->y = tile_y + 0.5f;
+	source->radius_sq = radius * radius;
+	source->inv_radius_sq = 1.0f / source->radius_sq;
+	source->decay = decay;
+	source->scale = scale;
 }
 
-static void Map_CalculateLight(int light_x, int light_y, int tile_x, int tile_y, float radius, float attenuation, float scale, bool temp_light)
+static int Map_GetLightAt(const LightSource* source, float x, float y)
 {
-	if (light_x < 0) light_x = 0; else if (light_x >= s_map.width) light_x = s_map.width - 1;
-	if (light_y < 0) light_y = 0; else if (light_y >= s_map.height) light_y = s_map.height - 1;
+	float dx = x - source->x;
+	float dy = y - source->y;
+	float distance_sq = dx * dx + dy * dy;
 
-	float light_radius = radius;
-	float light_attenuation = attenuation;
+	//the falloff reaches zero at the radius
+	if (distance_sq >= source->radius_sq)
+	{
+		return 0;
+	}
+
+	float nd = distance_sq * source->inv_radius_sq;
+	nd *= nd;
+	nd = 1.0f - nd;
+	nd *= nd;
 
-	float inv_radius = 1.0 / light_radius;
+	distance_sq = max(distance_sq, 1e-8f);
 
-	float distance = Math_XY_Length(tile_x - light_x, tile_y - light_y);
-	light_attenuation = calc_light_attenuation(distance, inv_radius, light_attenuation);
-	light_attenuation *= scale;
+	//the distance to the power of -decay, most lights have a decay of 1
+	float attenuation = (source->decay == 1.0f) ? 1.0f / sqrtf(distance_sq) : powf(distance_sq, -0.5f * source->decay);
 
-	int light = light_attenuation * 255;
+	int light = nd * attenuation * source->scale * 255;
 
 	if (light > 255)
 	{
@@ -168,770 +314,1938 @@ static void Map_CalculateLight(int light_x, int light_y, int tile_x, int tile_y,
 		light = 0;
 	}
 
-	int index = light_x + light_y * s_map.width;
-	LightTile* light_tile = &s_map.light_tiles[index];
-
-	if (temp_light)
-	{
-		int l = light + (int)light_tile->temp_light;
-
-		if (l > 255) l = 255;
-
-		light_tile->temp_light = (uint8_t)l;
-	}
-	else
-	{
-		int dir_x = light_x - tile_x;
-		int dir_y = light_y - tile_y;
-
-		float norm_dir_x = dir_x;
-		float norm_dir_y = dir_y;
-
-		Math_XY_Normalize(&norm_dir_x, &norm_dir_y);
-
-		DirEnum dir = DirVectorToDirEnum(dir_x, dir_y);
-
-		if (dir == DIR_NORTH || dir == DIR_NORTH_EAST || dir == DIR_NORTH_WEST)
-		{
-			int l = light + (int)light_tile->light_north;
-
-			if (l > 255) l = 255;
-
-			light_tile->light_north = (uint8_t)l;
-		}
-		if (dir == DIR_SOUTH || dir == DIR_SOUTH_EAST || dir == DIR_SOUTH_WEST)
-		{
-			int l = light + (int)light_tile->light_south;
-
-			if (l > 255) l = 255;
-
-			light_tile->light_south = (uint8_t)l;
-		}
-		if (dir == DIR_WEST || dir == DIR_SOUTH_WEST || dir == DIR_NORTH_WEST)
-		{
-			int l = light + (int)light_tile->light_west;
-
-			if (l > 255) l = 255;
-
-			light_tile->light_west = (uint8_t)l;
-		}
-		if (dir == DIR_EAST || dir == DIR_SOUTH_EAST || dir == DIR_NORTH_EAST)
-		{
-			int l = light + (int)light_tile->light_east;
-
-			if (l > 255) l = 255;
-
-			light_tile->light_east = (uint8_t)l;
-		}
+	return light;
+}
 
-		int l = light + (int)light_tile->light;
+static inline void Map_AddLight(uint8_t* sample, int light)
+{
+	int l = light + (int)*sample;
 
-		if (l > 255) l = 255;
+	if (l > 255) l = 255;
 
-		light_tile->light = (uint8_t)l;
-	}	
+	*sample = (uint8_t)l;
 }
 
-static void SetLightTileCallback(int center_x, int center_y, int x, int y)
+static void Map_AddTempLight(int index, int light)
 {
-	Object* light_obj = Map_GetObjectAtTile(center_x, center_y);
+	int back = !s_map.temp_light_front;
+	uint8_t* temp_lights = s_map.temp_lights[back];
 
-	float radius = 6;
-	float attenuation = 1;
-	float scale = 1;
-
-	if (light_obj && light_obj->type == OT__LIGHT)
+	if (!temp_lights || light <= 0)
 	{
-		LightInfo* light_info = Info_GetLightInfo(light_obj->sub_type);
+		return;
+	}
 
-		if (light_info)
-		{
-			radius = light_info->radius;
-			attenuation = light_info->attenuation;
-			scale = light_info->scale;
-		}
+	//first light on the tile, remember it so it is the only one cleared
+	if (temp_lights[index] == 0)
+	{
+		s_map.temp_light_tiles[back][s_map.num_temp_light_tiles[back]++] = index;
 	}
 
-	Map_CalculateLight(x, y, center_x, center_y, radius, attenuation, scale, false);
-}
-static void SetTempLightTileCallback(int center_x, int center_y, int x, int y)
-{
-	Map_CalculateLight(x, y, center_x, center_y, 4.5, 1, 0.5, true);
+	Map_AddLight(&temp_lights[index], light);
 }
 
-static void Map_SetupLightTiles()
+static void Map_BakeFaceLight(const LightSource* source, uint8_t* samples, float x, float y, float step_x, float step_y)
 {
-	s_map.light_tiles = malloc(sizeof(LightTile) * s_map.width * s_map.height);
-
-	if (!s_map.light_tiles)
+	for (int i = 0; i < LIGHTMAP_SAMPLES; i++)
 	{
-		return;
+		Map_AddLight(&samples[i], Map_GetLightAt(source, x + i * step_x, y + i * step_y));
 	}
+}
 
-	memset(s_map.light_tiles, 0, sizeof(LightTile) * s_map.width * s_map.height);
+static void Map_BakeLightTile(const LightSource* source, LightTile* light_tile, int x, int y)
+{
+	const float cell_size = 1.0f / LIGHTMAP_CELLS;
 
-	//set min light
-	for (int x = 0; x < s_map.width; x++)
+	if (Map_GetTile(x, y) == EMPTY_TILE)
 	{
-		for (int y = 0; y < s_map.height; y++)
+		for (int i = 0; i < LIGHTMAP_SAMPLES; i++)
 		{
-			int index = x + y * s_map.width;
-			LightTile* light_tile = &s_map.light_tiles[index];
-
-			light_tile->light = MIN_LIGHT;
-			light_tile->light_east = MIN_LIGHT;
-			light_tile->light_west = MIN_LIGHT;
-			light_tile->light_north = MIN_LIGHT;
-			light_tile->light_south = MIN_LIGHT;
+			Map_BakeFaceLight(source, &light_tile->floor[i * LIGHTMAP_SAMPLES], x, y + i * cell_size, cell_size, 0);
 		}
+
+		light_tile->light = light_tile->floor[LIGHTMAP_CENTER];
+		return;
 	}
 
-	for (int i = 0; i < s_map.num_objects; i++)
+	//only the faces that look toward the light
+	if (source->x < x)
 	{
-		Object* object = &s_map.objects[i];
-
-		if (!object || object->type != OT__LIGHT)
-		{
-			continue;
-		}
+		Map_BakeFaceLight(source, light_tile->faces[LIGHT_FACE__WEST], x, y, 0, cell_size);
+	}
+	if (source->x > x + 1)
+	{
+		Map_BakeFaceLight(source, light_tile->faces[LIGHT_FACE__EAST], x + 1, y, 0, cell_size);
+	}
+	if (source->y < y)
+	{
+		Map_BakeFaceLight(source, light_tile->faces[LIGHT_FACE__NORTH], x, y, cell_size, 0);
+	}
+	if (source->y > y + 1)
+	{
+		Map_BakeFaceLight(source, light_tile->faces[LIGHT_FACE__SOUTH], x, y + 1, cell_size, 0);
+	}
+}
 
-		LightInfo* light_info = Info_GetLightInfo(object->sub_type);
+/*
+	Lights are baked on the render threads, LIGHT_BAKE_BATCH at a time. Every light has a private buffer over
+	the square its cast can reach and starts at zero, so nothing is shared while baking. The buffers are then
+	merged into the lightmap a few rows at a time, each row is only written by one thread. The adds saturate,
+	so the order they are merged in does not change the result.
+*/
+#define LIGHT_BAKE_BATCH 64 //bounds the memory of the private buffers
+#define LIGHT_MERGE_ROWS 4
 
-		int radius = 6;
+typedef struct
+{
+	LightSource source;
+	LightTile* tiles;
+	int tile_x, tile_y;
+	int radius;
 
-		if (light_info)
-		{
-			radius = light_info->radius;
-		}
+	//map tile of tiles[0]
+	int x0, y0;
+	int width, height;
+} LightBake;
 
-		int tile_x = (int)object->x;
-		int tile_y = (int)object->y;
+typedef struct
+{
+	LightBake bakes[LIGHT_BAKE_BATCH];
+	int num_bakes;
 
-		Trace_ShadowCast(tile_x, tile_y, radius, SetLightTileCallback);
-	}
-}
+	LightTile* light_tiles; //merged into
+} LightBakeBatch;
 
-static void Map_FreeListStoreID(ObjectID id)
+static void SetLightTileCallback(int center_x, int center_y, int x, int y, void* data)
 {
-	if (s_map.num_free_list >= MAX_OBJECTS)
+	LightBake* bake = data;
+
+	int bx = x - bake->x0;
+	int by = y - bake->y0;
+
+	if (bx < 0 || by < 0 || bx >= bake->width || by >= bake->height)
 	{
 		return;
 	}
 
-	s_map.free_list[s_map.num_free_list++] = id;
+	Map_BakeLightTile(&bake->source, &bake->tiles[bx + by * bake->width], x, y);
 }
-
-static ObjectID Map_GetNewObjectIndex()
+static void SetTempLightTileCallback(int center_x, int center_y, int x, int y, void* data)
 {
-	ObjectID id = -1;
-	//get from free list
-	if (s_map.num_free_list > 0)
-	{
-		id = s_map.free_list[s_map.num_free_list - 1];
-		s_map.num_free_list--;
-	}
-	else
+	if (x < 0 || y < 0 || x >= s_map.width || y >= s_map.height)
 	{
-		if (s_map.num_objects < MAX_OBJECTS)
-		{
-			id = s_map.num_objects++;
-		}
+		return;
 	}
 
-	return id;
+	Map_AddTempLight(x + y * s_map.width, Map_GetLightAt(data, x + 0.5f, y + 0.5f));
 }
 
-void Map_SetDirtyTempLight()
+static void Map_BakeLights(int start, int end, void* data)
 {
-	s_map.dirty_temp_light = true;
-}
+	LightBakeBatch* batch = data;
 
-int Map_GetLevelIndex()
-{
-	return s_map.level_index;
-}
+	for (int i = start; i < end; i++)
+	{
+		LightBake* bake = &batch->bakes[i];
 
-Map* Map_GetMap()
-{
-	return &s_map;
+		memset(bake->tiles, 0, sizeof(LightTile) * bake->width * bake->height);
+
+		Trace_ShadowCast(bake->tile_x, bake->tile_y, bake->radius, SetLightTileCallback, bake);
+	}
 }
 
-Object* Map_NewObject(ObjectType type)
+static void Map_MergeLightRows(int start, int end, void* data)
 {
-	ObjectID index = Map_GetNewObjectIndex();
+	LightBakeBatch* batch = data;
 
-	if (index < 0)
+	for (int y = start; y < end; y++)
 	{
-		return NULL;
-	}
-
-	Object* obj = &s_map.objects[index];
-
-	obj->sprite.scale_x = 1;
-	obj->sprite.scale_y = 1;
-	obj->id = index;
-	obj->tile_index = NULL_INDEX;
-	obj->type = type;
-	obj->hp = 1;
-	obj->size = 0.5;
+		for (int i = 0; i < batch->num_bakes; i++)
+		{
+			const LightBake* bake = &batch->bakes[i];
 
-	Map_UpdateSortedList();
+			if (y < bake->y0 || y >= bake->y0 + bake->height)
+			{
+				continue;
+			}
 
-	return obj;
-}
+			//every byte of a light tile is a sample or zero padding
+			uint8_t* dst = (uint8_t*)&batch->light_tiles[bake->x0 + y * s_map.width];
+			const uint8_t* src = (const uint8_t*)&bake->tiles[(y - bake->y0) * bake->width];
+			int num_bytes = bake->width * (int)sizeof(LightTile);
 
-bool Map_LoadFromIndex(int index)
-{
-	int arr_size = sizeof(LEVELS) / sizeof(LEVELS[0]);
-	if (index >= arr_size)
-	{
-		index = arr_size - 1;
-	}
-	else if (index < 0)
-	{
-		index = 0;
-	}
+			for (int k = 0; k < num_bytes; k++)
+			{
+				int l = dst[k] + src[k];
 
-	if (!Map_Load(LEVELS[index]))
-	{
-		return false;
+				dst[k] = (l > 255) ? 255 : (uint8_t)l;
+			}
+		}
 	}
-
-	s_map.level_index = index;
-
-	return true;
 }
 
-bool Map_Load(const char* filename)
+//bakes every light of the map into light_tiles, on the render threads when parallel is set
+bool Map_BakeLight(LightTile* light_tiles, bool parallel)
 {
-	Map_Destruct();
-
-	GameAssets* assets = Game_GetAssets();
-
-	bool result = true;
-
-	const unsigned char* filestr = File_Parse(filename, NULL);
+	//set min light, the floor samples share their bytes with the faces
+	memset(light_tiles, 0, sizeof(LightTile) * s_map.width * s_map.height);
 
-	if (!filestr)
+	for (int i = 0; i < s_map.width * s_map.height; i++)
 	{
-		printf("ERROR::Failed to load map!\n");
-		return false;
+		LightTile* light_tile = &light_tiles[i];
+
+		memset(light_tile->floor, MIN_LIGHT, sizeof(light_tile->floor));
+		light_tile->light = MIN_LIGHT;
 	}
 
-	cJSON* json = cJSON_Parse(filestr);
+	LightBakeBatch* batch = malloc(sizeof(LightBakeBatch));
+	LightTile* buffer = NULL;
+	size_t buffer_tiles = 0;
+	bool baked = true;
 
-	if (!json)
+	if (!batch)
 	{
-		printf("ERROR::Failed to load map!\n");
 		return false;
 	}
 
-	//we can free the raw char data
-	free(filestr);
-	filestr = NULL;
+	batch->light_tiles = light_tiles;
 
-	cJSON* layers = cJSON_GetObjectItem(json, "layers");
-
-	if (!layers)
-	{
-		printf("ERROR::Failed to load map!\n");
-		result = false;
-		goto cleanup;
-	}
+	int object_index = 0;
 
-	cJSON* layer = NULL;
-	cJSON_ArrayForEach(layer, layers)
+	while (object_index < s_map.num_objects)
 	{
-		cJSON* type = cJSON_GetObjectItem(layer, "type");
-		cJSON* name = cJSON_GetObjectItem(layer, "name");
+		batch->num_bakes = 0;
 
-		if (!type || !cJSON_IsString(type) || !name || !cJSON_IsString(name))
-		{
-			printf("ERROR::Failed to load map!\n");
-			result = false;
-			goto cleanup;
-		}
+		size_t num_tiles = 0;
 
-		//tile layer
-		if(!strcmp(cJSON_GetStringValue(type), "tilelayer") && !strcmp(cJSON_GetStringValue(name), "tile_layer"))
+		for (; object_index < s_map.num_objects && batch->num_bakes < LIGHT_BAKE_BATCH; object_index++)
 		{
-			cJSON* width = cJSON_GetObjectItem(layer, "width");
-			cJSON* height = cJSON_GetObjectItem(layer, "height");
+			Object* object = Map_ObjectAt(object_index);
 
-			if (!width || !height || !cJSON_IsNumber(width) || !cJSON_IsNumber(height))
+			if (!object || object->type != OT__LIGHT)
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				continue;
 			}
 
-			s_map.width = cJSON_GetNumberValue(width);
-			s_map.height = cJSON_GetNumberValue(height);
+			const LightInfo* light_info = Info_GetLightInfo(object->sub_type);
 
-			cJSON* tile_data = cJSON_GetObjectItem(layer, "data");
+			float radius = 6;
+			float attenuation = 1;
+			float scale = 1;
 
-			if (!tile_data || !cJSON_IsArray(tile_data))
+			if (light_info)
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				radius = light_info->radius;
+				attenuation = light_info->attenuation;
+				scale = light_info->scale;
 			}
 
-			//allocate tile buffer
-			s_map.tiles = calloc(s_map.height * s_map.width, sizeof(TileID));
+			LightBake* bake = &batch->bakes[batch->num_bakes];
 
-			if (!s_map.tiles)
-			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
-			}
+			bake->tile_x = (int)object->x;
+			bake->tile_y = (int)object->y;
+			bake->radius = (int)radius;
 
-			//allocate object tile buffer
-			s_map.object_tiles = calloc(s_map.height * s_map.width, sizeof(ObjectID));
+			//the cast only reaches tiles closer than the radius
+			int reach = max(bake->radius - 1, 0);
 
-			if (!s_map.object_tiles)
-			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
-			}
+			bake->x0 = max(bake->tile_x - reach, 0);
+			bake->y0 = max(bake->tile_y - reach, 0);
+			bake->width = min(bake->tile_x + reach + 1, s_map.width) - bake->x0;
+			bake->height = min(bake->tile_y + reach + 1, s_map.height) - bake->y0;
 
-			int index = 0;
-			//parse each tile
-			for (int y = 0; y < s_map.height; y++)
+			if (bake->width <= 0 || bake->height <= 0)
 			{
-				for (int x = 0; x < s_map.width; x++)
-				{
-					cJSON* tile = cJSON_GetArrayItem(tile_data, index);
-
-					if (!tile || !cJSON_IsNumber(tile))
-					{
-						printf("ERROR::Failed to load map!\n");
-						result = false;
-						goto cleanup;
-					}
-
-					int tile_number = cJSON_GetNumberValue(tile);
-
-					if (tile_number > 0)
-					{
-						s_map.num_non_empty_tiles++;
-					}
+				continue;
+			}
 
-					s_map.tiles[x + y * s_map.width] = tile_number;
+			Map_SetLightSource(&bake->source, bake->tile_x, bake->tile_y, radius, attenuation, scale);
 
-					index++;
-				}
-			}
+			num_tiles += (size_t)bake->width * bake->height;
+			batch->num_bakes++;
+		}
 
+		if (batch->num_bakes == 0)
+		{
+			break;
 		}
-		//floor layer
-		else if (!strcmp(cJSON_GetStringValue(type), "tilelayer") && !strcmp(cJSON_GetStringValue(name), "floor_layer"))
+
+		if (num_tiles > buffer_tiles)
 		{
-			cJSON* width = cJSON_GetObjectItem(layer, "width");
-			cJSON* height = cJSON_GetObjectItem(layer, "height");
+			LightTile* new_buffer = realloc(buffer, sizeof(LightTile) * num_tiles);
 
-			if (!width || !height || !cJSON_IsNumber(width) || !cJSON_IsNumber(height))
+			if (!new_buffer)
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				baked = false;
+				break;
 			}
 
-			int w = cJSON_GetNumberValue(width);
-			int h = cJSON_GetNumberValue(height);
-
-			cJSON* tile_data = cJSON_GetObjectItem(layer, "data");
+			buffer = new_buffer;
+			buffer_tiles = num_tiles;
+		}
 
-			if (!tile_data || !cJSON_IsArray(tile_data))
-			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
-			}
+		LightTile* tiles = buffer;
 
-			//allocate tile buffer
-			s_map.floor_tiles = calloc(h * w, sizeof(TileID));
+		for (int i = 0; i < batch->num_bakes; i++)
+		{
+			batch->bakes[i].tiles = tiles;
+			tiles += batch->bakes[i].width * batch->bakes[i].height;
+		}
 
-			if (!s_map.floor_tiles)
-			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
-			}
+		if (parallel)
+		{
+			Render_ParallelFor(batch->num_bakes, 1, Map_BakeLights, batch);
+			Render_ParallelFor(s_map.height, LIGHT_MERGE_ROWS, Map_MergeLightRows, batch);
+		}
+		else
+		{
+			Map_BakeLights(0, batch->num_bakes, batch);
+			Map_MergeLightRows(0, s_map.height, batch);
+		}
+	}
 
-			int index = 0;
-			//parse each tile
-			for (int y = 0; y < h; y++)
-			{
-				for (int x = 0; x < w; x++)
-				{
-					cJSON* tile = cJSON_GetArrayItem(tile_data, index);
+	if (buffer) free(buffer);
+	free(batch);
 
-					if (!tile || !cJSON_IsNumber(tile))
-					{
-						printf("ERROR::Failed to load map!\n");
-						result = false;
-						goto cleanup;
-					}
+	return baked;
+}
+
+static void Map_SetupLightTiles()
+{
+	s_map.light_tiles = malloc(sizeof(LightTile) * s_map.width * s_map.height);
+
+	if (!s_map.light_tiles)
+	{
+		return;
+	}
 
-					int tile_number = cJSON_GetNumberValue(tile);
+	Map_BakeLight(s_map.light_tiles, true);
+}
 
-					s_map.floor_tiles[x + y * w] = tile_number;
+/*
+	Potentially visible set. The map is split into square regions and every region keeps one bit for each
+	region that can be seen from it. A region is cast from every open tile on its border, a tile that is seen
+	marks the regions of its neighbours as well, since lines start anywhere in a tile and not just at its center.
+	Regions the cast does not reach are always marked. Doors are the only tiles that change, so the set is built
+	twice, with every door open and with every door closed. The closed set is used while no door is open.
+*/
+#define PVS_REGION_SHIFT 3
+#define PVS_REGION_SIZE (1 << PVS_REGION_SHIFT)
+#define PVS_CAST_RADIUS 64
+
+static inline int Map_GetPVSRegion(int x, int y)
+{
+	return (x >> PVS_REGION_SHIFT) + (y >> PVS_REGION_SHIFT) * s_map.pvs_width;
+}
 
-					index++;
-				}
-			}
+static void SetPVSTileCallback(int center_x, int center_y, int x, int y, void* data)
+{
+	uint64_t* row = data;
 
-			s_map.floor_width = w;
-			s_map.floor_height = h;
+	//the neighbours only reach another region on the region edges
+	int min_rx = max(x - 1, 0) >> PVS_REGION_SHIFT;
+	int min_ry = max(y - 1, 0) >> PVS_REGION_SHIFT;
+	int max_rx = min(x + 1, s_map.width - 1) >> PVS_REGION_SHIFT;
+	int max_ry = min(y + 1, s_map.height - 1) >> PVS_REGION_SHIFT;
 
-		}
-		//ceil layer
-		else if (!strcmp(cJSON_GetStringValue(type), "tilelayer") && !strcmp(cJSON_GetStringValue(name), "ceil_layer"))
+	for (int ry = min_ry; ry <= max_ry; ry++)
+	{
+		for (int rx = min_rx; rx <= max_rx; rx++)
 		{
-			cJSON* width = cJSON_GetObjectItem(layer, "width");
-			cJSON* height = cJSON_GetObjectItem(layer, "height");
+			int region = rx + ry * s_map.pvs_width;
 
-			if (!width || !height || !cJSON_IsNumber(width) || !cJSON_IsNumber(height))
-			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
-			}
+			row[region >> 6] |= (uint64_t)1 << (region & 63);
+		}
+	}
+}
 
-			int w = cJSON_GetNumberValue(width);
-			int h = cJSON_GetNumberValue(height);
+static inline bool Map_IsInPVSRegion(int x, int y, int x0, int y0, int x1, int y1)
+{
+	return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+}
+
+//an open tile next to an open tile on the other side of the region edge
+static bool Map_IsPVSPortalTile(int x, int y, int x0, int y0, int x1, int y1)
+{
+	if (x < 0 || y < 0 || x >= s_map.width || y >= s_map.height || Check_IsBlockingTile(x, y))
+	{
+		return false;
+	}
 
-			cJSON* tile_data = cJSON_GetObjectItem(layer, "data");
+	bool inside = Map_IsInPVSRegion(x, y, x0, y0, x1, y1);
 
-			if (!tile_data || !cJSON_IsArray(tile_data))
+	for (int ny = y - 1; ny <= y + 1; ny++)
+	{
+		for (int nx = x - 1; nx <= x + 1; nx++)
+		{
+			if (nx < 0 || ny < 0 || nx >= s_map.width || ny >= s_map.height || Map_IsInPVSRegion(nx, ny, x0, y0, x1, y1) == inside)
+			{
+				continue;
+			}
+			if (!Check_IsBlockingTile(nx, ny))
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				return true;
 			}
+		}
+	}
+
+	return false;
+}
 
-			//allocate tile buffer
-			s_map.ceil_tiles = calloc(h * w, sizeof(TileID));
+static void Map_BuildPVSSet(uint64_t* pvs)
+{
+	int num_regions = s_map.pvs_width * s_map.pvs_height;
+
+	memset(pvs, 0, sizeof(uint64_t) * s_map.pvs_row_words * num_regions);
+
+	for (int region = 0; region < num_regions; region++)
+	{
+		int rx = region % s_map.pvs_width;
+		int ry = region / s_map.pvs_width;
+
+		int x0 = rx << PVS_REGION_SHIFT;
+		int y0 = ry << PVS_REGION_SHIFT;
+		int x1 = min(x0 + PVS_REGION_SIZE, s_map.width) - 1;
+		int y1 = min(y0 + PVS_REGION_SIZE, s_map.height) - 1;
+
+		uint64_t* row = pvs + (size_t)region * s_map.pvs_row_words;
+
+		//regions past the cast radius are never proven hidden
+		for (int other = 0; other < num_regions; other++)
+		{
+			int ox = other % s_map.pvs_width;
+			int oy = other / s_map.pvs_width;
 
-			if (!s_map.ceil_tiles)
+			int dx = (abs(ox - rx) + 1) * PVS_REGION_SIZE + 1;
+			int dy = (abs(oy - ry) + 1) * PVS_REGION_SIZE + 1;
+
+			if (other == region || dx * dx + dy * dy >= (PVS_CAST_RADIUS - 1) * (PVS_CAST_RADIUS - 1))
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				row[other >> 6] |= (uint64_t)1 << (other & 63);
 			}
+		}
 
-			int index = 0;
-			//parse each tile
-			for (int y = 0; y < h; y++)
+		//everything seen from inside leaves through the tiles on both sides of the region edge.
+		//the cast starts at the tile center, the outer tiles cover lines that start close to the edge
+		for (int y = y0 - 1; y <= y1 + 1; y++)
+		{
+			for (int x = x0 - 1; x <= x1 + 1; x++)
 			{
-				for (int x = 0; x < w; x++)
+				if (x > x0 && x < x1 && y > y0 && y < y1)
+				{
+					continue;
+				}
+				if (!Map_IsPVSPortalTile(x, y, x0, y0, x1, y1))
 				{
-					cJSON* tile = cJSON_GetArrayItem(tile_data, index);
+					continue;
+				}
 
-					if (!tile || !cJSON_IsNumber(tile))
-					{
-						printf("ERROR::Failed to load map!\n");
-						result = false;
-						goto cleanup;
-					}
+				//the cast walks its whole radius even past the map edges
+				int reach_x = max(x, s_map.width - 1 - x);
+				int reach_y = max(y, s_map.height - 1 - y);
+				int radius = min((int)sqrtf(reach_x * reach_x + reach_y * reach_y) + 2, PVS_CAST_RADIUS);
 
-					int tile_number = cJSON_GetNumberValue(tile);
+				Trace_ShadowCast(x, y, radius, SetPVSTileCallback, row);
+			}
+		}
+	}
+}
 
-					s_map.ceil_tiles[x + y * w] = tile_number;
+static void Map_SetDoorsOpen(bool open)
+{
+	for (int i = 0; i < s_map.num_objects; i++)
+	{
+		Object* obj = Map_ObjectAt(i);
 
-					index++;
-				}
-			}
+		if (obj->type == OT__DOOR)
+		{
+			obj->move_timer = (open) ? 0 : 1;
+		}
+	}
+}
+
+static void Map_CountOpenDoors()
+{
+	s_map.num_open_doors = 0;
+
+	for (int i = 0; i < s_map.num_objects; i++)
+	{
+		Object* obj = Map_ObjectAt(i);
+
+		if (obj->type == OT__DOOR && !Object_IsSpecialCollidableTile(obj))
+		{
+			s_map.num_open_doors++;
+		}
+	}
+}
+
+static void Map_SetupPVS()
+{
+	s_map.pvs_width = (s_map.width + PVS_REGION_SIZE - 1) >> PVS_REGION_SHIFT;
+	s_map.pvs_height = (s_map.height + PVS_REGION_SIZE - 1) >> PVS_REGION_SHIFT;
+	s_map.pvs_row_words = (s_map.pvs_width * s_map.pvs_height + 63) / 64;
+
+	size_t size = sizeof(uint64_t) * s_map.pvs_row_words * s_map.pvs_width * s_map.pvs_height;
+
+	s_map.pvs_open = malloc(size);
+	s_map.pvs_closed = malloc(size);
+
+	if (!s_map.pvs_open || !s_map.pvs_closed)
+	{
+		if (s_map.pvs_open) free(s_map.pvs_open);
+		if (s_map.pvs_closed) free(s_map.pvs_closed);
+
+		s_map.pvs_open = NULL;
+		s_map.pvs_closed = NULL;
+		return;
+	}
+
+	//keep the door timers, the cast reads them through the blocking check
+	int num_doors = 0;
+	float* door_timers = NULL;
+
+	for (int i = 0; i < s_map.num_objects; i++)
+	{
+		if (Map_ObjectAt(i)->type == OT__DOOR)
+		{
+			num_doors++;
+		}
+	}
+
+	if (num_doors > 0)
+	{
+		door_timers = malloc(sizeof(float) * num_doors);
+	}
+
+	for (int i = 0, door = 0; door_timers && i < s_map.num_objects; i++)
+	{
+		Object* obj = Map_ObjectAt(i);
+
+		if (obj->type == OT__DOOR)
+		{
+			door_timers[door++] = obj->move_timer;
+		}
+	}
+
+	Map_SetDoorsOpen(true);
+	Map_BuildPVSSet(s_map.pvs_open);
+
+	//without doors both sets are the same
+	if (num_doors > 0)
+	{
+		Map_SetDoorsOpen(false);
+		Map_BuildPVSSet(s_map.pvs_closed);
+	}
+	else
+	{
+		memcpy(s_map.pvs_closed, s_map.pvs_open, size);
+	}
+
+	for (int i = 0, door = 0; door_timers && i < s_map.num_objects; i++)
+	{
+		Object* obj = Map_ObjectAt(i);
+
+		if (obj->type == OT__DOOR)
+		{
+			obj->move_timer = door_timers[door++];
+		}
+	}
+
+	if (door_timers) free(door_timers);
+}
+
+static void Map_FreeListStoreID(int index)
+{
+	if (s_map.num_free_list >= s_map.num_objects)
+	{
+		return;
+	}
+
+	*Map_FreeListEntry(s_map.num_free_list++) = index;
+}
+
+static int Map_GetNewObjectIndex()
+{
+	//get from free list
+	if (s_map.num_free_list > 0)
+	{
+		s_map.num_free_list--;
+
+		return *Map_FreeListEntry(s_map.num_free_list);
+	}
+
+	//add a chunk when the ones we have are full
+	if (s_map.num_objects >= s_map.num_object_chunks * OBJECT_CHUNK_SIZE)
+	{
+		if (s_map.num_object_chunks >= MAX_OBJECT_CHUNKS)
+		{
+			return NULL_INDEX;
+		}
+
+		ObjectChunk* chunk = calloc(1, sizeof(ObjectChunk));
+
+		if (!chunk)
+		{
+			return NULL_INDEX;
+		}
+
+		s_map.object_chunks[s_map.num_object_chunks++] = chunk;
+	}
+
+	return s_map.num_objects++;
+}
+
+int Map_GetLevelIndex()
+{
+	return s_map.level_index;
+}
+
+Map* Map_GetMap()
+{
+	return &s_map;
+}
+
+Object* Map_NewObject(ObjectType type)
+{
+	int index = Map_GetNewObjectIndex();
+
+	if (index < 0)
+	{
+		return NULL;
+	}
+
+	ObjectChunk* chunk = s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT];
+	int slot = index & (OBJECT_CHUNK_SIZE - 1);
+
+	Object* obj = &chunk->objects[slot];
+
+	obj->sprite.scale_x = 1;
+	obj->sprite.scale_y = 1;
+	obj->id = index | ((ObjectID)chunk->generations[slot] << OBJECT_INDEX_BITS);
+
+	//not transformed yet, keep it in the draw queue until the next view pass
+	chunk->view_x[slot] = 0;
+	chunk->view_y[slot] = 1;
+	obj->tile_index = NULL_INDEX;
+	obj->tile_prev = NULL_INDEX;
+	obj->tile_next = NULL_INDEX;
+	obj->type = type;
+	obj->hp = 1;
+	obj->size = 0.5;
+
+	Map_AddToSortedList(obj);
+
+	return obj;
+}
+
+Object* Map_GetObject(ObjectID id)
+{
+	if (id < 0)
+	{
+		return NULL;
+	}
+
+	int index = id & OBJECT_INDEX_MASK;
 
-			s_map.ceil_width = w;
-			s_map.ceil_height = h;
+	if (index >= s_map.num_objects)
+	{
+		return NULL;
+	}
+
+	Object* obj = Map_ObjectAt(index);
+
+	//deleted, or the slot was given to another object
+	if (obj->type == OT__NONE || obj->id != id)
+	{
+		return NULL;
+	}
+
+	return obj;
+}
+
+Object* Map_GetObjectByIndex(int index)
+{
+	if (index < 0 || index >= s_map.num_objects)
+	{
+		return NULL;
+	}
+
+	return Map_ObjectAt(index);
+}
+
+Object* Map_GetSortedObject(int index)
+{
+	if (index < 0 || index >= s_map.num_sorted_objects)
+	{
+		return NULL;
+	}
+
+	return Map_ObjectAt(*Map_SortedListEntry(index) & OBJECT_INDEX_MASK);
+}
+
+void Map_GetObjectView(const Object* obj, float* r_view_x, float* r_view_y)
+{
+	int index = obj->id & OBJECT_INDEX_MASK;
+
+	ObjectChunk* chunk = s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT];
+	int slot = index & (OBJECT_CHUNK_SIZE - 1);
+
+	*r_view_x = chunk->view_x[slot];
+	*r_view_y = chunk->view_y[slot];
+}
+
+/*
+	Objects are first read into records, so the json and the binary loader spawn them the same way.
+	The records are also what the converter writes into compiled maps.
+*/
+#define MAP_RECORD_TILE_CENTERED 1
+#define MAP_RECORD_GID 2 //gid is the tile of doors and fake tiles
+#define MAP_RECORD_STATE 4 //gid is the start state of switches
+#define MAP_RECORD_TARGET 8
+
+typedef struct
+{
+	int16_t type;
+	int16_t sub_type;
+	int32_t map_id;
+	float x, y;
+	int32_t gid;
+	int32_t target;
+	int32_t flags;
+} MapObjectRecord;
+
+typedef struct
+{
+	const char* name;
+	ObjectType type;
+	SubType sub_type;
+	int flags;
+	bool read_target;
+} MapObjectType;
+
+static const MapObjectType MAP_OBJECT_TYPES[] =
+{
+	{ "light_torch", OT__LIGHT, SUB__LIGHT_TORCH, 0, false },
+	{ "light_lamp", OT__LIGHT, SUB__LIGHT_LAMP, 0, false },
+	{ "thing_redcollumn", OT__THING, SUB__THING_RED_COLLUMN, 0, false },
+	{ "thing_bluecollumn", OT__THING, SUB__THING_BLUE_COLLUMN, 0, false },
+	{ "thing_redflag", OT__THING, SUB__THING_RED_FLAG, 0, false },
+	{ "thing_blueflag", OT__THING, SUB__THING_BLUE_FLAG, 0, false },
+	{ "monster_imp", OT__MONSTER, SUB__MOB_IMP, 0, false },
+	{ "monster_pinky", OT__MONSTER, SUB__MOB_PINKY, 0, false },
+	{ "monster_bruiser", OT__MONSTER, SUB__MOB_BRUISER, 0, false },
+	{ "pickup_smallhp", OT__PICKUP, SUB__PICKUP_SMALLHP, 0, false },
+	{ "pickup_bighp", OT__PICKUP, SUB__PICKUP_BIGHP, 0, false },
+	{ "pickup_ammo", OT__PICKUP, SUB__PICKUP_AMMO, 0, false },
+	{ "pickup_rockets", OT__PICKUP, SUB__PICKUP_ROCKETS, 0, false },
+	{ "pickup_godmode", OT__PICKUP, SUB__PICKUP_INVUNERABILITY, 0, false },
+	{ "pickup_quad", OT__PICKUP, SUB__PICKUP_QUAD_DAMAGE, 0, false },
+	{ "pickup_shotgun", OT__PICKUP, SUB__PICKUP_SHOTGUN, 0, false },
+	{ "pickup_machinegun", OT__PICKUP, SUB__PICKUP_MACHINEGUN, 0, false },
+	{ "pickup_devastator", OT__PICKUP, SUB__PICKUP_DEVASTATOR, 0, false },
+	{ "trigger", OT__TRIGGER, SUB__NONE, MAP_RECORD_TILE_CENTERED, true },
+	{ "trigger_once", OT__TRIGGER, SUB__TRIGGER_ONCE, MAP_RECORD_TILE_CENTERED, true },
+	{ "trigger_switch", OT__TRIGGER, SUB__TRIGGER_SWITCH, MAP_RECORD_TILE_CENTERED | MAP_RECORD_STATE, true },
+	{ "trigger_secret", OT__TRIGGER, SUB__TRIGGER_SECRET, 0, false },
+	{ "trigger_changelevel", OT__TRIGGER, SUB__TRIGGER_CHANGELEVEL, 0, false },
+	{ "target_teleport", OT__TARGET, SUB__TARGET_TELEPORT, 0, false },
+	{ "door_v", OT__DOOR, SUB__DOOR_VERTICAL, MAP_RECORD_TILE_CENTERED | MAP_RECORD_GID, false },
+	{ "tile_fake", OT__SPECIAL_TILE, SUB__SPECIAL_TILE_FAKE, MAP_RECORD_TILE_CENTERED | MAP_RECORD_GID, false }
+};
+
+/*
+	Compiled map, all sections are 64 byte aligned and little endian:
+	header, tiles, floor tiles, ceil tiles, baked light tiles, pvs with doors open, pvs with doors closed, object records.
+	The tile, light and pvs sections are used in place, the file is mapped copy on write.
+*/
+#define MAP_FILE_MAGIC 0x50414D52 //"RMAP"
+#define MAP_FILE_VERSION 4
+#define MAP_FILE_ALIGN 64 //a cache line, light tiles never straddle one
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t file_size;
+	int32_t width, height;
+	int32_t floor_width, floor_height;
+	int32_t ceil_width, ceil_height;
+	int32_t spawn_x, spawn_y;
+	float spawn_rot;
+	int32_t num_non_empty_tiles;
+	int32_t num_objects;
+	int32_t pvs_width, pvs_height;
+	//byte offsets from the start of the file
+	uint32_t tiles_offset;
+	uint32_t floor_offset;
+	uint32_t ceil_offset;
+	uint32_t light_offset;
+	uint32_t pvs_open_offset;
+	uint32_t pvs_closed_offset;
+	uint32_t objects_offset;
+} MapFileHeader;
+
+static MapLoadTimes s_loadTimes;
+
+#define MAP_JSON_NAME_LENGTH 64
+
+//tiles of one layer, they come before the layer name and size
+typedef struct
+{
+	TileID* tiles;
+	int count;
+	int capacity;
+} MapTileBuffer;
+
+typedef struct
+{
+	char type[MAP_JSON_NAME_LENGTH];
+	char name[MAP_JSON_NAME_LENGTH];
+	int width, height;
+	MapTileBuffer data;
+} MapJsonLayer;
+
+typedef struct
+{
+	MapObjectRecord* records;
+	int count;
+	int capacity;
+} MapRecordBuffer;
+
+static bool Map_ReadTileData(JsonReader* reader, MapTileBuffer* buffer)
+{
+	JsonToken token;
 
+	while (Json_Next(reader, &token))
+	{
+		if (token.type == JSON_TOKEN__ARRAY_END)
+		{
+			return true;
+		}
+		if (token.type != JSON_TOKEN__NUMBER)
+		{
+			return false;
 		}
-		//parse objects
-		else if (!strcmp(cJSON_GetStringValue(type), "objectgroup"))
+
+		if (buffer->count >= buffer->capacity)
 		{
-			cJSON* objects = cJSON_GetObjectItem(layer, "objects");
+			int capacity = (buffer->capacity > 0) ? buffer->capacity * 2 : 1024;
 
-			if (!objects || !cJSON_IsArray(objects))
+			TileID* tiles = realloc(buffer->tiles, sizeof(TileID) * capacity);
+
+			if (!tiles)
 			{
-				printf("ERROR::Failed to load map!\n");
-				result = false;
-				goto cleanup;
+				return false;
 			}
 
-			cJSON* object = NULL;
-			cJSON_ArrayForEach(object, objects)
-			{
-				cJSON* x_coord = cJSON_GetObjectItem(object, "x");
-				cJSON* y_coord = cJSON_GetObjectItem(object, "y");
+			buffer->tiles = tiles;
+			buffer->capacity = capacity;
+		}
+
+		buffer->tiles[buffer->count++] = (TileID)token.number;
+	}
+
+	return false;
+}
+
+//reads the number value of the property called name, properties are objects of name, type and value
+static bool Map_ReadProperties(JsonReader* reader, const char* name, double* r_value, bool* r_found)
+{
+	JsonToken token;
+
+	while (Json_Next(reader, &token) && token.type != JSON_TOKEN__ARRAY_END)
+	{
+		if (token.type != JSON_TOKEN__OBJECT_START)
+		{
+			return false;
+		}
+
+		bool name_matches = false;
+		bool has_value = false;
+		double value = 0;
+
+		JsonToken key;
+
+		while (Json_Next(reader, &key) && key.type != JSON_TOKEN__OBJECT_END)
+		{
+			if (!Json_Next(reader, &token))
+			{
+				return false;
+			}
+
+			if (Json_TokenEquals(&key, "name"))
+			{
+				name_matches = Json_TokenEquals(&token, name);
+			}
+			else if (Json_TokenEquals(&key, "value") && token.type == JSON_TOKEN__NUMBER)
+			{
+				value = token.number;
+				has_value = true;
+			}
+			else if (!Json_SkipValue(reader, &token))
+			{
+				return false;
+			}
+		}
+
+		if (key.type != JSON_TOKEN__OBJECT_END)
+		{
+			return false;
+		}
+
+		//first match wins
+		if (name_matches && has_value && !*r_found)
+		{
+			*r_value = value;
+			*r_found = true;
+		}
+	}
+
+	return token.type == JSON_TOKEN__ARRAY_END;
+}
+
+//returns false on a malformed object, r_record->type is OT__NONE for objects that are skipped
+static bool Map_ReadObject(JsonReader* reader, Map* map, MapObjectRecord* r_record)
+{
+	memset(r_record, 0, sizeof(MapObjectRecord));
+
+	r_record->type = OT__NONE;
+	r_record->map_id = -1;
+
+	char type_value[MAP_JSON_NAME_LENGTH] = { 0 };
+	bool has_type = false;
+	bool has_x = false;
+	bool has_y = false;
+	bool has_gid = false;
+	double x = 0, y = 0, gid = 0;
+
+	//properties are read after the type is known, so keep where they start
+	JsonReader properties = { NULL, NULL };
+
+	JsonToken key, token;
+
+	while (Json_Next(reader, &key) && key.type != JSON_TOKEN__OBJECT_END)
+	{
+		if (!Json_Next(reader, &token))
+		{
+			return false;
+		}
+
+		if (Json_TokenEquals(&key, "x") && token.type == JSON_TOKEN__NUMBER)
+		{
+			x = token.number;
+			has_x = true;
+		}
+		else if (Json_TokenEquals(&key, "y") && token.type == JSON_TOKEN__NUMBER)
+		{
+			y = token.number;
+			has_y = true;
+		}
+		else if (Json_TokenEquals(&key, "id") && token.type == JSON_TOKEN__NUMBER)
+		{
+			r_record->map_id = token.number;
+		}
+		else if (Json_TokenEquals(&key, "gid") && token.type == JSON_TOKEN__NUMBER)
+		{
+			gid = token.number;
+			has_gid = true;
+		}
+		else if (Json_TokenEquals(&key, "type") && token.type == JSON_TOKEN__STRING)
+		{
+			Json_CopyString(&token, type_value, sizeof(type_value));
+			has_type = true;
+		}
+		else
+		{
+			if (Json_TokenEquals(&key, "properties") && token.type == JSON_TOKEN__ARRAY_START)
+			{
+				properties = *reader;
+			}
+			if (!Json_SkipValue(reader, &token))
+			{
+				return false;
+			}
+		}
+	}
+
+	if (key.type != JSON_TOKEN__OBJECT_END || !has_x || !has_y)
+	{
+		return false;
+	}
+
+	if (!has_type)
+	{
+		return true;
+	}
+
+	r_record->x = x / TILE_SIZE;
+	r_record->y = y / TILE_SIZE;
+
+	if (!strcmp(type_value, "spawnpoint"))
+	{
+		map->player_spawn_point_x = r_record->x;
+		map->player_spawn_point_y = r_record->y;
+
+		double spawn_rot = 0;
+		bool found = false;
+
+		if (properties.cur && Map_ReadProperties(&properties, "spawn_rot", &spawn_rot, &found) && found)
+		{
+			map->player_spawn_rot = spawn_rot;
+		}
+
+		return true;
+	}
+
+	const MapObjectType* object_type = NULL;
+
+	for (size_t i = 0; i < sizeof(MAP_OBJECT_TYPES) / sizeof(MAP_OBJECT_TYPES[0]); i++)
+	{
+		if (!strcmp(type_value, MAP_OBJECT_TYPES[i].name))
+		{
+			object_type = &MAP_OBJECT_TYPES[i];
+			break;
+		}
+	}
+
+	if (!object_type)
+	{
+		return true;
+	}
+
+	r_record->type = object_type->type;
+	r_record->sub_type = object_type->sub_type;
+	r_record->flags = object_type->flags & MAP_RECORD_TILE_CENTERED;
+
+	if ((object_type->flags & (MAP_RECORD_GID | MAP_RECORD_STATE)) && has_gid)
+	{
+		r_record->gid = gid;
+		r_record->flags |= object_type->flags & (MAP_RECORD_GID | MAP_RECORD_STATE);
+	}
+
+	if (object_type->read_target && properties.cur)
+	{
+		double target = 0;
+		bool found = false;
+
+		if (Map_ReadProperties(&properties, "target", &target, &found) && found)
+		{
+			r_record->target = (unsigned)target;
+			r_record->flags |= MAP_RECORD_TARGET;
+		}
+	}
+
+	return true;
+}
+
+static bool Map_ReadObjects(JsonReader* reader, Map* map, MapRecordBuffer* buffer)
+{
+	JsonToken token;
+
+	while (Json_Next(reader, &token) && token.type != JSON_TOKEN__ARRAY_END)
+	{
+		if (token.type != JSON_TOKEN__OBJECT_START)
+		{
+			return false;
+		}
+
+		if (buffer->count >= buffer->capacity)
+		{
+			int capacity = (buffer->capacity > 0) ? buffer->capacity * 2 : 64;
+
+			MapObjectRecord* records = realloc(buffer->records, sizeof(MapObjectRecord) * capacity);
+
+			if (!records)
+			{
+				return false;
+			}
+
+			buffer->records = records;
+			buffer->capacity = capacity;
+		}
+
+		MapObjectRecord* record = &buffer->records[buffer->count];
+
+		if (!Map_ReadObject(reader, map, record))
+		{
+			return false;
+		}
+
+		if (record->type != OT__NONE)
+		{
+			buffer->count++;
+		}
+	}
+
+	return token.type == JSON_TOKEN__ARRAY_END;
+}
+
+//moves the tiles of a finished layer into the map
+static bool Map_TakeLayerTiles(MapJsonLayer* layer, TileID** r_tiles, int* r_width, int* r_height)
+{
+	//each layer only once
+	if (*r_tiles || layer->width <= 0 || layer->height <= 0 || layer->data.count < layer->width * layer->height)
+	{
+		return false;
+	}
+
+	*r_tiles = layer->data.tiles;
+	*r_width = layer->width;
+	*r_height = layer->height;
+
+	layer->data.tiles = NULL;
+
+	return true;
+}
+
+static bool Map_ReadLayer(JsonReader* reader, Map* map, MapRecordBuffer* records)
+{
+	MapJsonLayer layer;
+	memset(&layer, 0, sizeof(layer));
+
+	//objects of a layer that turns out not to be an object group are dropped
+	int first_record = records->count;
+
+	bool result = true;
+
+	JsonToken key, token;
+
+	while (Json_Next(reader, &key) && key.type != JSON_TOKEN__OBJECT_END)
+	{
+		if (!Json_Next(reader, &token))
+		{
+			result = false;
+			break;
+		}
+
+		if (Json_TokenEquals(&key, "data") && token.type == JSON_TOKEN__ARRAY_START)
+		{
+			result = Map_ReadTileData(reader, &layer.data);
+		}
+		else if (Json_TokenEquals(&key, "objects") && token.type == JSON_TOKEN__ARRAY_START)
+		{
+			result = Map_ReadObjects(reader, map, records);
+		}
+		else if (Json_TokenEquals(&key, "type"))
+		{
+			Json_CopyString(&token, layer.type, sizeof(layer.type));
+		}
+		else if (Json_TokenEquals(&key, "name"))
+		{
+			Json_CopyString(&token, layer.name, sizeof(layer.name));
+		}
+		else if (Json_TokenEquals(&key, "width") && token.type == JSON_TOKEN__NUMBER)
+		{
+			layer.width = token.number;
+		}
+		else if (Json_TokenEquals(&key, "height") && token.type == JSON_TOKEN__NUMBER)
+		{
+			layer.height = token.number;
+		}
+		else
+		{
+			result = Json_SkipValue(reader, &token);
+		}
+
+		if (!result)
+		{
+			break;
+		}
+	}
+
+	if (key.type != JSON_TOKEN__OBJECT_END || !layer.type[0] || !layer.name[0])
+	{
+		result = false;
+	}
+
+	if (result)
+	{
+		if (strcmp(layer.type, "objectgroup"))
+		{
+			records->count = first_record;
+		}
+
+		//tile layer
+		if (!strcmp(layer.type, "tilelayer") && !strcmp(layer.name, "tile_layer"))
+		{
+			result = Map_TakeLayerTiles(&layer, &map->tiles, &map->width, &map->height);
+		}
+		//floor layer
+		else if (!strcmp(layer.type, "tilelayer") && !strcmp(layer.name, "floor_layer"))
+		{
+			result = Map_TakeLayerTiles(&layer, &map->floor_tiles, &map->floor_width, &map->floor_height);
+		}
+		//ceil layer
+		else if (!strcmp(layer.type, "tilelayer") && !strcmp(layer.name, "ceil_layer"))
+		{
+			result = Map_TakeLayerTiles(&layer, &map->ceil_tiles, &map->ceil_width, &map->ceil_height);
+		}
+	}
+
+	if (layer.data.tiles)
+	{
+		free(layer.data.tiles);
+	}
+
+	return result;
+}
+
+/*
+	Reads the Tiled json in a single pass with the streaming reader, tiles go straight into tile buffers
+	without building a document first.
+*/
+static bool Map_LoadJson(const char* filename, Map* map, MapLoadTimes* times, MapObjectRecord** r_records, int* r_num_records)
+{
+	double start_time = Sys_GetTime();
+
+	MappedFile file;
+
+	if (!Sys_MapFile(&file, filename))
+	{
+		printf("Failed to open file for parsing at path: %s!\n", filename);
+		return false;
+	}
+
+	times->read_ms = (Sys_GetTime() - start_time) * 1000.0;
+
+	start_time = Sys_GetTime();
+
+	JsonReader reader;
+	Json_InitReader(&reader, file.data, file.size);
+
+	MapRecordBuffer records;
+	memset(&records, 0, sizeof(records));
+
+	bool result = true;
+	bool has_layers = false;
+
+	JsonToken key, token;
+
+	if (!Json_Next(&reader, &token) || token.type != JSON_TOKEN__OBJECT_START)
+	{
+		result = false;
+	}
+
+	while (result && Json_Next(&reader, &key) && key.type != JSON_TOKEN__OBJECT_END)
+	{
+		if (!Json_Next(&reader, &token))
+		{
+			result = false;
+			break;
+		}
+
+		if (!Json_TokenEquals(&key, "layers") || token.type != JSON_TOKEN__ARRAY_START)
+		{
+			result = Json_SkipValue(&reader, &token);
+			continue;
+		}
+
+		has_layers = true;
+
+		while (result && Json_Next(&reader, &token) && token.type != JSON_TOKEN__ARRAY_END)
+		{
+			result = (token.type == JSON_TOKEN__OBJECT_START) && Map_ReadLayer(&reader, map, &records);
+		}
+
+		if (token.type != JSON_TOKEN__ARRAY_END)
+		{
+			result = false;
+		}
+	}
+
+	Sys_UnmapFile(&file);
+
+	if (!has_layers || !map->tiles)
+	{
+		result = false;
+	}
+
+	if (result)
+	{
+		for (int i = 0; i < map->width * map->height; i++)
+		{
+			if (map->tiles[i] > 0)
+			{
+				map->num_non_empty_tiles++;
+			}
+		}
+
+		//allocate object tile buffer
+		map->object_tiles = calloc(map->height * map->width, sizeof(ObjectID));
+
+		if (!map->object_tiles)
+		{
+			result = false;
+		}
+	}
+
+	times->parse_ms = (Sys_GetTime() - start_time) * 1000.0;
+
+	if (!result)
+	{
+		free(records.records);
+		return false;
+	}
+
+	*r_records = records.records;
+	*r_num_records = records.count;
+
+	return true;
+}
+
+static void Map_SpawnRecord(const MapObjectRecord* record)
+{
+	Object* map_object = Object_Spawn(record->type, record->sub_type, record->x, record->y);
+
+	if (!map_object)
+	{
+		return;
+	}
+
+	if (record->flags & MAP_RECORD_STATE)
+	{
+		map_object->state = record->gid;
+	}
+	if (record->flags & MAP_RECORD_GID)
+	{
+		map_object->gid = record->gid;
+	}
+	if (record->flags & MAP_RECORD_TARGET)
+	{
+		//hacky way to store int, but works for now
+		map_object->target = (Object*)(intptr_t)record->target;
+	}
+
+	map_object->map_id = record->map_id;
+
+	if (record->flags & MAP_RECORD_TILE_CENTERED)
+	{
+		map_object->y -= 1;
+	}
+}
+
+static bool Map_CheckSection(const MapFileHeader* header, uint32_t offset, size_t size)
+{
+	return (offset % MAP_FILE_ALIGN) == 0 && offset >= sizeof(MapFileHeader) && offset <= header->file_size && size <= header->file_size - offset;
+}
+
+static bool Map_LoadBinary(const char* filename, Map* map, MapLoadTimes* times, const MapObjectRecord** r_records, int* r_num_records)
+{
+	double start_time = Sys_GetTime();
+
+	if (!Sys_MapFile(&map->file, filename))
+	{
+		return false;
+	}
+
+	times->read_ms = (Sys_GetTime() - start_time) * 1000.0;
+
+	start_time = Sys_GetTime();
+
+	unsigned char* data = map->file.data;
+	const MapFileHeader* header = (const MapFileHeader*)data;
+
+	if (map->file.size < sizeof(MapFileHeader) || header->magic != MAP_FILE_MAGIC || header->version != MAP_FILE_VERSION || header->file_size != map->file.size)
+	{
+		return false;
+	}
+
+	size_t num_tiles = (size_t)header->width * header->height;
+
+	if (header->width <= 0 || header->height <= 0 || header->num_objects < 0 || header->floor_width < 0 || header->floor_height < 0 || header->ceil_width < 0 || header->ceil_height < 0)
+	{
+		return false;
+	}
+
+	//the regions have to cover the map
+	int pvs_width = (header->width + PVS_REGION_SIZE - 1) >> PVS_REGION_SHIFT;
+	int pvs_height = (header->height + PVS_REGION_SIZE - 1) >> PVS_REGION_SHIFT;
+
+	if (header->pvs_width != pvs_width || header->pvs_height != pvs_height)
+	{
+		return false;
+	}
+
+	int pvs_row_words = (pvs_width * pvs_height + 63) / 64;
+	size_t pvs_size = sizeof(uint64_t) * pvs_row_words * pvs_width * pvs_height;
+
+	if (!Map_CheckSection(header, header->tiles_offset, num_tiles * sizeof(TileID))
+		|| !Map_CheckSection(header, header->floor_offset, (size_t)header->floor_width * header->floor_height * sizeof(TileID))
+		|| !Map_CheckSection(header, header->ceil_offset, (size_t)header->ceil_width * header->ceil_height * sizeof(TileID))
+		|| !Map_CheckSection(header, header->light_offset, num_tiles * sizeof(LightTile))
+		|| !Map_CheckSection(header, header->pvs_open_offset, pvs_size)
+		|| !Map_CheckSection(header, header->pvs_closed_offset, pvs_size)
+		|| !Map_CheckSection(header, header->objects_offset, (size_t)header->num_objects * sizeof(MapObjectRecord)))
+	{
+		return false;
+	}
+
+	//point straight into the mapping
+	map->width = header->width;
+	map->height = header->height;
+	map->tiles = (TileID*)(data + header->tiles_offset);
+
+	if (header->floor_width > 0 && header->floor_height > 0)
+	{
+		map->floor_width = header->floor_width;
+		map->floor_height = header->floor_height;
+		map->floor_tiles = (TileID*)(data + header->floor_offset);
+	}
+	if (header->ceil_width > 0 && header->ceil_height > 0)
+	{
+		map->ceil_width = header->ceil_width;
+		map->ceil_height = header->ceil_height;
+		map->ceil_tiles = (TileID*)(data + header->ceil_offset);
+	}
+
+	map->light_tiles = (LightTile*)(data + header->light_offset);
+
+	map->pvs_open = (uint64_t*)(data + header->pvs_open_offset);
+	map->pvs_closed = (uint64_t*)(data + header->pvs_closed_offset);
+	map->pvs_width = pvs_width;
+	map->pvs_height = pvs_height;
+	map->pvs_row_words = pvs_row_words;
+
+	map->player_spawn_point_x = header->spawn_x;
+	map->player_spawn_point_y = header->spawn_y;
+	map->player_spawn_rot = header->spawn_rot;
+	map->num_non_empty_tiles = header->num_non_empty_tiles;
+
+	//allocate object tile buffer
+	map->object_tiles = calloc(num_tiles, sizeof(ObjectID));
+
+	if (!map->object_tiles)
+	{
+		return false;
+	}
+
+	*r_records = (const MapObjectRecord*)(data + header->objects_offset);
+	*r_num_records = header->num_objects;
+
+	times->parse_ms = (Sys_GetTime() - start_time) * 1000.0;
+
+	return true;
+}
+
+static bool Map_IsCompiledPath(const char* filename)
+{
+	size_t length = strlen(filename);
+
+	return length >= 5 && !strcmp(filename + length - 5, ".rmap");
+}
+
+//same path with the .json extension swapped for .rmap
+static bool Map_GetCompiledPath(const char* filename, char* r_path, size_t size)
+{
+	size_t length = strlen(filename);
+
+	if (length < 5 || strcmp(filename + length - 5, ".json") || length + 1 > size)
+	{
+		return false;
+	}
+
+	memcpy(r_path, filename, length - 5);
+	memcpy(r_path + length - 5, ".rmap", 6);
+
+	return true;
+}
+
+//reads the tiles, light and object records of a level into map. Nothing else is touched, so it can run on the loader thread
+static bool Map_ReadLevel(const char* filename, bool force_json, Map* map, MapLoadTimes* times, MapObjectRecord** r_json_records, const MapObjectRecord** r_records, int* r_num_records)
+{
+	memset(times, 0, sizeof(MapLoadTimes));
+
+	//a compiled map next to the json is used when it is up to date
+	char compiled_path[512];
+	int64_t json_time, compiled_time;
+
+	if (!force_json && Map_GetCompiledPath(filename, compiled_path, sizeof(compiled_path))
+		&& Sys_GetFileTime(compiled_path, &compiled_time) && Sys_GetFileTime(filename, &json_time) && compiled_time >= json_time)
+	{
+		filename = compiled_path;
+	}
+
+	times->compiled = Map_IsCompiledPath(filename);
+
+	*r_json_records = NULL;
+	*r_records = NULL;
+	*r_num_records = 0;
+
+	bool result = false;
+
+	if (times->compiled)
+	{
+		result = Map_LoadBinary(filename, map, times, r_records, r_num_records);
+	}
+	else
+	{
+		result = Map_LoadJson(filename, map, times, r_json_records, r_num_records);
+		*r_records = *r_json_records;
+	}
+
+	if (!result)
+	{
+		printf("ERROR::Failed to load map!\n");
+		free(*r_json_records);
+		*r_json_records = NULL;
+	}
+
+	return result;
+}
+
+//frees what Map_ReadLevel allocated
+static void Map_FreeLevel(Map* map)
+{
+	//compiled maps point into the mapped file
+	if (map->file.data)
+	{
+		Sys_UnmapFile(&map->file);
+	}
+	else
+	{
+		if (map->tiles) free(map->tiles);
+		if (map->floor_tiles) free(map->floor_tiles);
+		if (map->ceil_tiles) free(map->ceil_tiles);
+		if (map->light_tiles) free(map->light_tiles);
+		if (map->pvs_open) free(map->pvs_open);
+		if (map->pvs_closed) free(map->pvs_closed);
+	}
+
+	if (map->object_tiles) free(map->object_tiles);
+}
+
+//moves a level read into another map over to the live map
+static void Map_TakeLevel(Map* level)
+{
+	s_map.width = level->width;
+	s_map.height = level->height;
+	s_map.tiles = level->tiles;
+
+	s_map.floor_width = level->floor_width;
+	s_map.floor_height = level->floor_height;
+	s_map.floor_tiles = level->floor_tiles;
+
+	s_map.ceil_width = level->ceil_width;
+	s_map.ceil_height = level->ceil_height;
+	s_map.ceil_tiles = level->ceil_tiles;
+
+	s_map.light_tiles = level->light_tiles;
+	s_map.object_tiles = level->object_tiles;
+
+	s_map.pvs_open = level->pvs_open;
+	s_map.pvs_closed = level->pvs_closed;
+	s_map.pvs_width = level->pvs_width;
+	s_map.pvs_height = level->pvs_height;
+	s_map.pvs_row_words = level->pvs_row_words;
+
+	s_map.player_spawn_point_x = level->player_spawn_point_x;
+	s_map.player_spawn_point_y = level->player_spawn_point_y;
+	s_map.player_spawn_rot = level->player_spawn_rot;
+	s_map.num_non_empty_tiles = level->num_non_empty_tiles;
+
+	s_map.file = level->file;
+
+	memset(level, 0, sizeof(Map));
+}
+
+static bool Map_SetupTempLights()
+{
+	size_t num_tiles = (size_t)s_map.width * s_map.height;
+
+	for (int i = 0; i < 2; i++)
+	{
+		//a tile is only listed once per buffer
+		s_map.temp_lights[i] = calloc(num_tiles, sizeof(uint8_t));
+		s_map.temp_light_tiles[i] = malloc(sizeof(int) * num_tiles);
+		s_map.num_temp_light_tiles[i] = 0;
+
+		if (!s_map.temp_lights[i] || !s_map.temp_light_tiles[i])
+		{
+			return false;
+		}
+	}
+
+	s_map.temp_light_front = 0;
+
+	return true;
+}
+
+static void Map_FreeTempLights()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (s_map.temp_lights[i]) free(s_map.temp_lights[i]);
+		if (s_map.temp_light_tiles[i]) free(s_map.temp_light_tiles[i]);
+
+		s_map.temp_lights[i] = NULL;
+		s_map.temp_light_tiles[i] = NULL;
+		s_map.num_temp_light_tiles[i] = 0;
+	}
+}
+
+//spawns the objects of a level that was just read, start_time is when the game thread started waiting on the load
+static void Map_SetupLevel(const char* filename, const MapObjectRecord* records, int num_records, double start_time, bool prefetched)
+{
+	double objects_time = Sys_GetTime();
+
+	for (int i = 0; i < num_records; i++)
+	{
+		Map_SpawnRecord(&records[i]);
+	}
+
+	Map_ConnectTriggersToTargets();
+	Map_UpdateObjectTilemap();
+
+	s_loadTimes.objects_ms = (Sys_GetTime() - objects_time) * 1000.0;
+
+	//compiled maps have the light and pvs baked
+	if (!s_loadTimes.compiled)
+	{
+		double light_time = Sys_GetTime();
+
+		Map_SetupLightTiles();
+
+		s_loadTimes.light_ms = (Sys_GetTime() - light_time) * 1000.0;
+
+		double pvs_time = Sys_GetTime();
+
+		Map_SetupPVS();
+
+		s_loadTimes.pvs_ms = (Sys_GetTime() - pvs_time) * 1000.0;
+	}
+
+	Map_CountOpenDoors();
+
+	if (!Map_SetupTempLights())
+	{
+		//temp lights are skipped without the buffers
+		Map_FreeTempLights();
+	}
+
+	s_loadTimes.prefetched = prefetched;
+	s_loadTimes.total_ms = s_loadTimes.read_ms + s_loadTimes.parse_ms + s_loadTimes.objects_ms + s_loadTimes.light_ms + s_loadTimes.pvs_ms;
+	s_loadTimes.stall_ms = (Sys_GetTime() - start_time) * 1000.0;
+
+	printf("Map: %s%s%s loaded in %.2f ms (read %.2f, parse %.2f, objects %.2f, light %.2f, pvs %.2f), game thread waited %.2f ms\n", filename, s_loadTimes.compiled ? " (compiled)" : "", prefetched ? " (prefetched)" : "",
+		s_loadTimes.total_ms, s_loadTimes.read_ms, s_loadTimes.parse_ms, s_loadTimes.objects_ms, s_loadTimes.light_ms, s_loadTimes.pvs_ms, s_loadTimes.stall_ms);
+}
+
+static bool Map_LoadInternal(const char* filename, MapObjectRecord** r_json_records, int* r_num_json_records)
+{
+	Map_Destruct();
+
+	double start_time = Sys_GetTime();
+
+	MapObjectRecord* json_records = NULL;
+	const MapObjectRecord* records = NULL;
+	int num_records = 0;
+
+	//the converter always reads the json
+	if (!Map_ReadLevel(filename, r_json_records != NULL, &s_map, &s_loadTimes, &json_records, &records, &num_records))
+	{
+		Map_Destruct();
+		return false;
+	}
+
+	Map_SetupLevel(filename, records, num_records, start_time, false);
+
+	if (r_json_records)
+	{
+		*r_json_records = json_records;
+		*r_num_json_records = num_records;
+	}
+	else
+	{
+		free(json_records);
+	}
+
+	return true;
+}
+
+bool Map_Load(const char* filename)
+{
+	return Map_LoadInternal(filename, NULL, NULL);
+}
+
+/*
+	The next level in LEVELS is read on a loader thread into a second map while the current one is played,
+	so a level change only has to swap the tiles in and spawn the objects. Spawning stays on the game thread
+	since it touches the game state, json maps without a compiled map also bake their light there.
+*/
+typedef struct
+{
+	Thread thread;
+	bool active; //thread started and not joined yet
+	int level_index;
+	Map* map;
+	MapLoadTimes times;
+	MapObjectRecord* json_records;
+	const MapObjectRecord* records;
+	int num_records;
+	bool result;
+} MapLoader;
+
+static MapLoader s_loader;
+
+static void Map_LoaderThread(void* arg)
+{
+	MapLoader* loader = arg;
+
+	loader->result = Map_ReadLevel(LEVELS[loader->level_index], false, loader->map, &loader->times, &loader->json_records, &loader->records, &loader->num_records);
+}
+
+static void Map_ResetLoader()
+{
+	if (s_loader.map)
+	{
+		Map_FreeLevel(s_loader.map);
+		free(s_loader.map);
+	}
+
+	free(s_loader.json_records);
+
+	memset(&s_loader, 0, sizeof(s_loader));
+}
+
+void Map_CancelPrefetch()
+{
+	if (s_loader.active)
+	{
+		Thread_Join(&s_loader.thread);
+	}
+
+	Map_ResetLoader();
+}
+
+static void Map_PrefetchLevel(int index)
+{
+	int arr_size = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+	if (s_loader.active && s_loader.level_index == index)
+	{
+		return;
+	}
+
+	Map_CancelPrefetch();
+
+	if (index < 0 || index >= arr_size)
+	{
+		return;
+	}
+
+	s_loader.map = calloc(1, sizeof(Map));
+
+	if (!s_loader.map)
+	{
+		return;
+	}
+
+	s_loader.level_index = index;
+
+	if (!Thread_Create(&s_loader.thread, Map_LoaderThread, &s_loader))
+	{
+		Map_ResetLoader();
+		return;
+	}
+
+	s_loader.active = true;
+}
+
+//swaps in the prefetched level if it is the one asked for, waits for the loader thread if it is not done yet
+static bool Map_TakePrefetchedLevel(int index)
+{
+	if (!s_loader.active || s_loader.level_index != index)
+	{
+		return false;
+	}
+
+	double start_time = Sys_GetTime();
+
+	Thread_Join(&s_loader.thread);
+	s_loader.active = false;
+
+	if (!s_loader.result)
+	{
+		Map_ResetLoader();
+		return false;
+	}
+
+	Map_Destruct();
+	Map_TakeLevel(s_loader.map);
+
+	s_loadTimes = s_loader.times;
+
+	Map_SetupLevel(LEVELS[index], s_loader.records, s_loader.num_records, start_time, true);
+
+	Map_ResetLoader();
+
+	return true;
+}
+
+bool Map_LoadFromIndex(int index)
+{
+	int arr_size = sizeof(LEVELS) / sizeof(LEVELS[0]);
+	if (index >= arr_size)
+	{
+		index = arr_size - 1;
+	}
+	else if (index < 0)
+	{
+		index = 0;
+	}
 
-				if (!x_coord || !y_coord || !cJSON_IsNumber(x_coord) || !cJSON_IsNumber(y_coord))
-				{
-					printf("ERROR::Failed to load map!\n");
-					result = false;
-					goto cleanup;
-				}
+	//fall back to a blocking load when the level was not prefetched
+	if (!Map_TakePrefetchedLevel(index) && !Map_Load(LEVELS[index]))
+	{
+		return false;
+	}
 
-				cJSON* type = cJSON_GetObjectItem(object, "type");
-				if (!type || !cJSON_IsString(type))
-				{
-					continue;
-				}
+	s_map.level_index = index;
 
-				cJSON* id = cJSON_GetObjectItem(object, "id");
+	//start reading the next level
+	Map_PrefetchLevel(index + 1);
 
-				int map_id = -1;
+	return true;
+}
 
-				if (id && cJSON_IsNumber(id))
-				{
-					map_id = cJSON_GetNumberValue(id);
-				}
+const MapLoadTimes* Map_GetLoadTimes()
+{
+	return &s_loadTimes;
+}
 
-				float obj_x = cJSON_GetNumberValue(x_coord) / TILE_SIZE;
-				float obj_y = cJSON_GetNumberValue(y_coord) / TILE_SIZE;
+static uint32_t Map_AlignOffset(uint32_t offset)
+{
+	return (offset + MAP_FILE_ALIGN - 1) & ~(MAP_FILE_ALIGN - 1);
+}
 
-				char* type_value = cJSON_GetStringValue(type);
+static bool Map_WriteSection(FILE* file, uint32_t offset, const void* data, size_t size)
+{
+	//zero padding up to the aligned offset
+	static const unsigned char zeros[MAP_FILE_ALIGN];
 
+	long pos = ftell(file);
 
-				if (!strcmp(type_value, "spawnpoint"))
-				{
-					s_map.player_spawn_point_x = obj_x;
-					s_map.player_spawn_point_y = obj_y;
-
-					cJSON* props = cJSON_GetObjectItem(object, "properties");
-
-					if (props && cJSON_IsArray(props))
-					{
-						cJSON* prop = NULL;
-						cJSON_ArrayForEach(prop, props)
-						{
-							cJSON* prop_name = cJSON_GetObjectItem(prop, "name");
-
-							if (prop_name && cJSON_IsString(prop_name) && !strcmp(cJSON_GetStringValue(prop_name), "spawn_rot"))
-							{
-								cJSON* prop_value = cJSON_GetObjectItem(prop, "value");
-
-								if (prop_value && cJSON_IsNumber(prop_value))
-								{
-									s_map.player_spawn_rot = cJSON_GetNumberValue(prop_value);
-									break;
-								}
-							}
-						}
-					}
+	if (pos < 0 || (uint32_t)pos > offset || fwrite(zeros, 1, offset - (uint32_t)pos, file) != offset - (uint32_t)pos)
+	{
+		return false;
+	}
 
-					continue;
-				}
+	return size == 0 || fwrite(data, 1, size, file) == size;
+}
 
-				Object* map_object = NULL;
+bool Map_Compile(const char* json_path, const char* out_path)
+{
+	MapObjectRecord* records = NULL;
+	int num_records = 0;
 
-				bool is_tile_centered = false;
+	if (!Map_LoadInternal(json_path, &records, &num_records))
+	{
+		return false;
+	}
 
-				if (!strcmp(type_value, "light_torch"))
-				{
-					map_object = Object_Spawn(OT__LIGHT, SUB__LIGHT_TORCH, obj_x, obj_y);
-				}
-				if (!strcmp(type_value, "light_lamp"))
-				{
-					map_object = Object_Spawn(OT__LIGHT, SUB__LIGHT_LAMP, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "thing_redcollumn"))
-				{
-					map_object = Object_Spawn(OT__THING, SUB__THING_RED_COLLUMN, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "thing_bluecollumn"))
-				{
-					map_object = Object_Spawn(OT__THING, SUB__THING_BLUE_COLLUMN, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "thing_redflag"))
-				{
-					map_object = Object_Spawn(OT__THING, SUB__THING_RED_FLAG, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "thing_blueflag"))
-				{
-					map_object = Object_Spawn(OT__THING, SUB__THING_BLUE_FLAG, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "monster_imp"))
-				{
-					map_object = Object_Spawn(OT__MONSTER, SUB__MOB_IMP, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "monster_pinky"))
-				{
-					map_object = Object_Spawn(OT__MONSTER, SUB__MOB_PINKY, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "monster_bruiser"))
-				{
-					map_object = Object_Spawn(OT__MONSTER, SUB__MOB_BRUISER, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_smallhp"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_SMALLHP, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_bighp"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_BIGHP, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_ammo"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_AMMO, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_rockets"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_ROCKETS, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_godmode"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_INVUNERABILITY, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_quad"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_QUAD_DAMAGE, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_shotgun"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_SHOTGUN, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_machinegun"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_MACHINEGUN, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "pickup_devastator"))
-				{
-					map_object = Object_Spawn(OT__PICKUP, SUB__PICKUP_DEVASTATOR, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "trigger") || !strcmp(type_value, "trigger_once") || !strcmp(type_value, "trigger_switch"))
-				{
-					if (!strcmp(type_value, "trigger_once"))
-					{
-						map_object = Object_Spawn(OT__TRIGGER, SUB__TRIGGER_ONCE, obj_x, obj_y);
-					}
-					else if(!strcmp(type_value, "trigger_switch"))
-					{
-						map_object = Object_Spawn(OT__TRIGGER, SUB__TRIGGER_SWITCH, obj_x, obj_y);
-
-						is_tile_centered = true;
-
-						cJSON* gid = cJSON_GetObjectItem(object, "gid");
-
-						if (gid && cJSON_IsNumber(gid))
-						{
-							map_object->state = cJSON_GetNumberValue(gid);
-						}
-					}
-					else
-					{
-						map_object = Object_Spawn(OT__TRIGGER, SUB__NONE, obj_x, obj_y);
-					}
-
-					if (map_object)
-					{
-						is_tile_centered = true;
-
-						cJSON* props = cJSON_GetObjectItem(object, "properties");
-
-						if (props && cJSON_IsArray(props))
-						{
-							cJSON* prop = NULL;
-							cJSON_ArrayForEach(prop, props)
-							{
-								cJSON* prop_name = cJSON_GetObjectItem(prop, "name");
-
-								if (prop_name && cJSON_IsString(prop_name) && !strcmp(cJSON_GetStringValue(prop_name), "target"))
-								{
-									cJSON* prop_value = cJSON_GetObjectItem(prop, "value");
-
-									if (prop_value && cJSON_IsNumber(prop_value))
-									{
-										//hacky way to store int, but works for now
-										map_object->target = (unsigned)cJSON_GetNumberValue(prop_value);
-										break;
-									}
-								}
-							}
-						}
-					}
-					
-				}
-				else if (!strcmp(type_value, "trigger_secret"))
-				{
-					map_object = Object_Spawn(OT__TRIGGER, SUB__TRIGGER_SECRET, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "trigger_changelevel"))
-				{
-					map_object = Object_Spawn(OT__TRIGGER, SUB__TRIGGER_CHANGELEVEL, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "target_teleport"))
-				{
-					map_object = Object_Spawn(OT__TARGET, SUB__TARGET_TELEPORT, obj_x, obj_y);
-				}
-				else if (!strcmp(type_value, "door_v"))
-				{
-					map_object = Object_Spawn(OT__DOOR, SUB__DOOR_VERTICAL, obj_x, obj_y);
+	size_t num_tiles = (size_t)s_map.width * s_map.height;
+	size_t floor_size = (size_t)s_map.floor_width * s_map.floor_height * sizeof(TileID);
+	size_t ceil_size = (size_t)s_map.ceil_width * s_map.ceil_height * sizeof(TileID);
+	size_t pvs_size = sizeof(uint64_t) * s_map.pvs_row_words * s_map.pvs_width * s_map.pvs_height;
 
-					if (map_object)
-					{
-						is_tile_centered = true;
+	if (!s_map.pvs_open)
+	{
+		printf("ERROR::Failed to build the pvs of %s!\n", json_path);
 
-						cJSON* gid = cJSON_GetObjectItem(object, "gid");
+		free(records);
+		Map_Destruct();
 
-						if (gid && cJSON_IsNumber(gid))
-						{
-							map_object->gid = cJSON_GetNumberValue(gid);
-						}
+		return false;
+	}
 
-					}
-				}
-				else if (!strcmp(type_value, "tile_fake"))
-				{
-					map_object = Object_Spawn(OT__SPECIAL_TILE, SUB__SPECIAL_TILE_FAKE, obj_x, obj_y);
+	MapFileHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = MAP_FILE_MAGIC;
+	header.version = MAP_FILE_VERSION;
+	header.width = s_map.width;
+	header.height = s_map.height;
+	header.floor_width = (s_map.floor_tiles) ? s_map.floor_width : 0;
+	header.floor_height = (s_map.floor_tiles) ? s_map.floor_height : 0;
+	header.ceil_width = (s_map.ceil_tiles) ? s_map.ceil_width : 0;
+	header.ceil_height = (s_map.ceil_tiles) ? s_map.ceil_height : 0;
+	header.spawn_x = s_map.player_spawn_point_x;
+	header.spawn_y = s_map.player_spawn_point_y;
+	header.spawn_rot = s_map.player_spawn_rot;
+	header.num_non_empty_tiles = s_map.num_non_empty_tiles;
+	header.num_objects = num_records;
+	header.pvs_width = s_map.pvs_width;
+	header.pvs_height = s_map.pvs_height;
+
+	header.tiles_offset = Map_AlignOffset(sizeof(MapFileHeader));
+	header.floor_offset = Map_AlignOffset(header.tiles_offset + num_tiles * sizeof(TileID));
+	header.ceil_offset = Map_AlignOffset(header.floor_offset + floor_size);
+	header.light_offset = Map_AlignOffset(header.ceil_offset + ceil_size);
+	header.pvs_open_offset = Map_AlignOffset(header.light_offset + num_tiles * sizeof(LightTile));
+	header.pvs_closed_offset = Map_AlignOffset(header.pvs_open_offset + pvs_size);
+	header.objects_offset = Map_AlignOffset(header.pvs_closed_offset + pvs_size);
+	header.file_size = header.objects_offset + num_records * sizeof(MapObjectRecord);
+
+	FILE* file = NULL;
+	fopen_s(&file, out_path, "wb");
+
+	bool result = (file != NULL);
+
+	if (file)
+	{
+		result = Map_WriteSection(file, 0, &header, sizeof(header))
+			&& Map_WriteSection(file, header.tiles_offset, s_map.tiles, num_tiles * sizeof(TileID))
+			&& Map_WriteSection(file, header.floor_offset, s_map.floor_tiles, floor_size)
+			&& Map_WriteSection(file, header.ceil_offset, s_map.ceil_tiles, ceil_size)
+			&& Map_WriteSection(file, header.light_offset, s_map.light_tiles, num_tiles * sizeof(LightTile))
+			&& Map_WriteSection(file, header.pvs_open_offset, s_map.pvs_open, pvs_size)
+			&& Map_WriteSection(file, header.pvs_closed_offset, s_map.pvs_closed, pvs_size)
+			&& Map_WriteSection(file, header.objects_offset, records, num_records * sizeof(MapObjectRecord));
+
+		result = (fclose(file) == 0) && result;
+	}
 
-					if (map_object)
-					{
-						is_tile_centered = true;
+	if (!result)
+	{
+		printf("ERROR::Failed to write compiled map %s!\n", out_path);
+	}
 
-						cJSON* gid = cJSON_GetObjectItem(object, "gid");
+	free(records);
+	Map_Destruct();
 
-						if (gid && cJSON_IsNumber(gid))
-						{
-							map_object->gid = cJSON_GetNumberValue(gid);
-						}
+	return result;
+}
 
-					}
-				}
+//writes the .rmap next to the json
+bool Map_CompileFile(const char* json_path)
+{
+	char out_path[512];
 
-				if (map_object)
-				{
-					map_object->map_id = map_id;
+	if (!Map_GetCompiledPath(json_path, out_path, sizeof(out_path)))
+	{
+		printf("ERROR::%s is not a json map!\n", json_path);
+		return false;
+	}
 
-					if (is_tile_centered)
-					{
-						map_object->y -= 1;
-					}
-				}
-			}
-		
-		}
+	if (!Map_Compile(json_path, out_path))
+	{
+		return false;
 	}
 
-	Map_ConnectTriggersToTargets();
-	Map_UpdateObjectTilemap();
-	Map_UpdateSortedList();
-	Map_SetupLightTiles();
+	printf("Compiled %s to %s\n", json_path, out_path);
+
+	return true;
+}
 
-	if (!s_map.tiles) 
+bool Map_CompileLevels()
+{
+	bool result = true;
+
+	for (size_t i = 0; i < sizeof(LEVELS) / sizeof(LEVELS[0]); i++)
 	{
-		printf("ERROR::Failed to load map!\n");
-		result = false;
-		goto cleanup;
+		result = Map_CompileFile(LEVELS[i]) && result;
 	}
 
-	cleanup:
-	//cleanup
-	cJSON_Delete(json);
-	
 	return result;
 }
 
@@ -986,14 +2300,7 @@ Object* Map_GetObjectAtTile(int x, int y)
 
 	size_t index = x + y * s_map.width;
 
-	ObjectID id = s_map.object_tiles[index];
-
-	if (id == NULL_INDEX)
-	{
-		return NULL;
-	}
-
-	return &s_map.objects[id];
+	return Map_GetTileObject(s_map.object_tiles[index]);
 }
 
 LightTile* Map_GetLightTile(int x, int y)
@@ -1022,7 +2329,76 @@ LightTile* Map_GetLightTile(int x, int y)
 
 void Map_SetTempLight(int x, int y, int size, int light)
 {
-	Trace_ShadowCast(x, y, size, SetTempLightTileCallback);
+	if (!s_map.temp_lights[0] || x < 0 || y < 0 || x >= s_map.width || y >= s_map.height)
+	{
+		return;
+	}
+
+	LightSource source;
+	Map_SetLightSource(&source, x, y, 4.5, 1, 0.5);
+
+	Trace_ShadowCast(x, y, size, SetTempLightTileCallback, &source);
+}
+
+int Map_GetTempLight(int x, int y)
+{
+	const uint8_t* temp_lights = s_map.temp_lights[s_map.temp_light_front];
+
+	if (!temp_lights)
+	{
+		return 0;
+	}
+
+	if (x < 0) x = 0; else if (x >= s_map.width) x = s_map.width - 1;
+	if (y < 0) y = 0; else if (y >= s_map.height) y = s_map.height - 1;
+
+	return temp_lights[x + y * s_map.width];
+}
+
+//shows the lights set since the last swap, and clears the tiles lit by the buffer that was shown so it can be lit again
+void Map_SwapTempLights()
+{
+	int front = s_map.temp_light_front;
+	int back = !front;
+
+	//nothing lit now or in the frame that is shown
+	if (s_map.num_temp_light_tiles[front] == 0 && s_map.num_temp_light_tiles[back] == 0)
+	{
+		return;
+	}
+
+	//the world is drawn while holding the object mutex, so no render thread is reading the front buffer once it is taken
+	Render_LockObjectMutex();
+	s_map.temp_light_front = back;
+	Render_UnlockObjectMutex();
+
+	uint8_t* temp_lights = s_map.temp_lights[front];
+	const int* tiles = s_map.temp_light_tiles[front];
+
+	for (int i = 0; i < s_map.num_temp_light_tiles[front]; i++)
+	{
+		temp_lights[tiles[i]] = 0;
+	}
+
+	s_map.num_temp_light_tiles[front] = 0;
+}
+
+bool Map_CheckPVS(float x, float y, float target_x, float target_y)
+{
+	//the closed set is only right while every door is closed
+	const uint64_t* pvs = (s_map.num_open_doors > 0) ? s_map.pvs_open : s_map.pvs_closed;
+
+	if (!pvs || x < 0 || y < 0 || target_x < 0 || target_y < 0 || x >= s_map.width || y >= s_map.height || target_x >= s_map.width || target_y >= s_map.height)
+	{
+		return true;
+	}
+
+	int region = Map_GetPVSRegion((int)x, (int)y);
+	int target_region = Map_GetPVSRegion((int)target_x, (int)target_y);
+
+	const uint64_t* row = pvs + (size_t)region * s_map.pvs_row_words;
+
+	return (row[target_region >> 6] >> (target_region & 63)) & 1;
 }
 
 TileID Map_Raycast(float p_x, float p_y, float dir_x, float dir_y, float* r_hitX, float* r_hitY)
@@ -1185,46 +2561,35 @@ bool Map_UpdateObjectTile(Object* obj)
 		return false;
 	}
 
-	ObjectID id = s_map.object_tiles[index];
-
-	if (id != NULL_INDEX)
+	//already in this tile
+	if (obj->tile_index == index)
 	{
-		Object* tile_obj = &s_map.objects[id];
+		return true;
+	}
 
-		if (tile_obj != obj)
+	//missiles are never blocked, monsters are left to the radius checks of Move_CheckStep
+	if (obj->type != OT__MISSILE)
+	{
+		for (Object* tile_obj = Map_GetTileObject(s_map.object_tiles[index]); tile_obj; tile_obj = Map_GetTileObject(tile_obj->tile_next))
 		{
-			//if we are a missile don't take take anyone's place
-			if (obj->type == OT__MISSILE)
-			{
-				return true;
-			}
-
-			if (tile_obj->type == OT__PLAYER || tile_obj == OT__MONSTER || tile_obj->type == OT__THING)
+			if (tile_obj->type == OT__PLAYER || tile_obj->type == OT__THING)
 			{
 				return false;
 			}
-
-			//return true, but don't take the spot
-			if (tile_obj->type == OT__DOOR || tile_obj->type == OT__TRIGGER || tile_obj->type == OT__SPECIAL_TILE || tile_obj->type == OT__PICKUP)
-			{
-				return true;
-			}
-			
 		}
 	}
 
-	//free up old tile index
-	if (obj->tile_index != NULL_INDEX)
-	{
-		s_map.object_tiles[obj->tile_index] = NULL_INDEX;
-	}
-	
-	obj->tile_index = index;
-	s_map.object_tiles[index] = obj->id;
+	Map_UnlinkTileObject(obj);
+	Map_LinkTileObject(obj, index);
 
 	return true;
 }
 
+Object* Map_GetNextTileObject(const Object* obj)
+{
+	return Map_GetTileObject(obj->tile_next);
+}
+
 int Map_GetTotalTiles()
 {
 	return s_map.width * s_map.height;
@@ -1239,10 +2604,21 @@ void Map_DrawObjects(Image* image, float* depth_buffer, DrawSpan* draw_spans, fl
 {
 	for (int i = 0; i < s_map.num_sorted_objects; i++)
 	{
-		ObjectID id = s_map.sorted_list[i];
-		Object* object = &s_map.objects[id];
+		ObjectID id = *Map_SortedListEntry(i);
+		int index = id & OBJECT_INDEX_MASK;
+
+		ObjectChunk* chunk = s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT];
+		int slot = index & (OBJECT_CHUNK_SIZE - 1);
+
+		//behind the camera or in a region that can't be seen, checked before the object is touched
+		if (chunk->view_y[slot] <= 0 || !Map_CheckPVS(p_x, p_y, chunk->sprite_x[slot], chunk->sprite_y[slot]))
+		{
+			continue;
+		}
 
-		if (object->type == OT__NONE || !object->sprite.img || object->sprite.skip_draw == true)
+		Object* object = Map_ObjectAt(index);
+
+		if (object->type == OT__NONE || !object->sprite.img)
 		{
 			continue;
 		}
@@ -1253,24 +2629,124 @@ void Map_DrawObjects(Image* image, float* depth_buffer, DrawSpan* draw_spans, fl
 	}
 }
 
+//world position of the sprite, also copied to the chunk for the view pass
+static void Map_UpdateSpritePosition(Object* obj, int index)
+{
+	if (!obj->sprite.img)
+	{
+		return;
+	}
+
+	ObjectChunk* chunk = s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT];
+	int slot = index & (OBJECT_CHUNK_SIZE - 1);
+
+	obj->sprite.x = obj->x + obj->sprite.offset_x;
+	obj->sprite.y = obj->y + obj->sprite.offset_y;
+
+	chunk->sprite_x[slot] = obj->sprite.x;
+	chunk->sprite_y[slot] = obj->sprite.y;
+}
+
+/*
+	Moves the sprite positions of every chunk to camera space. Free slots are transformed as well,
+	nothing reads them and the loop stays free of branches.
+*/
+static void Map_TransformObjectViews(float view_x, float view_y, float dir_x, float dir_y, float plane_x, float plane_y)
+{
+	float inv_det = 1.0 / (plane_x * dir_y - dir_x * plane_y);
+
+	for (int c = 0; c < s_map.num_object_chunks; c++)
+	{
+		ObjectChunk* chunk = s_map.object_chunks[c];
+
+		int count = min(s_map.num_objects - c * OBJECT_CHUNK_SIZE, OBJECT_CHUNK_SIZE);
+		int i = 0;
+
+#if defined(MAP_X86)
+		const __m128 v_x = _mm_set1_ps(view_x);
+		const __m128 v_y = _mm_set1_ps(view_y);
+		const __m128 d_x = _mm_set1_ps(dir_x);
+		const __m128 d_y = _mm_set1_ps(dir_y);
+		const __m128 p_x = _mm_set1_ps(plane_x);
+		const __m128 neg_p_y = _mm_set1_ps(-plane_y);
+		const __m128 det = _mm_set1_ps(inv_det);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 local_x = _mm_sub_ps(_mm_loadu_ps(chunk->sprite_x + i), v_x);
+			__m128 local_y = _mm_sub_ps(_mm_loadu_ps(chunk->sprite_y + i), v_y);
+
+			__m128 transform_x = _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(d_y, local_x), _mm_mul_ps(d_x, local_y)));
+			__m128 transform_y = _mm_mul_ps(det, _mm_add_ps(_mm_mul_ps(neg_p_y, local_x), _mm_mul_ps(p_x, local_y)));
+
+			_mm_storeu_ps(chunk->view_x + i, transform_x);
+			_mm_storeu_ps(chunk->view_y + i, transform_y);
+		}
+#elif defined(MAP_NEON)
+		const float32x4_t v_x = vdupq_n_f32(view_x);
+		const float32x4_t v_y = vdupq_n_f32(view_y);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t local_x = vsubq_f32(vld1q_f32(chunk->sprite_x + i), v_x);
+			float32x4_t local_y = vsubq_f32(vld1q_f32(chunk->sprite_y + i), v_y);
+
+			float32x4_t transform_x = vmulq_n_f32(vsubq_f32(vmulq_n_f32(local_x, dir_y), vmulq_n_f32(local_y, dir_x)), inv_det);
+			float32x4_t transform_y = vmulq_n_f32(vaddq_f32(vmulq_n_f32(local_x, -plane_y), vmulq_n_f32(local_y, plane_x)), inv_det);
+
+			vst1q_f32(chunk->view_x + i, transform_x);
+			vst1q_f32(chunk->view_y + i, transform_y);
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			//translate sprite position to relative to camera
+			float local_sprite_x = chunk->sprite_x[i] - view_x;
+			float local_sprite_y = chunk->sprite_y[i] - view_y;
+
+			chunk->view_x[i] = inv_det * (dir_y * local_sprite_x - dir_x * local_sprite_y);
+			chunk->view_y[i] = inv_det * (-plane_y * local_sprite_x + plane_x * local_sprite_y);
+		}
+	}
+}
+
 void Map_UpdateObjects(float delta)
 {
 	float view_x, view_y, dir_x, dir_y, dir_z, plane_x, plane_y;
 	Player_GetView(&view_x, &view_y, &dir_x, &dir_y, &plane_x, &plane_y);
 
-	float inv_det = 1.0 / (plane_x * dir_y - dir_x * plane_y);
+	//paths toward the player are shared by every monster
+	Flow_Update(Player_GetObj());
 
+	//trace the lines the monsters will look along together
 	for (int i = 0; i < s_map.num_sorted_objects; i++)
 	{
-		ObjectID id = s_map.sorted_list[i];
+		ObjectID id = *Map_SortedListEntry(i);
 		if (id < 0)
 		{
 			continue;
 		}
 
-		Object* obj = &s_map.objects[id];
+		Object* obj = Map_ObjectAt(id & OBJECT_INDEX_MASK);
+
+		if (obj->type == OT__MONSTER)
+		{
+			Monster_QueueSight(obj);
+		}
+	}
+
+	Sight_ResolveQueue();
+
+	for (int i = 0; i < s_map.num_sorted_objects; i++)
+	{
+		ObjectID id = *Map_SortedListEntry(i);
+		if (id < 0)
+		{
+			continue;
+		}
 
-		obj->sprite.skip_draw = false;
+		Object* obj = Map_ObjectAt(id & OBJECT_INDEX_MASK);
 
 		if (obj->type == OT__NONE)
 		{
@@ -1291,7 +2767,18 @@ void Map_UpdateObjects(float delta)
 		}
 		case OT__DOOR:
 		{
+			bool was_closed = Object_IsSpecialCollidableTile(obj);
+
 			Move_Door(obj, delta);
+
+			//lines through the door change
+			if (Object_IsSpecialCollidableTile(obj) != was_closed)
+			{
+				s_map.num_open_doors += (was_closed) ? 1 : -1;
+
+				Sight_Invalidate();
+				Flow_Invalidate();
+			}
 			break;
 		}
 		case OT__PARTICLE:
@@ -1315,73 +2802,69 @@ void Map_UpdateObjects(float delta)
 			break;
 		}
 
-		if (!obj->sprite.img)
-		{
-			continue;
-		}
+		//the object is still in cache, so store its sprite position for the view pass now
+		Map_UpdateSpritePosition(obj, id & OBJECT_INDEX_MASK);
+	}
 
-		bool sprite_position_changed = false;
+	//show this update's temp lights
+	Map_SwapTempLights();
 
-		float next_sprite_x = obj->x + obj->sprite.offset_x;
-		float next_sprite_y = obj->y + obj->sprite.offset_y;
+	Map_TransformObjectViews(view_x, view_y, dir_x, dir_y, plane_x, plane_y);
+}
 
-		if (obj->sprite.x != next_sprite_x || next_sprite_y)
+void Map_UpdateObjectViews(float view_x, float view_y, float dir_x, float dir_y, float plane_x, float plane_y)
+{
+	for (int i = 0; i < s_map.num_sorted_objects; i++)
+	{
+		ObjectID id = *Map_SortedListEntry(i);
+		if (id < 0)
 		{
-			sprite_position_changed = true;
+			continue;
 		}
 
-		obj->sprite.x = next_sprite_x;
-		obj->sprite.y = next_sprite_y;
-
-
-		//translate sprite position to relative to camera
-		float local_sprite_x = obj->sprite.x - view_x;
-		float local_sprite_y = obj->sprite.y - view_y;
-
-		float transform_x = inv_det * (dir_y * local_sprite_x - dir_x * local_sprite_y);
-		float transform_y = inv_det * (-plane_y * local_sprite_x + plane_x * local_sprite_y);
+		Object* obj = Map_ObjectAt(id & OBJECT_INDEX_MASK);
 
-		obj->view_x = transform_x;
-		obj->view_y = transform_y;
-
-		//if the sprite is in view and its position changed, request sprite redraw
-		if (transform_y > 0) 
-		{
-			if(sprite_position_changed)
-				Render_RedrawSprites();
-		}
-		else
+		if (obj->type == OT__NONE)
 		{
-			obj->sprite.skip_draw = true;
+			continue;
 		}
-		
+
+		Map_UpdateSpritePosition(obj, id & OBJECT_INDEX_MASK);
 	}
+
+	Map_TransformObjectViews(view_x, view_y, dir_x, dir_y, plane_x, plane_y);
 }
 
 void Map_DeleteObject(Object* obj)
 {
 	Render_LockObjectMutex();
 
-	ObjectID id = obj->id;
+	int index = obj->id & OBJECT_INDEX_MASK;
 
-	assert(id < MAX_OBJECTS);
+	assert(index < s_map.num_objects && Map_ObjectAt(index) == obj);
 
 	//remove from object tilemap
 	assert(obj->tile_index < s_map.width * s_map.height);
 
-	if (obj->tile_index >= 0)
-	{
-		s_map.object_tiles[obj->tile_index] = NULL_INDEX;
-	}
+	Map_UnlinkTileObject(obj);
+	Map_RemoveFromSortedList(index);
 
 	//reset the object
 	memset(obj, 0, sizeof(Object));
 
-	//store the id in free list
-	Map_FreeListStoreID(id);
+	//a tile walk that holds on to the object ends here
+	obj->tile_index = NULL_INDEX;
+	obj->tile_prev = NULL_INDEX;
+	obj->tile_next = NULL_INDEX;
+
+	//ids of the deleted object no longer resolve
+	ObjectChunk* chunk = s_map.object_chunks[index >> OBJECT_CHUNK_SHIFT];
+	int slot = index & (OBJECT_CHUNK_SIZE - 1);
 
-	//update sorted list
-	Map_UpdateSortedList();
+	chunk->generations[slot] = (chunk->generations[slot] + 1) & OBJECT_GENERATION_MASK;
+
+	//store the index in free list
+	Map_FreeListStoreID(index);
 
 	Render_UnlockObjectMutex();
 }
@@ -1391,11 +2874,13 @@ void Map_Destruct()
 	//keep old level index
 	int old_level_index = s_map.level_index;
 
-	if (s_map.tiles) free(s_map.tiles);
-	if (s_map.floor_tiles) free(s_map.floor_tiles);
-	if (s_map.ceil_tiles) free(s_map.ceil_tiles);
-	if (s_map.object_tiles) free(s_map.object_tiles);
-	if (s_map.light_tiles) free(s_map.light_tiles);
+	Map_FreeLevel(&s_map);
+	Map_FreeTempLights();
+
+	for (int i = 0; i < s_map.num_object_chunks; i++)
+	{
+		free(s_map.object_chunks[i]);
+	}
 
 	memset(&s_map, 0, sizeof(s_map));
 
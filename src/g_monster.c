@@ -372,6 +372,19 @@ static void Monster_UpdateSpriteAnimation(Object* obj, float delta)
 	}
 }
 
+static DirEnum Monster_GetDirEnum(int step_x, int step_y)
+{
+	for (int i = DIR_NONE + 1; i < DIR_MAX; i++)
+	{
+		if (x_diags[i] == step_x && y_diags[i] == step_y)
+		{
+			return i;
+		}
+	}
+
+	return DIR_NONE;
+}
+
 static bool Monster_TryStep(Object* obj, float delta)
 {	
 	float dir_x = x_diags[obj->dir_enum];
@@ -458,6 +471,31 @@ static bool Monster_CheckIfMissilesPossible(Object* obj)
 	return true;
 }
 
+//steps along the flow field when chasing the player, it leads around the walls the direct route gets stuck on
+static bool Monster_FollowFlow(Object* obj, float delta)
+{
+	int step_x = 0;
+	int step_y = 0;
+
+	if (obj->target != Player_GetObj() || !Flow_GetStep(obj, &step_x, &step_y))
+	{
+		return false;
+	}
+
+	DirEnum old_dir = obj->dir_enum;
+
+	obj->dir_enum = Monster_GetDirEnum(step_x, step_y);
+
+	if (obj->dir_enum != DIR_NONE && Monster_TryStep(obj, delta))
+	{
+		return true;
+	}
+
+	obj->dir_enum = old_dir;
+
+	return false;
+}
+
 static void Monster_NewChaseDir(Object* obj, float delta)
 {
 	Object* target = obj->target;
@@ -640,8 +678,8 @@ static void Monster_LookForTarget(Object* monster)
 		return;
 	}
 
-	//make sure player is alive and visible
-	if (player->hp <= 0 || !Object_CheckLineToTarget(monster, player))
+	//make sure player is alive and visible, the pvs rejects most of the map without tracing
+	if (player->hp <= 0 || !Map_CheckPVS(monster->x, monster->y, player->x, player->y) || !Object_CheckLineToTarget(monster, player))
 	{
 		return;
 	}
@@ -657,7 +695,7 @@ static void Monster_LookForTarget(Object* monster)
 void Monster_Spawn(Object* obj)
 {
 	GameAssets* assets = Game_GetAssets();
-	MonsterInfo* monster_info = Info_GetMonsterInfo(obj->sub_type);
+	const MonsterInfo* monster_info = Info_GetMonsterInfo(obj->sub_type);
 
 	if (!monster_info)
 	{
@@ -734,6 +772,34 @@ void Monster_SetState(Object* obj, int state)
 
 }
 
+//queues the line the monster will check this update
+void Monster_QueueSight(Object* obj)
+{
+	if (obj->hp <= 0)
+	{
+		return;
+	}
+
+	Object* target = obj->target;
+
+	//looking for the player
+	if (!target)
+	{
+		target = Player_GetObj();
+
+		//the line is not traced when the player can't be seen from here
+		if (target && !Map_CheckPVS(obj->x, obj->y, target->x, target->y))
+		{
+			return;
+		}
+	}
+
+	if (target && target->hp > 0)
+	{
+		Sight_QueueLine(obj, target);
+	}
+}
+
 void Monster_Update(Object* obj, float delta)
 {
 	Monster_UpdateSpriteAnimation(obj, delta);
@@ -796,6 +862,13 @@ void Monster_Update(Object* obj, float delta)
 	//get a new chase dir or move forward in the direction
 	if (obj->move_timer <= 0  || !Monster_Walk(obj, delta))
 	{
+		//look at the flow field again after every tile
+		if (Monster_FollowFlow(obj, delta))
+		{
+			obj->move_timer = 1.0 / obj->speed;
+			return;
+		}
+
 		Monster_NewChaseDir(obj, delta);
 		obj->move_timer = Math_randf();
 		return;
@@ -859,7 +932,7 @@ void Monster_Melee(Object* obj)
 	{
 		return;
 	}
-	MonsterInfo* info = Info_GetMonsterInfo(obj->type);
+	const MonsterInfo* info = Info_GetMonsterInfo(obj->type);
 
 	if (info->melee_damage <= 0)
 	{
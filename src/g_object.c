@@ -285,12 +285,12 @@ bool Object_HandleObjectCollision(Object* obj, Object* collision_obj)
 	//we can't move
 	return false;
 }
-bool Object_CheckLineToTile(Object* obj, float target_x, float target_y)
+bool Trace_CheckLine(float p_x, float p_y, float target_x, float target_y)
 {
 	const int max_tiles = Map_GetTotalTiles();
 
-	float x_point = obj->x - target_x;
-	float y_point = obj->y - target_y;
+	float x_point = p_x - target_x;
+	float y_point = p_y - target_y;
 
 	float ray_dir_x = x_point;
 	float ray_dir_y = y_point;
@@ -299,8 +299,8 @@ bool Object_CheckLineToTile(Object* obj, float target_x, float target_y)
 	float delta_dist_x = (ray_dir_x == 0) ? 1e30 : fabs(1.0 / ray_dir_x);
 	float delta_dist_y = (ray_dir_y == 0) ? 1e30 : fabs(1.0 / ray_dir_y);
 
-	int map_x = (int)obj->x;
-	int map_y = (int)obj->y;
+	int map_x = (int)p_x;
+	int map_y = (int)p_y;
 
 	int target_tile_x = (int)target_x;
 	int target_tile_y = (int)target_y;
@@ -321,22 +321,22 @@ bool Object_CheckLineToTile(Object* obj, float target_x, float target_y)
 	if (x_point > 0)
 	{
 		step_x = -1;
-		side_dist_x = (obj->x - map_x) * delta_dist_x;
+		side_dist_x = (p_x - map_x) * delta_dist_x;
 	}
 	else
 	{
 		step_x = 1;
-		side_dist_x = (map_x + 1.0 - obj->x) * delta_dist_x;
+		side_dist_x = (map_x + 1.0 - p_x) * delta_dist_x;
 	}
 	if (y_point > 0)
 	{
 		step_y = -1;
-		side_dist_y = (obj->y - map_y) * delta_dist_y;
+		side_dist_y = (p_y - map_y) * delta_dist_y;
 	}
 	else
 	{
 		step_y = 1;
-		side_dist_y = (map_y + 1.0 - obj->y) * delta_dist_y;
+		side_dist_y = (map_y + 1.0 - p_y) * delta_dist_y;
 	}
 
 	//perform DDA
@@ -402,6 +402,11 @@ bool Object_CheckLineToTile(Object* obj, float target_x, float target_y)
 	return true;
 }
 
+bool Object_CheckLineToTile(Object* obj, float target_x, float target_y)
+{
+	return Trace_CheckLine(obj->x, obj->y, target_x, target_y);
+}
+
 bool Object_CheckLineToTile2(Object* obj, float target_x, float target_y)
 {
 	const int max_tiles = Map_GetTotalTiles();
@@ -519,7 +524,8 @@ bool Object_CheckLineToTile2(Object* obj, float target_x, float target_y)
 
 bool Object_CheckLineToTarget(Object* obj, Object* target)
 {
-	return Object_CheckLineToTile(obj, target->x, target->y);
+	//the answer for the two tiles is usually cached
+	return Sight_CheckLine(obj->x, obj->y, target->x, target->y);
 }
 
 bool Object_CheckSight(Object* obj, Object* target)
@@ -752,8 +758,8 @@ Object* Object_Spawn(ObjectType type, SubType sub_type, float x, float y)
 	case OT__PICKUP:
 	case OT__THING:
 	{
-		ObjectInfo* object_info = Info_GetObjectInfo(obj->type, obj->sub_type);
-		AnimInfo* anim_info = &object_info->anim_info;
+		const ObjectInfo* object_info = Info_GetObjectInfo(obj->type, obj->sub_type);
+		const AnimInfo* anim_info = &object_info->anim_info;
 
 		obj->sprite.img = &assets->object_textures;
 
@@ -797,8 +803,8 @@ Object* Object_Spawn(ObjectType type, SubType sub_type, float x, float y)
 	}
 	case OT__PARTICLE:
 	{
-		ParticleInfo* particle_info = Info_GetParticleInfo(sub_type);
-		AnimInfo* anim_info = &particle_info->anim_info;
+		const ParticleInfo* particle_info = Info_GetParticleInfo(sub_type);
+		const AnimInfo* anim_info = &particle_info->anim_info;
 
 		obj->sprite.img = &assets->particle_textures;
 		obj->move_timer = particle_info->time;
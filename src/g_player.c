@@ -14,6 +14,7 @@
 #define PLAYER_MAX_AMMO 100
 #define PLAYER_OVERHEAL_HP_TICK_TIME 0.25
 #define PLAYER_SPEED 10
+#define PLAYER_HITSCAN_RANGE 10 //bullets do no damage further away
 #define MOUSE_SENS_DIVISOR 1000
 #define MIN_SENS 0.5
 #define MAX_SENS 16
@@ -48,7 +49,7 @@ typedef struct
 	int stored_hp;
 
 	GunType gun;
-	GunInfo* gun_info;
+	const GunInfo* gun_info;
 
 	bool gun_check[GUN__MAX];
 	Sprite gun_sprites[GUN__MAX];
@@ -122,65 +123,25 @@ static void Player_TraceBullet(float p_x, float p_y, float p_dirX, float p_dirY)
 	float map_hit_x = 0;
 	float map_hit_y = 0;
 
-	int render_w;
-	Render_GetRenderSize(&render_w, NULL);
+	float dir_x = player.obj->dir_x;
+	float dir_y = player.obj->dir_y;
 
-	int half_w = render_w / 2;
-	int center_x = (half_w) - 1;
-	int shoot_delta = render_w / 8;
+	//monsters within an eighth of the screen width from the crosshair are hit, whatever the spread of the bullet
+	float spread = 0.25f * sqrtf(player.plane_x * player.plane_x + player.plane_y * player.plane_y) / sqrtf(dir_x * dir_x + dir_y * dir_y);
 
-	Map* map = Map_GetMap();
+	Object* closest = Trace_Hitscan(player.obj, dir_x, dir_y, spread, PLAYER_HITSCAN_RANGE, NULL);
 
-	Object* closest = NULL;
-	Object* prev_closest = NULL;
-
-	float max_dist = FLT_MAX;
-
-	while (true)
+	if (!closest)
 	{
-		prev_closest = closest;
-
-		for (int i = 0; i < map->num_sorted_objects; i++)
+		if (Map_Raycast(p_x, p_y, p_dirX, p_dirY, &map_hit_x, &map_hit_y) != EMPTY_TILE)
 		{
-			ObjectID id = map->sorted_list[i];
-			Object* object = &map->objects[id];
-
-			//behind the plane
-			if (object->view_y <= 0)
-			{
-				continue;
-			}
-
-			int screen_x = (int)((half_w) * (1 + object->view_x / object->view_y));
-
-			if (object->type == OT__MONSTER && object->hp > 0 && abs(screen_x - center_x) < shoot_delta)
-			{
-				float dist = (p_x - object->x) * (p_x - object->x) + (p_y - object->y) * (p_y - object->y);
-
-				if (dist < max_dist)
-				{
-					max_dist = dist;
-					closest = object;
-				}
-			}
-		}
-
-		if (closest == prev_closest)
-		{
-			if (Map_Raycast(p_x, p_y, p_dirX, p_dirY, &map_hit_x, &map_hit_y) != EMPTY_TILE)
-			{
-				Object_Spawn(OT__PARTICLE, SUB__PARTICLE_WALL_HIT, (map_hit_x), (map_hit_y));
-				return;
-			}
-			return;
-		}
-
-		if (Object_CheckLineToTarget(player.obj, closest))
-		{
-			break;
+			Object_Spawn(OT__PARTICLE, SUB__PARTICLE_WALL_HIT, (map_hit_x), (map_hit_y));
 		}
+		return;
 	}
 
+	float max_dist = (p_x - closest->x) * (p_x - closest->x) + (p_y - closest->y) * (p_y - closest->y);
+
 	Object* ray_obj = closest;
 
 	if (ray_obj && ray_obj->type == OT__MONSTER)
@@ -236,7 +197,7 @@ static void Player_SetGun(GunType gun_type)
 	Sprite_ResetAnimState(&player.gun_sprites[player.gun]);
 	Sprite_ResetAnimState(&player.gun_sprites[gun_type]);
 
-	GunInfo* gun_info = Info_GetGunInfo(gun_type);
+	const GunInfo* gun_info = Info_GetGunInfo(gun_type);
 
 	player.gun = gun_type;
 	player.gun_info = gun_info;
@@ -531,7 +492,7 @@ static void Player_SetupGunSprites()
 	for (int i = 1; i < GUN__MAX; i++)
 	{
 		Sprite* sprite = &player.gun_sprites[i];
-		GunInfo* gun_info = Info_GetGunInfo(i);
+		const GunInfo* gun_info = Info_GetGunInfo(i);
 
 		if (!gun_info)
 		{
@@ -900,7 +861,7 @@ void Player_Draw(Image* image, FontData* font)
 	//draw gun
 	if (player.obj->hp > 0 && light_tile)
 	{
-		int l = (int)light_tile->light + (int)light_tile->temp_light;
+		int l = (int)light_tile->light + Map_GetTempLight(player.obj->x, player.obj->y);
 
 		if (l > 255) l = 255;
 
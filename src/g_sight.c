@@ -0,0 +1,199 @@
+#include "g_common.h"
+
+#include <string.h>
+
+/*
+	Line of sight cache. Whether a line is blocked only depends on the walls, the doors and the static objects
+	of the tiles it passes, so the answer for a pair of tiles is kept until a door opens or closes,
+	a static object is added or removed, or another map is loaded. The first line traced between two tiles
+	answers for every position in them.
+	Before the objects update, every monster queues the line to its target. The lines that are not cached
+	are traced together, on the render threads when there are many of them, so the checks during the update hit the cache.
+*/
+
+#define SIGHT_CACHE_BITS 14
+#define SIGHT_CACHE_SIZE (1 << SIGHT_CACHE_BITS)
+#define SIGHT_MAX_QUEUED 4096
+#define SIGHT_PARALLEL_MIN 256 //fewer lines are traced on the game thread, waking the render threads costs more
+#define SIGHT_PARALLEL_BATCH 32
+
+typedef struct
+{
+	uint64_t key;
+	uint32_t epoch; //0 is empty
+	bool visible;
+} SightEntry;
+
+typedef struct
+{
+	float x, y;
+	float target_x, target_y;
+	uint64_t key;
+	bool visible;
+} SightLine;
+
+typedef struct
+{
+	SightEntry entries[SIGHT_CACHE_SIZE];
+
+	SightLine queue[SIGHT_MAX_QUEUED];
+	int num_queued;
+
+	uint32_t epoch;
+	bool disabled;
+} SightCache;
+
+static SightCache s_sight = { .epoch = 1 };
+
+static bool Sight_GetKey(float x, float y, float target_x, float target_y, uint64_t* r_key)
+{
+	int map_w, map_h;
+	Map_GetSize(&map_w, &map_h);
+
+	if (x < 0 || y < 0 || target_x < 0 || target_y < 0 || x >= map_w || y >= map_h || target_x >= map_w || target_y >= map_h)
+	{
+		return false;
+	}
+
+	uint32_t from = (int)x + (int)y * map_w;
+	uint32_t to = (int)target_x + (int)target_y * map_w;
+
+	*r_key = ((uint64_t)from << 32) | to;
+
+	return true;
+}
+
+static inline SightEntry* Sight_GetEntry(uint64_t key)
+{
+	return &s_sight.entries[(key * 0x9E3779B97F4A7C15ull) >> (64 - SIGHT_CACHE_BITS)];
+}
+
+static bool Sight_Lookup(uint64_t key, bool* r_visible)
+{
+	SightEntry* entry = Sight_GetEntry(key);
+
+	if (entry->epoch != s_sight.epoch || entry->key != key)
+	{
+		return false;
+	}
+
+	*r_visible = entry->visible;
+
+	return true;
+}
+
+static void Sight_Store(uint64_t key, bool visible)
+{
+	SightEntry* entry = Sight_GetEntry(key);
+
+	entry->key = key;
+	entry->epoch = s_sight.epoch;
+	entry->visible = visible;
+}
+
+static void Sight_TraceLines(int start, int end, void* data)
+{
+	SightLine* lines = data;
+
+	for (int i = start; i < end; i++)
+	{
+		SightLine* line = &lines[i];
+
+		line->visible = Trace_CheckLine(line->x, line->y, line->target_x, line->target_y);
+	}
+}
+
+bool Sight_CheckLine(float x, float y, float target_x, float target_y)
+{
+	uint64_t key = 0;
+
+	if (s_sight.disabled || !Sight_GetKey(x, y, target_x, target_y, &key))
+	{
+		return Trace_CheckLine(x, y, target_x, target_y);
+	}
+
+	bool visible = false;
+
+	if (Sight_Lookup(key, &visible))
+	{
+		return visible;
+	}
+
+	visible = Trace_CheckLine(x, y, target_x, target_y);
+
+	Sight_Store(key, visible);
+
+	return visible;
+}
+
+void Sight_QueueLine(Object* obj, Object* target)
+{
+	if (s_sight.disabled || s_sight.num_queued >= SIGHT_MAX_QUEUED)
+	{
+		return;
+	}
+
+	uint64_t key = 0;
+	bool visible = false;
+
+	if (!Sight_GetKey(obj->x, obj->y, target->x, target->y, &key) || Sight_Lookup(key, &visible))
+	{
+		return;
+	}
+
+	SightLine* line = &s_sight.queue[s_sight.num_queued++];
+
+	line->x = obj->x;
+	line->y = obj->y;
+	line->target_x = target->x;
+	line->target_y = target->y;
+	line->key = key;
+}
+
+void Sight_ResolveQueue()
+{
+	int num_lines = s_sight.num_queued;
+
+	if (num_lines <= 0)
+	{
+		return;
+	}
+
+	if (num_lines >= SIGHT_PARALLEL_MIN)
+	{
+		Render_ParallelFor(num_lines, SIGHT_PARALLEL_BATCH, Sight_TraceLines, s_sight.queue);
+	}
+	else
+	{
+		Sight_TraceLines(0, num_lines, s_sight.queue);
+	}
+
+	//stored here, the cache is only touched by the game thread
+	for (int i = 0; i < num_lines; i++)
+	{
+		Sight_Store(s_sight.queue[i].key, s_sight.queue[i].visible);
+	}
+
+	s_sight.num_queued = 0;
+}
+
+void Sight_Invalidate()
+{
+	s_sight.epoch++;
+
+	//wrapped around, old entries could match again
+	if (s_sight.epoch == 0)
+	{
+		memset(s_sight.entries, 0, sizeof(s_sight.entries));
+		s_sight.epoch = 1;
+	}
+
+	s_sight.num_queued = 0;
+}
+
+void Sight_SetCache(bool enable)
+{
+	s_sight.disabled = !enable;
+
+	Sight_Invalidate();
+}
@@ -1,6 +1,6 @@
 #include "game_info.h"
 
-GunInfo* Info_GetGunInfo(int type)
+const GunInfo* Info_GetGunInfo(int type)
 {
 	int index = type;
 
@@ -12,7 +12,7 @@ GunInfo* Info_GetGunInfo(int type)
 	return &GUN_INFOs[index];
 }
 
-MonsterInfo* Info_GetMonsterInfo(int type)
+const MonsterInfo* Info_GetMonsterInfo(int type)
 {
 	if (type < 0)
 	{
@@ -34,7 +34,7 @@ MonsterInfo* Info_GetMonsterInfo(int type)
 	return &MONSTER_INFO[index];
 }
 
-ObjectInfo* Info_GetObjectInfo(int type, int sub_type)
+const ObjectInfo* Info_GetObjectInfo(int type, int sub_type)
 {
 	if (type < 0 || sub_type < 0)
 	{
@@ -46,7 +46,7 @@ ObjectInfo* Info_GetObjectInfo(int type, int sub_type)
 	
 	for (int i = 0; i < arr_size; i++)
 	{
-		ObjectInfo* info = &OBJECT_INFOS[i];
+		const ObjectInfo* info = &OBJECT_INFOS[i];
 
 		if (info->type == sub_type)
 		{
@@ -58,7 +58,7 @@ ObjectInfo* Info_GetObjectInfo(int type, int sub_type)
 	return &OBJECT_INFOS[0];
 }
 
-LightInfo* Info_GetLightInfo(int sub_type)
+const LightInfo* Info_GetLightInfo(int sub_type)
 {
 	if (sub_type < 0)
 	{
@@ -80,7 +80,7 @@ LightInfo* Info_GetLightInfo(int sub_type)
 	return &LIGHT_INFOS[index];
 }
 
-ParticleInfo* Info_GetParticleInfo(int sub_type)
+const ParticleInfo* Info_GetParticleInfo(int sub_type)
 {
 	int arr_size = sizeof(PARTICLE_INFOS) / sizeof(PARTICLE_INFOS[0]);
 	int index = sub_type - SUB__PARTICLE_BLOOD;
@@ -97,7 +97,7 @@ ParticleInfo* Info_GetParticleInfo(int sub_type)
 	return &PARTICLE_INFOS[index];
 }
 
-MissileInfo* Info_GetMissileInfo(int sub_type)
+const MissileInfo* Info_GetMissileInfo(int sub_type)
 {
 	int arr_size = sizeof(MISSILE_INFO) / sizeof(MISSILE_INFO[0]);
 	int index = sub_type - SUB__MISSILE_FIREBALL;
@@ -808,12 +808,12 @@ static const ParticleInfo PARTICLE_INFOS[] =
 #define PICKUP_INVUNERABILITY_TIME 15
 #define PICKUP_QUAD_TIME 15
 
-GunInfo* Info_GetGunInfo(int type);
-MonsterInfo* Info_GetMonsterInfo(int type);
-ObjectInfo* Info_GetObjectInfo(int type, int sub_type);
-LightInfo* Info_GetLightInfo(int sub_type);
-ParticleInfo* Info_GetParticleInfo(int sub_type);
-MissileInfo* Info_GetMissileInfo(int sub_type);
+const GunInfo* Info_GetGunInfo(int type);
+const MonsterInfo* Info_GetMonsterInfo(int type);
+const ObjectInfo* Info_GetObjectInfo(int type, int sub_type);
+const LightInfo* Info_GetLightInfo(int sub_type);
+const ParticleInfo* Info_GetParticleInfo(int sub_type);
+const MissileInfo* Info_GetMissileInfo(int sub_type);
 
 static const char* LEVELS[] =
 {
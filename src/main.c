@@ -12,6 +12,7 @@
 #include "utility.h"
 #include "main.h"
 #include "sound.h"
+#include "bench.h"
 
 #define WINDOW_SCALE 3
 #define WINDOW_WIDTH 640
@@ -54,6 +55,10 @@ static bool Engine_SaveCfg(const char* filename)
 	fprintf(file, "render_scale %i \n", Render_GetRenderScale());
 	fprintf(file, "mouse_sens %.1f \n", Player_GetSensitivity());
 	fprintf(file, "volume %.1f \n", Sound_GetMasterVolume());
+	fprintf(file, "render_threads %i \n", Render_GetThreadCount());
+	fprintf(file, "render_stats %i \n", (int)Render_GetShowStats());
+	fprintf(file, "render_palette %i \n", (int)Render_GetPaletteMode());
+	fprintf(file, "render_mipmaps %i \n", (int)Video_GetMipmaps());
 
 	return fclose(file) == 0;
 }
@@ -91,6 +96,22 @@ static bool Engine_LoadCfg(const char* filename)
 		{
 			Sound_setMasterVolume(value);
 		}
+		else if (!strcmp(buf, "render_threads"))
+		{
+			Render_SetThreadCount((int)value);
+		}
+		else if (!strcmp(buf, "render_stats"))
+		{
+			Render_SetShowStats(value != 0);
+		}
+		else if (!strcmp(buf, "render_palette"))
+		{
+			Render_SetPaletteMode(value != 0);
+		}
+		else if (!strcmp(buf, "render_mipmaps"))
+		{
+			Video_SetMipmaps(value != 0);
+		}
 	}
 
 	return fclose(file) == 0;
@@ -223,10 +244,99 @@ GLFWwindow* Engine_GetWindow()
 	return s_engine.window;
 }
 
-int main()
+static bool Engine_ParseBenchArgs(int argc, char** argv, BenchConfig* config)
+{
+	bool bench = false;
+
+	Bench_DefaultConfig(config);
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		//-bench on its own renders the camera path, the other bench flags pick what it runs instead
+		if (arg[0] == '-' && Bench_IsMode(arg + 1))
+		{
+			bench = true;
+
+			if (strcmp(arg, "-bench"))
+			{
+				config->mode = arg + 1;
+			}
+			continue;
+		}
+		if (!strcmp(arg, "-palette"))
+		{
+			config->palette = true;
+			continue;
+		}
+		if (!strcmp(arg, "-nomips"))
+		{
+			config->no_mipmaps = true;
+			continue;
+		}
+		if (!strcmp(arg, "-nospritecull"))
+		{
+			config->no_sprite_culling = true;
+			continue;
+		}
+
+		if (!value)
+		{
+			break;
+		}
+
+		if (!strcmp(arg, "-map")) config->map_path = value;
+		else if (!strcmp(arg, "-path")) config->path_file = value;
+		else if (!strcmp(arg, "-dump")) config->dump_dir = value;
+		else if (!strcmp(arg, "-csv")) config->csv_path = value;
+		else if (!strcmp(arg, "-scale")) config->scale = atoi(value);
+		else if (!strcmp(arg, "-threads")) config->threads = atoi(value);
+		else if (!strcmp(arg, "-frames")) config->frames = atoi(value);
+		else if (!strcmp(arg, "-warmup")) config->warmup = atoi(value);
+		else if (!strcmp(arg, "-kernel")) config->column_kernel = value;
+		else continue;
+
+		i++;
+	}
+
+	return bench;
+}
+
+int main(int argc, char** argv)
 {
 	memset(&s_engine, 0, sizeof(EngineData));
 
+	//compile json maps into .rmap files next to them, every level when no files are given
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-compilemaps"))
+		{
+			if (i + 1 >= argc)
+			{
+				return (Map_CompileLevels()) ? 0 : -1;
+			}
+
+			bool result = true;
+
+			for (int k = i + 1; k < argc; k++)
+			{
+				result = Map_CompileFile(argv[k]) && result;
+			}
+
+			return (result) ? 0 : -1;
+		}
+	}
+
+	//headless benchmark, no window or sound
+	BenchConfig bench_config;
+
+	if (Engine_ParseBenchArgs(argc, argv, &bench_config))
+	{
+		return Bench_RunMode(&bench_config);
+	}
+
 	srand(time(NULL));
 
 	if (!Engine_SetupSubSystems())
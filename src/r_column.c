@@ -0,0 +1,599 @@
+#include "r_common.h"
+
+#include <string.h>
+
+/*
+	Vertical column kernels. A column is a run of pixels stepping down the screen while
+	stepping a 16.16 texture coordinate down a texture column. Every pixel is depth tested,
+	the column stops at the first pixel that is already drawn.
+
+	All kernels give the same result, the simd ones just do 4 or 8 pixels at a time.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLUMN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define COLUMN_TARGET_AVX2
+#else
+#define COLUMN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define COLUMN_NEON
+#include <arm_neon.h>
+#endif
+
+static ColumnKernel s_columnKernel = COLUMN_KERNEL__SCALAR;
+
+static const char* COLUMN_KERNEL_NAMES[COLUMN_KERNEL__MAX] =
+{
+	"scalar",
+	"sse2",
+	"avx2",
+	"neon"
+};
+
+static inline int Column_CountTrailingZeros(unsigned mask)
+{
+	int count = 0;
+
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		count++;
+	}
+
+	return count;
+}
+
+static inline const unsigned char* Column_GetTexel(const ColumnDraw* col, uint32_t v)
+{
+	return col->tex + ((v >> 16) & col->tex_mask) * col->tex_stride;
+}
+
+static int Column_DrawScalar(const ColumnDraw* col)
+{
+	uint32_t v = col->v;
+
+	unsigned char* dst = col->dst;
+	float* depth = col->depth;
+
+	for (int i = 0; i < col->count; i++)
+	{
+		//depth is set by other tile
+		if (*depth < DEPTH_CLEAR)
+		{
+			return i;
+		}
+
+		const unsigned char* texel = Column_GetTexel(col, v);
+
+		dst[0] = Video_Light(texel[0], col->light);
+		dst[1] = Video_Light(texel[1], col->light);
+		dst[2] = Video_Light(texel[2], col->light);
+		dst[3] = 255;
+
+		*depth = col->wall_dist;
+
+		v += col->v_step;
+		dst += col->stride * 4;
+		depth += col->stride;
+	}
+
+	return col->count;
+}
+
+#ifdef COLUMN_X86
+
+//x / 255 for 16 bit lanes holding products of two bytes
+static inline __m128i Column_Div255_SSE2(__m128i x)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i Column_Light_SSE2(__m128i texels, __m128i light)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), light);
+	__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), light);
+
+	__m128i result = _mm_packus_epi16(Column_Div255_SSE2(lo), Column_Div255_SSE2(hi));
+
+	return _mm_or_si128(result, _mm_set1_epi32(0xFF000000));
+}
+
+static int Column_DrawSSE2(const ColumnDraw* col)
+{
+	const __m128 clear = _mm_set1_ps(DEPTH_CLEAR);
+	const __m128 wall_dist = _mm_set1_ps(col->wall_dist);
+	const __m128i light = _mm_set1_epi16(col->light);
+
+	const int stride = col->stride;
+
+	uint32_t v = col->v;
+
+	unsigned char* dst = col->dst;
+	float* depth = col->depth;
+
+	int i = 0;
+
+	for (; i + 4 <= col->count; i += 4)
+	{
+		__m128 d;
+
+		if (stride == 1)
+		{
+			d = _mm_loadu_ps(depth);
+		}
+		else
+		{
+			d = _mm_setr_ps(depth[0], depth[stride], depth[stride * 2], depth[stride * 3]);
+		}
+
+		int occupied = _mm_movemask_ps(_mm_cmplt_ps(d, clear));
+
+		int32_t t0, t1, t2, t3;
+		memcpy(&t0, Column_GetTexel(col, v), 4);
+		memcpy(&t1, Column_GetTexel(col, v + col->v_step), 4);
+		memcpy(&t2, Column_GetTexel(col, v + col->v_step * 2), 4);
+		memcpy(&t3, Column_GetTexel(col, v + col->v_step * 3), 4);
+
+		__m128i color = Column_Light_SSE2(_mm_setr_epi32(t0, t1, t2, t3), light);
+
+		int num_write = (occupied) ? Column_CountTrailingZeros(occupied) : 4;
+
+		if (stride == 1 && num_write == 4)
+		{
+			_mm_storeu_si128((__m128i*)dst, color);
+			_mm_storeu_ps(depth, wall_dist);
+		}
+		else
+		{
+			int32_t colors[4];
+			_mm_storeu_si128((__m128i*)colors, color);
+
+			for (int k = 0; k < num_write; k++)
+			{
+				memcpy(dst + k * stride * 4, &colors[k], 4);
+				depth[k * stride] = col->wall_dist;
+			}
+		}
+
+		if (occupied)
+		{
+			return i + num_write;
+		}
+
+		v += col->v_step * 4;
+		dst += stride * 16;
+		depth += stride * 4;
+	}
+
+	//finish the rest
+	ColumnDraw rest = *col;
+	rest.dst = dst;
+	rest.depth = depth;
+	rest.v = v;
+	rest.count = col->count - i;
+
+	return i + Column_DrawScalar(&rest);
+}
+
+COLUMN_TARGET_AVX2 static int Column_DrawAVX2(const ColumnDraw* col)
+{
+	//gathering and scattering strided pixels is slower than the sse2 path
+	if (col->stride != 1)
+	{
+		return Column_DrawSSE2(col);
+	}
+
+	const __m256 clear = _mm256_set1_ps(DEPTH_CLEAR);
+	const __m256 wall_dist = _mm256_set1_ps(col->wall_dist);
+	const __m256i light = _mm256_set1_epi16(col->light);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i tex_mask = _mm256_set1_epi32(col->tex_mask);
+	const __m256i tex_stride = _mm256_set1_epi32(col->tex_stride);
+	const __m256i v_offsets = _mm256_mullo_epi32(lane, _mm256_set1_epi32(col->v_step));
+
+	uint32_t v = col->v;
+
+	unsigned char* dst = col->dst;
+	float* depth = col->depth;
+
+	int i = 0;
+
+	for (; i + 8 <= col->count; i += 8)
+	{
+		__m256 d = _mm256_loadu_ps(depth);
+
+		int occupied = _mm256_movemask_ps(_mm256_cmp_ps(d, clear, _CMP_LT_OQ));
+
+		//texel byte offsets
+		__m256i vs = _mm256_add_epi32(_mm256_set1_epi32(v), v_offsets);
+		__m256i offsets = _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(vs, 16), tex_mask), tex_stride);
+
+		__m256i texels = _mm256_i32gather_epi32((const int*)col->tex, offsets, 1);
+
+		__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(texels, zero), light);
+		__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(texels, zero), light);
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, _mm256_set1_epi16(1)), _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, _mm256_set1_epi16(1)), _mm256_srli_epi16(hi, 8)), 8);
+
+		__m256i color = _mm256_or_si256(_mm256_packus_epi16(lo, hi), _mm256_set1_epi32(0xFF000000));
+
+		if (occupied)
+		{
+			int num_write = Column_CountTrailingZeros(occupied);
+
+			int32_t colors[8];
+			_mm256_storeu_si256((__m256i*)colors, color);
+
+			for (int k = 0; k < num_write; k++)
+			{
+				memcpy(dst + k * 4, &colors[k], 4);
+				depth[k] = col->wall_dist;
+			}
+
+			return i + num_write;
+		}
+
+		_mm256_storeu_si256((__m256i*)dst, color);
+		_mm256_storeu_ps(depth, wall_dist);
+
+		v += col->v_step * 8;
+		dst += 32;
+		depth += 8;
+	}
+
+	//finish the rest
+	ColumnDraw rest = *col;
+	rest.dst = dst;
+	rest.depth = depth;
+	rest.v = v;
+	rest.count = col->count - i;
+
+	return i + Column_DrawSSE2(&rest);
+}
+
+static bool Column_HasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+
+	bool os_uses_xsave = (info[2] & (1 << 27)) != 0;
+	bool has_avx = (info[2] & (1 << 28)) != 0;
+
+	if (!os_uses_xsave || !has_avx)
+	{
+		return false;
+	}
+
+	//os saves the ymm registers
+	if ((_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef COLUMN_NEON
+
+static int Column_DrawNEON(const ColumnDraw* col)
+{
+	const float32x4_t clear = vdupq_n_f32(DEPTH_CLEAR);
+	const float32x4_t wall_dist = vdupq_n_f32(col->wall_dist);
+	const uint8x8_t light = vdup_n_u8(col->light);
+	const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+
+	const int stride = col->stride;
+
+	uint32_t v = col->v;
+
+	unsigned char* dst = col->dst;
+	float* depth = col->depth;
+
+	int i = 0;
+
+	for (; i + 4 <= col->count; i += 4)
+	{
+		float32x4_t d;
+
+		if (stride == 1)
+		{
+			d = vld1q_f32(depth);
+		}
+		else
+		{
+			float ds[4] = { depth[0], depth[stride], depth[stride * 2], depth[stride * 3] };
+			d = vld1q_f32(ds);
+		}
+
+		uint32_t occupied_lanes[4];
+		vst1q_u32(occupied_lanes, vcltq_f32(d, clear));
+
+		int num_write = 4;
+
+		for (int k = 0; k < 4; k++)
+		{
+			if (occupied_lanes[k])
+			{
+				num_write = k;
+				break;
+			}
+		}
+
+		uint32_t t[4];
+		memcpy(&t[0], Column_GetTexel(col, v), 4);
+		memcpy(&t[1], Column_GetTexel(col, v + col->v_step), 4);
+		memcpy(&t[2], Column_GetTexel(col, v + col->v_step * 2), 4);
+		memcpy(&t[3], Column_GetTexel(col, v + col->v_step * 3), 4);
+
+		uint8x16_t texels = vreinterpretq_u8_u32(vld1q_u32(t));
+
+		uint16x8_t lo = vmull_u8(vget_low_u8(texels), light);
+		uint16x8_t hi = vmull_u8(vget_high_u8(texels), light);
+
+		//x / 255 as (x + 1 + (x >> 8)) >> 8
+		lo = vaddq_u16(vaddq_u16(lo, vdupq_n_u16(1)), vshrq_n_u16(lo, 8));
+		hi = vaddq_u16(vaddq_u16(hi, vdupq_n_u16(1)), vshrq_n_u16(hi, 8));
+
+		uint8x16_t lit = vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+		uint32x4_t color = vorrq_u32(vreinterpretq_u32_u8(lit), alpha);
+
+		if (stride == 1 && num_write == 4)
+		{
+			vst1q_u32((uint32_t*)dst, color);
+			vst1q_f32(depth, wall_dist);
+		}
+		else
+		{
+			uint32_t colors[4];
+			vst1q_u32(colors, color);
+
+			for (int k = 0; k < num_write; k++)
+			{
+				memcpy(dst + k * stride * 4, &colors[k], 4);
+				depth[k * stride] = col->wall_dist;
+			}
+		}
+
+		if (num_write < 4)
+		{
+			return i + num_write;
+		}
+
+		v += col->v_step * 4;
+		dst += stride * 16;
+		depth += stride * 4;
+	}
+
+	//finish the rest
+	ColumnDraw rest = *col;
+	rest.dst = dst;
+	rest.depth = depth;
+	rest.v = v;
+	rest.count = col->count - i;
+
+	return i + Column_DrawScalar(&rest);
+}
+
+#endif
+
+bool Video_IsColumnKernelSupported(ColumnKernel kernel)
+{
+	switch (kernel)
+	{
+	case COLUMN_KERNEL__SCALAR:
+		return true;
+#ifdef COLUMN_X86
+	case COLUMN_KERNEL__SSE2:
+		return true;
+	case COLUMN_KERNEL__AVX2:
+		return Column_HasAVX2();
+#endif
+#ifdef COLUMN_NEON
+	case COLUMN_KERNEL__NEON:
+		return true;
+#endif
+	default:
+		break;
+	}
+
+	return false;
+}
+
+void Video_SetupColumnKernels()
+{
+	s_columnKernel = COLUMN_KERNEL__SCALAR;
+
+	//pick the widest supported kernel
+	for (int i = COLUMN_KERNEL__MAX - 1; i >= 0; i--)
+	{
+		if (Video_IsColumnKernelSupported(i))
+		{
+			s_columnKernel = i;
+			break;
+		}
+	}
+}
+
+bool Video_SetColumnKernel(ColumnKernel kernel)
+{
+	if (kernel < 0 || kernel >= COLUMN_KERNEL__MAX || !Video_IsColumnKernelSupported(kernel))
+	{
+		return false;
+	}
+
+	s_columnKernel = kernel;
+
+	return true;
+}
+
+ColumnKernel Video_GetColumnKernel()
+{
+	return s_columnKernel;
+}
+
+const char* Video_GetColumnKernelName(ColumnKernel kernel)
+{
+	if (kernel < 0 || kernel >= COLUMN_KERNEL__MAX)
+	{
+		return "unknown";
+	}
+
+	return COLUMN_KERNEL_NAMES[kernel];
+}
+
+int Video_DrawColumnWith(ColumnKernel kernel, const ColumnDraw* col)
+{
+	if (col->count <= 0)
+	{
+		return 0;
+	}
+
+	switch (kernel)
+	{
+#ifdef COLUMN_X86
+	case COLUMN_KERNEL__SSE2:
+		return Column_DrawSSE2(col);
+	case COLUMN_KERNEL__AVX2:
+		return Column_DrawAVX2(col);
+#endif
+#ifdef COLUMN_NEON
+	case COLUMN_KERNEL__NEON:
+		return Column_DrawNEON(col);
+#endif
+	default:
+		break;
+	}
+
+	return Column_DrawScalar(col);
+}
+
+int Video_DrawColumn(const ColumnDraw* col)
+{
+	return Video_DrawColumnWith(s_columnKernel, col);
+}
+
+//8 bit version, tex points at palette indices and light goes through the colormap
+int Video_DrawColumnIndexed(const ColumnDraw* col)
+{
+	uint32_t v = col->v;
+
+	unsigned char* dst = col->dst;
+	float* depth = col->depth;
+
+	const unsigned char* colormap = col->colormap;
+
+	for (int i = 0; i < col->count; i++)
+	{
+		//depth is set by other tile
+		if (*depth < DEPTH_CLEAR)
+		{
+			return i;
+		}
+
+		*dst = colormap[*Column_GetTexel(col, v)];
+		*depth = col->wall_dist;
+
+		v += col->v_step;
+		dst += col->stride;
+		depth += col->stride;
+	}
+
+	return col->count;
+}
+
+/*
+	Copies columns x_start to x_end of a column major image into a row major one.
+	Works on 4x4 pixel blocks, a band of columns is walked 4 rows at a time so the
+	source columns are read sequentially and every row gets a full run of the band.
+*/
+void Video_TransposeColumns(Image* dst, const Image* src, int x_start, int x_end)
+{
+	const int width = dst->width;
+	const int height = dst->height;
+
+	const uint32_t* src_data = (const uint32_t*)src->data;
+	uint32_t* dst_data = (uint32_t*)dst->data;
+
+	int block_end_x = x_start + ((x_end - x_start) & ~3);
+	int block_end_y = height & ~3;
+
+	for (int y = 0; y < block_end_y; y += 4)
+	{
+		int x = x_start;
+
+		for (; x < block_end_x; x += 4)
+		{
+			const uint32_t* s = src_data + y + x * height;
+			uint32_t* d = dst_data + x + y * width;
+
+#if defined(COLUMN_X86)
+			__m128i a = _mm_loadu_si128((const __m128i*)(s));
+			__m128i b = _mm_loadu_si128((const __m128i*)(s + height));
+			__m128i c = _mm_loadu_si128((const __m128i*)(s + height * 2));
+			__m128i e = _mm_loadu_si128((const __m128i*)(s + height * 3));
+
+			__m128i t0 = _mm_unpacklo_epi32(a, b);
+			__m128i t1 = _mm_unpacklo_epi32(c, e);
+			__m128i t2 = _mm_unpackhi_epi32(a, b);
+			__m128i t3 = _mm_unpackhi_epi32(c, e);
+
+			_mm_storeu_si128((__m128i*)(d), _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*)(d + width), _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*)(d + width * 2), _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i*)(d + width * 3), _mm_unpackhi_epi64(t2, t3));
+#elif defined(COLUMN_NEON)
+			uint32x4x2_t t0 = vtrnq_u32(vld1q_u32(s), vld1q_u32(s + height));
+			uint32x4x2_t t1 = vtrnq_u32(vld1q_u32(s + height * 2), vld1q_u32(s + height * 3));
+
+			vst1q_u32(d, vcombine_u32(vget_low_u32(t0.val[0]), vget_low_u32(t1.val[0])));
+			vst1q_u32(d + width, vcombine_u32(vget_low_u32(t0.val[1]), vget_low_u32(t1.val[1])));
+			vst1q_u32(d + width * 2, vcombine_u32(vget_high_u32(t0.val[0]), vget_high_u32(t1.val[0])));
+			vst1q_u32(d + width * 3, vcombine_u32(vget_high_u32(t0.val[1]), vget_high_u32(t1.val[1])));
+#else
+			for (int i = 0; i < 4; i++)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					d[k + i * width] = s[i + k * height];
+				}
+			}
+#endif
+		}
+
+		//leftover columns
+		for (; x < x_end; x++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				dst_data[x + (y + i) * width] = src_data[(y + i) + x * height];
+			}
+		}
+	}
+
+	//leftover rows
+	for (int y = block_end_y; y < height; y++)
+	{
+		for (int x = x_start; x < x_end; x++)
+		{
+			dst_data[x + y * width] = src_data[y + x * height];
+		}
+	}
+}
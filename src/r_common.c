@@ -2,7 +2,9 @@
 
 #include <string.h>
 #include <assert.h>
+#include <stdio.h>
 #include <stb_image/stb_image.h>
+#include "u_math.h"
 
 
 bool Image_Create(Image* img, int p_width, int p_height, int p_numChannels)
@@ -72,13 +74,32 @@ bool Image_CreateFromPath(Image* img, const char* path)
 
 bool Image_SaveToPath(Image* img, const char* filename)
 {
-	if (!img->data)
+	if (!img->data || img->numChannels < 3)
+	{
+		return false;
+	}
+
+	//binary ppm, alpha is dropped
+	FILE* file = fopen(filename, "wb");
+
+	if (!file)
 	{
 		return false;
 	}
 
+	fprintf(file, "P6\n%i %i\n255\n", img->width, img->height);
 
-	return false;
+	for (int y = 0; y < img->height; y++)
+	{
+		for (int x = 0; x < img->width; x++)
+		{
+			unsigned char* color = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
+
+			fwrite(color, 1, 3, file);
+		}
+	}
+
+	return fclose(file) == 0;
 }
 
 void Image_Resize(Image* img, int p_width, int p_height)
@@ -117,6 +138,11 @@ void Image_Destruct(Image* img)
 
 	free(img->data);
 
+	if (img->indices)
+	{
+		free(img->indices);
+	}
+
 	if (img->frame_info)
 	{
 		int total_frames = img->h_frames * img->v_frames;
@@ -173,7 +199,7 @@ void Image_Set(Image* img, int x, int y, unsigned char r, unsigned char g, unsig
 		return;
 	}
 
-	unsigned char* d = img->data + (x + y * img->width) * img->numChannels;
+	unsigned char* d = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 
 	if (img->numChannels >= 1) d[0] = r;
 	if (img->numChannels >= 2) d[1] = g;
@@ -181,6 +207,75 @@ void Image_Set(Image* img, int x, int y, unsigned char r, unsigned char g, unsig
 	if (img->numChannels >= 4) d[3] = a;
 }
 
+static unsigned char* Image_ChangeLayout(Image* img, const unsigned char* src_data, int channels, bool column_major)
+{
+	unsigned char* data = malloc((size_t)img->width * img->height * channels);
+
+	if (!data)
+	{
+		return NULL;
+	}
+
+	for (int y = 0; y < img->height; y++)
+	{
+		for (int x = 0; x < img->width; x++)
+		{
+			int src = Image_PixelIndex(img, x, y);
+			int dst = (column_major) ? y + x * img->height : x + y * img->width;
+
+			memcpy(data + dst * channels, src_data + src * channels, channels);
+		}
+	}
+
+	return data;
+}
+
+void Image_SetColumnMajor(Image* img, bool column_major)
+{
+	//mipmaps follow the base image
+	for (int i = 0; i < img->num_mipmaps; i++)
+	{
+		Image* mip_map = img->mipmaps[i];
+
+		if (mip_map)
+		{
+			Image_SetColumnMajor(mip_map, column_major);
+		}
+	}
+
+	if (!img->data || img->column_major == column_major)
+	{
+		return;
+	}
+
+	unsigned char* data = Image_ChangeLayout(img, img->data, img->numChannels, column_major);
+	unsigned char* indices = NULL;
+
+	if (!data)
+	{
+		return;
+	}
+
+	if (img->indices)
+	{
+		indices = Image_ChangeLayout(img, img->indices, 1, column_major);
+
+		if (!indices)
+		{
+			free(data);
+			return;
+		}
+
+		free(img->indices);
+		img->indices = indices;
+	}
+
+	free(img->data);
+
+	img->data = data;
+	img->column_major = column_major;
+}
+
 void Image_Blur(Image* img, int size, float scale)
 {
 	if (!img->data || size <= 0 || scale <= 0)
@@ -262,35 +357,28 @@ void Image_Blur(Image* img, int size, float scale)
 
 }
 
+/*
+	Every level is a 2x2 box filter of the level above it. Levels stop once a frame of the sheet can't be halved
+	anymore, so frames and wall tiles stay aligned on every level. Transparent texels don't bleed into the color,
+	a texel stays opaque when at least half of its source texels are opaque.
+*/
 void Image_GenerateMipmaps(Image* img)
 {
-	int mip_width = img->width;
-	int mip_height = img->height;
+	int frame_width = (img->h_frames > 0) ? img->width / img->h_frames : img->width;
+	int frame_height = (img->v_frames > 0) ? img->height / img->v_frames : img->height;
 
-	float scale = 1;
+	Image* src = img;
 
-	for (int i = 0; i < MAX_IMAGE_MIPMAPS; i++)
+	while (img->num_mipmaps < MAX_IMAGE_MIPMAPS)
 	{
-		mip_width >>= 1;
-		mip_height >>= 1;
-
-		scale /= 2;
-
-		//check for valid mip size
-		if (mip_width < 1)
-		{
-			mip_width = 1;
-		}
-		if (mip_height < 1)
-		{
-			mip_height = 1;
-		}
-
-		if (img->num_mipmaps >= MAX_IMAGE_MIPMAPS)
+		if ((frame_width & 1) || (frame_height & 1) || frame_width < 2 || frame_height < 2)
 		{
 			break;
 		}
 
+		frame_width >>= 1;
+		frame_height >>= 1;
+
 		Image* mip_image = malloc(sizeof(Image));
 
 		if (!mip_image)
@@ -298,66 +386,67 @@ void Image_GenerateMipmaps(Image* img)
 			return;
 		}
 
-		Image_Create(mip_image, mip_width, mip_height, img->numChannels);
+		if (!Image_Create(mip_image, src->width / 2, src->height / 2, img->numChannels))
+		{
+			free(mip_image);
+			return;
+		}
 
-		mip_image->x_scale = (float)mip_width / (float)img->width;
-		mip_image->y_scale = (float)mip_height / (float)img->height;
-		
-		mip_image->x_scale = scale;
-		mip_image->y_scale = scale;
+		mip_image->h_frames = img->h_frames;
+		mip_image->v_frames = img->v_frames;
+		mip_image->column_major = img->column_major;
+		mip_image->x_scale = (float)mip_image->width / (float)img->width;
+		mip_image->y_scale = (float)mip_image->height / (float)img->height;
 
-		int mip = i + 1;
+		const int channels = img->numChannels;
+		const bool has_alpha = (channels >= 4);
 
-		for (int x = 0; x < mip_width; x++)
+		for (int x = 0; x < mip_image->width; x++)
 		{
-			for (int y = 0; y < mip_height; y++)
+			for (int y = 0; y < mip_image->height; y++)
 			{
-				//4 samples per channel
-				for (int c = 0; c < img->numChannels; c++)
+				unsigned char* samples[4] =
 				{
-					unsigned char* samp0 = Image_Get(img, (x << mip) + 0, (y << mip) + 0);
-					unsigned char* samp1 = Image_Get(img, (x << mip) + 1, (y << mip) + 0);
-					unsigned char* samp2 = Image_Get(img, (x << mip) + 1, (y << mip) + 1);
-					unsigned char* samp3 = Image_Get(img, (x << mip) + 0, (y << mip) + 1);
+					Image_Get(src, x * 2 + 0, y * 2 + 0),
+					Image_Get(src, x * 2 + 1, y * 2 + 0),
+					Image_Get(src, x * 2 + 0, y * 2 + 1),
+					Image_Get(src, x * 2 + 1, y * 2 + 1)
+				};
 
-					int avg = 0;
-					int samples = 0;
+				int sum[4] = { 0, 0, 0, 0 };
+				int opaque = 0;
 
-					if (samp0) { avg += samp0[c]; samples++; }
-					if (samp1) { avg += samp1[c]; samples++; }
-					if (samp2) { avg += samp2[c]; samples++; }
-					if (samp3) { avg += samp3[c]; samples++; }
+				for (int i = 0; i < 4; i++)
+				{
+					if (has_alpha && samples[i][3] < 128)
+					{
+						continue;
+					}
 
-					if (samples > 0)
+					for (int c = 0; c < channels; c++)
 					{
-						avg /= samples;
-
-						if (avg < 0)
-						{
-							avg = 0;
-						}
-						if (avg > 255)
-						{
-							avg = 255;
-						}
-
-						unsigned char* mip_color = Image_Get(mip_image, x, y);
-
-						if (mip_color)
-						{
-							mip_color[c] = (unsigned char)avg;
-						}
+						sum[c] += samples[i][c];
 					}
+					opaque++;
+				}
+
+				unsigned char* mip_color = Image_Get(mip_image, x, y);
 
-					
+				for (int c = 0; c < channels; c++)
+				{
+					mip_color[c] = (opaque > 0) ? (unsigned char)((sum[c] + opaque / 2) / opaque) : 0;
+				}
 
+				if (has_alpha)
+				{
+					mip_color[3] = (opaque >= 2) ? 255 : 0;
 				}
 			}
 		}
-		
-		//Image_Blur(mip_image, 8, 0.5);
 
 		img->mipmaps[img->num_mipmaps++] = mip_image;
+
+		src = mip_image;
 	}
 }
 
@@ -512,6 +601,8 @@ void Image_Copy(Image* dest, Image* src)
 	assert(dest->numChannels == src->numChannels);
 	
 	memcpy(dest->data, src->data, sizeof(unsigned char) * dest->width * dest->height * dest->numChannels);
+
+	dest->column_major = src->column_major;
 }
 
 void Image_Blit(Image* dest, Image* src, int dstX0, int dstY0, int dstX1, int dstY1, int srcX0, int srcY0, int srcX1, int srcY1)
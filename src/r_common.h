@@ -16,6 +16,31 @@
 #define LIGHT_LOW 0
 #define LIGHT_HIGH 1
 
+//8 bit pipeline
+#define PALETTE_TRANSPARENT 255
+#define COLORMAP_LEVELS 32
+
+//16.16 fixed point for the DDA
+#define RAY_FRAC_BITS 16
+//distance between grid lines of a ray parallel to an axis, leaves headroom so the walk never overflows
+#define RAY_MAX_DELTA (1 << 29)
+//rays set up at once
+#define RAY_BATCH 32
+
+//camera space x of every screen column, only changes with the resolution
+typedef struct
+{
+	float* cam_x;
+	int width;
+} RayTable;
+
+typedef struct
+{
+	float dir_x, dir_y;
+	int32_t delta_x, delta_y; //distance between two x or two y sides
+	int32_t side_x, side_y; //distance to the first x and y side
+} Ray;
+
 typedef struct
 {
 	uint8_t light;
@@ -26,6 +51,10 @@ typedef struct
 	float wall_dist;
 	float floor_x;
 	float floor_y;
+
+	//rows the wall was drawn on and the depth it left there, sprites behind it are culled before drawing
+	float occluder_dist;
+	int occluder_top, occluder_bottom;
 } DrawSpan;
 
 typedef struct
@@ -41,7 +70,7 @@ typedef struct
 	AlphaSpan* alpha_spans;
 } FrameInfo;
 
-typedef struct
+typedef struct Image
 {
 	int half_width;
 	int half_height;
@@ -54,6 +83,12 @@ typedef struct
 	int h_frames;
 	int v_frames;
 
+	//pixels are stored column by column, so vertical reads are contiguous
+	bool column_major;
+
+	//palette index per pixel in the same layout as data, only set for quantized images
+	unsigned char* indices;
+
 	FrameInfo* frame_info;
 
 	//mipmap stuff
@@ -72,38 +107,55 @@ void Image_Clear(Image* img, int c);
 void Image_Copy(Image* dest, Image* src);
 void Image_Blit(Image* dest, Image* src, int dstX0, int dstY0, int dstX1, int dstY1, int srcX0, int srcY0, int srcX1, int srcY1);
 void Image_Set(Image* img, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+void Image_SetColumnMajor(Image* img, bool column_major);
 
-inline void Image_Set2(Image* img, int x, int y, unsigned char* color)
+//pixel offset of x, y in the image's storage order
+static inline int Image_PixelIndex(const Image* img, int x, int y)
+{
+	return (img->column_major) ? y + x * img->height : x + y * img->width;
+}
+//pixels between two horizontally adjacent pixels
+static inline int Image_XStride(const Image* img)
+{
+	return (img->column_major) ? img->height : 1;
+}
+//pixels between two vertically adjacent pixels
+static inline int Image_YStride(const Image* img)
+{
+	return (img->column_major) ? 1 : img->width;
+}
+
+static inline void Image_Set2(Image* img, int x, int y, unsigned char* color)
 {
 	if (!img->data || x < 0 || y < 0 || x >= img->width || y >= img->height)
 	{
 		return;
 	}
 
-	unsigned char* d = img->data + (x + y * img->width) * img->numChannels;
+	unsigned char* d = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 
 	memcpy(d, color, img->numChannels);
 }
-inline void Image_Set3(Image* img, int x, int y, unsigned char* color, int numChannels)
+static inline void Image_Set3(Image* img, int x, int y, unsigned char* color, int numChannels)
 {
 	if (!img->data || x < 0 || y < 0 || x >= img->width || y >= img->height)
 	{
 		return;
 	}
 
-	unsigned char* d = img->data + (x + y * img->width) * img->numChannels;
+	unsigned char* d = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 
 	memcpy(d, color, numChannels);
 }
-inline void Image_SetFast(Image* img, int x, int y, unsigned char* color)
+static inline void Image_SetFast(Image* img, int x, int y, unsigned char* color)
 {
-	unsigned char* d = img->data + (x + y * img->width) * img->numChannels;
+	unsigned char* d = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 
 	memcpy(d, color, img->numChannels);
 }
-inline void Image_SetScaled(Image* img, int x, int y, float scale, unsigned char* color)
+static inline void Image_SetScaled(Image* img, int x, int y, float scale, unsigned char* color)
 {
-	unsigned char* d = img->data + (x + y * img->width) * img->numChannels;
+	unsigned char* d = img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 
 	//no scale, so set directly
 	if (scale == 1)
@@ -146,7 +198,7 @@ inline void Image_SetScaled(Image* img, int x, int y, float scale, unsigned char
 	
 }
 
-inline unsigned char* Image_Get(Image* img, int x, int y)
+static inline unsigned char* Image_Get(const Image* img, int x, int y)
 {
 	if (x < 0)
 	{
@@ -165,49 +217,59 @@ inline unsigned char* Image_Get(Image* img, int x, int y)
 		y = img->height - 1;
 	}
 
-	return img->data + (x + y * img->width) * img->numChannels;
+	return img->data + Image_PixelIndex(img, x, y) * img->numChannels;
 }
-
-//unfinished
-inline unsigned char* Image_GetMipmapped(Image* img, int x, int y, float dist)
+//palette index, the image has to be quantized
+static inline unsigned char Image_GetIndex(Image* img, int x, int y)
 {
-	dist = fabs(dist);
+	if (x < 0) x = 0;
+	else if (x >= img->width) x = img->width - 1;
+	if (y < 0) y = 0;
+	else if (y >= img->height) y = img->height - 1;
 
-	int mipmap_index = (int)dist;
+	return img->indices[Image_PixelIndex(img, x, y)];
+}
 
-	if (dist >= img->num_mipmaps - 1)
+//level 0 is the image itself
+static inline Image* Image_GetMipLevel(Image* img, int level)
+{
+	if (level <= 0 || img->num_mipmaps <= 0)
 	{
-		mipmap_index = img->num_mipmaps - 1;
+		return img;
 	}
-
-	if (mipmap_index == 0)
+	if (level > img->num_mipmaps)
 	{
-		return Image_Get(img, x, y);
+		level = img->num_mipmaps;
 	}
 
-	Image* mip_map = img->mipmaps[mipmap_index];
+	return (Image*)img->mipmaps[level - 1];
+}
 
-	x *= mip_map->x_scale;
-	y *= mip_map->y_scale;
+//picks the level where one texel covers about one pixel
+static inline int Image_SelectMipLevel(const Image* img, float texels_per_pixel)
+{
+	int level = 0;
 
-	if (x < 0)
-	{
-		x = 0;
-	}
-	else if (x >= mip_map->width)
+	while (level < img->num_mipmaps && texels_per_pixel >= 2.0f)
 	{
-		x = mip_map->width - 1;
+		texels_per_pixel *= 0.5f;
+		level++;
 	}
-	if (y < 0)
-	{
-		y = 0;
-	}
-	else if (y >= mip_map->height)
+
+	return level;
+}
+
+//x and y are in level 0 texels
+static inline unsigned char* Image_GetMipmapped(Image* img, int x, int y, int level)
+{
+	Image* mip_map = Image_GetMipLevel(img, level);
+
+	if (mip_map == img)
 	{
-		y = mip_map->height - 1;
+		return Image_Get(img, x, y);
 	}
 
-	return mip_map->data + (x + y * mip_map->width) * mip_map->numChannels;
+	return Image_Get(mip_map, x * mip_map->x_scale, y * mip_map->y_scale);
 }
 
 void Image_Blur(Image* img, int size, float scale);
@@ -228,8 +290,6 @@ typedef struct
 	float v_offset;
 	bool flip_h, flip_v;
 
-	bool skip_draw;
-
 	//modifiers
 	float transparency;
 	float light;
@@ -263,25 +323,97 @@ typedef struct
 } Sprite;
 
 
+//c * light / 255 without a division, exact for every pair of bytes
+static inline unsigned char Video_Light(unsigned char c, unsigned char light)
+{
+	unsigned x = (unsigned)c * (unsigned)light;
+
+	return (unsigned char)((x + 1 + (x >> 8)) >> 8);
+}
+
+typedef enum
+{
+	COLUMN_KERNEL__SCALAR,
+	COLUMN_KERNEL__SSE2,
+	COLUMN_KERNEL__AVX2,
+	COLUMN_KERNEL__NEON,
+
+	COLUMN_KERNEL__MAX
+} ColumnKernel;
+
+//a vertical run of lit and depth tested texels
+typedef struct
+{
+	unsigned char* dst; //first rgba pixel, or palette index for indexed columns
+	float* depth; //depth of the first pixel
+	int stride; //pixels between two rows in dst and depth
+	int count;
+
+	const unsigned char* tex; //first texel of the texture column
+	int tex_stride; //bytes between two texels of the column
+	int tex_mask;
+	uint32_t v, v_step; //16.16 fixed point
+
+	unsigned char light;
+	const unsigned char* colormap; //indexed columns only
+	float wall_dist;
+} ColumnDraw;
+
 void Sprite_UpdateAnimation(Sprite* sprite, float delta);
 void Sprite_ResetAnimState(Sprite* sprite);
 
 void Video_Setup();
 void Video_DrawLine(Image* image, int x0, int y0, int x1, int y1, unsigned char* color);
 void Video_DrawRectangle(Image* image, int p_x, int p_y, int p_w, int p_h, unsigned char* p_color);
-void Video_RaycastFloorCeilling(Image* image, Image* texture, float* depth_buffer, int x, int spans, int draw_start, int draw_end, float floor_x, float floor_y, float wall_dist, float p_x, float p_y, int doors_drawn, bool is_floor);
-void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpan* draw_spans, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY);
+void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpan* draw_spans, const RayTable* ray_table, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY);
+bool Video_CreateRayTable(RayTable* table, int width);
+void Video_DestroyRayTable(RayTable* table);
+void Video_SetupRays(const RayTable* table, int x, int count, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY, Ray* r_rays);
 bool Video_DrawCollumn(Image* image, Image* texture, int x, float size, float* depth_buffer, int tex_x, float wall_dist, unsigned char light, int tile, int spans, int doors_drawn, int* r_draw_start, int* r_draw_end);
 void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY);
 bool Video_SpriteSetup(Image* image, Sprite* sprite, float* depth_buffer, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY);
 void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer, int x_start, int x_end);
+bool Video_IsSpriteOccluded(const Sprite* sprite, const DrawSpan* draw_spans, int x_start, int x_end);
 void Video_DrawScreenTexture(Image* image, Image* texture, float p_x, float p_y, float p_scaleX, float p_scaleY);
 void Video_DrawScreenSprite(Image* image, Sprite* sprite);
 
+void Video_SetupColumnKernels();
+bool Video_IsColumnKernelSupported(ColumnKernel kernel);
+bool Video_SetColumnKernel(ColumnKernel kernel);
+ColumnKernel Video_GetColumnKernel();
+const char* Video_GetColumnKernelName(ColumnKernel kernel);
+int Video_DrawColumn(const ColumnDraw* col);
+int Video_DrawColumnWith(ColumnKernel kernel, const ColumnDraw* col);
+void Video_SetMipmaps(bool enable);
+bool Video_GetMipmaps();
+void Video_SetSpriteOcclusion(bool enable);
+void Video_TransposeColumns(Image* dst, const Image* src, int x_start, int x_end);
+int Video_DrawColumnIndexed(const ColumnDraw* col);
+
+bool Video_BuildPalette(Image** images, int num_images);
+void Video_DestroyPalette();
+bool Video_HasPalette();
+const unsigned char* Video_GetColormap(int light);
+void Video_ExpandColumns(Image* dst, const Image* src, int x_start, int x_end);
+
 typedef void (*ShaderFun)(Image* image, int x, int y, int tx, int ty);
 void Video_Shade(Image* image, ShaderFun shader_fun, int x0, int y0, int x1, int y1);
 
+typedef struct
+{
+	int num_threads;
+	float frame_ms;
+	float world_ms;
+
+	//world pass load balance, imbalance is the busiest thread's time over the average
+	float imbalance;
+	float max_band_ms;
+	int num_bands;
+	int num_steals;
+} RenderStats;
+
 bool Render_Init(int width, int height);
+bool Render_InitHeadless(int width, int height);
 void Render_ShutDown();
 void Render_LockThreadsMutex();
 void Render_UnlockThreadsMutex();
@@ -293,6 +425,9 @@ void Render_AddSpriteToQueue(Sprite* sprite);
 void Render_AddScreenSpriteToQueue(Sprite* sprite);
 void Render_QueueFullscreenShader(ShaderFun shader_fun);
 
+typedef void (*ParallelForFun)(int start, int end, void* data);
+void Render_ParallelFor(int count, int batch, ParallelForFun fun, void* data);
+
 void Render_RedrawWalls();
 void Render_RedrawSprites();
 void Render_ResizeWindow(int width, int height);
@@ -304,6 +439,14 @@ void Render_SetRenderScale(int scale);
 float Render_GetWindowAspect();
 int Render_IsFullscreen();
 void Render_ToggleFullscreen();
+void Render_SetThreadCount(int count);
+int Render_GetThreadCount();
+Image* Render_GetFramebuffer();
+const RenderStats* Render_GetStats();
+void Render_SetShowStats(bool show);
+bool Render_GetShowStats();
+void Render_SetPaletteMode(bool enable);
+bool Render_GetPaletteMode();
 
 #define MAX_FONT_GLYPHS 100
 
@@ -349,7 +492,7 @@ typedef struct
 
 
 bool Text_LoadFont(const char* filename, const char* image_path, FontData* font_data);
-FontGlyphData* FontData_GetGlyphData(const FontData* font_data, char ch);
+const FontGlyphData* FontData_GetGlyphData(const FontData* font_data, char ch);
 void Text_DrawStr(Image* image, const FontData* font_data, float _x, float _y, float scale_x, float scale_y, int r, int g, int b, int a, const char* str);
 void Text_Draw(Image* image, const FontData* font_data, float _x, float _y, float scale_x, float scale_y, const char* fmt, ...);
 void Text_DrawColor(Image* image, const FontData* font_data, float _x, float _y, float scale_x, float scale_y, int r, int g, int b, int a, const char* fmt, ...);
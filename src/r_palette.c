@@ -0,0 +1,481 @@
+#include "r_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "u_math.h"
+
+/*
+	Optional 8 bit pipeline. A 255 color palette is built from the world textures with median cut,
+	the last index is kept as the transparent key. Lighting is a colormap with COLORMAP_LEVELS rows,
+	each row maps a palette index to the nearest palette index of the lit color.
+	The world is drawn as palette indices and expanded to rgba when it is transposed for upload.
+*/
+
+#define PALETTE_COLORS 255
+#define PALETTE_BITS 5
+#define PALETTE_LUT_SIZE (1 << (PALETTE_BITS * 3))
+
+typedef struct
+{
+	uint16_t color; //5:5:5
+	uint32_t count;
+} PaletteEntry;
+
+typedef struct
+{
+	int start, end; //range in the entry list
+	int longest_axis;
+	int range;
+} PaletteBox;
+
+static uint32_t s_palette[256];
+static unsigned char s_colormap[COLORMAP_LEVELS][256];
+static unsigned char* s_inverseLut;
+static bool s_hasPalette;
+
+static inline int Palette_Channel(uint16_t color, int axis)
+{
+	return (color >> (PALETTE_BITS * (2 - axis))) & ((1 << PALETTE_BITS) - 1);
+}
+
+//5 bits back to 8 bits
+static inline int Palette_Expand(int c)
+{
+	return (c << (8 - PALETTE_BITS)) | (c >> (PALETTE_BITS * 2 - 8));
+}
+
+static inline uint16_t Palette_Pack(int r, int g, int b)
+{
+	return (uint16_t)(((r >> (8 - PALETTE_BITS)) << (PALETTE_BITS * 2)) | ((g >> (8 - PALETTE_BITS)) << PALETTE_BITS) | (b >> (8 - PALETTE_BITS)));
+}
+
+static inline uint32_t Palette_MakeColor(int r, int g, int b)
+{
+	unsigned char rgba[4] = { r, g, b, 255 };
+	uint32_t color;
+
+	memcpy(&color, rgba, 4);
+
+	return color;
+}
+
+static void PaletteBox_Shrink(PaletteBox* box, const PaletteEntry* entries)
+{
+	int min_c[3] = { 255, 255, 255 };
+	int max_c[3] = { 0, 0, 0 };
+
+	for (int i = box->start; i < box->end; i++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int c = Palette_Channel(entries[i].color, axis);
+
+			if (c < min_c[axis]) min_c[axis] = c;
+			if (c > max_c[axis]) max_c[axis] = c;
+		}
+	}
+
+	box->longest_axis = 0;
+	box->range = -1;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int range = max_c[axis] - min_c[axis];
+
+		if (range > box->range)
+		{
+			box->range = range;
+			box->longest_axis = axis;
+		}
+	}
+}
+
+static int s_sortAxis;
+
+static int Palette_CompareEntries(const void* a, const void* b)
+{
+	const PaletteEntry* e0 = a;
+	const PaletteEntry* e1 = b;
+
+	int c0 = Palette_Channel(e0->color, s_sortAxis);
+	int c1 = Palette_Channel(e1->color, s_sortAxis);
+
+	if (c0 != c1)
+	{
+		return c0 - c1;
+	}
+
+	return (int)e0->color - (int)e1->color;
+}
+
+static int Palette_FindNearest(int r, int g, int b)
+{
+	int best = 0;
+	int best_dist = 0x7fffffff;
+
+	for (int i = 0; i < PALETTE_COLORS; i++)
+	{
+		unsigned char* c = (unsigned char*)&s_palette[i];
+
+		int dr = c[0] - r;
+		int dg = c[1] - g;
+		int db = c[2] - b;
+
+		int dist = dr * dr * 3 + dg * dg * 4 + db * db * 2;
+
+		if (dist < best_dist)
+		{
+			best_dist = dist;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static inline unsigned char Palette_Lookup(int r, int g, int b)
+{
+	return s_inverseLut[Palette_Pack(r, g, b)];
+}
+
+static bool Palette_MedianCut(Image** images, int num_images)
+{
+	uint32_t* histogram = calloc(PALETTE_LUT_SIZE, sizeof(uint32_t));
+
+	if (!histogram)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < num_images; i++)
+	{
+		Image* img = images[i];
+
+		if (!img || !img->data || img->numChannels < 3)
+		{
+			continue;
+		}
+
+		int num_pixels = img->width * img->height;
+
+		for (int k = 0; k < num_pixels; k++)
+		{
+			unsigned char* c = img->data + k * img->numChannels;
+
+			if (img->numChannels >= 4 && c[3] < 128)
+			{
+				continue;
+			}
+
+			histogram[Palette_Pack(c[0], c[1], c[2])]++;
+		}
+	}
+
+	int num_entries = 0;
+
+	for (int i = 0; i < PALETTE_LUT_SIZE; i++)
+	{
+		if (histogram[i] > 0) num_entries++;
+	}
+
+	PaletteEntry* entries = malloc(sizeof(PaletteEntry) * max(num_entries, 1));
+
+	if (!entries)
+	{
+		free(histogram);
+		return false;
+	}
+
+	num_entries = 0;
+
+	for (int i = 0; i < PALETTE_LUT_SIZE; i++)
+	{
+		if (histogram[i] > 0)
+		{
+			entries[num_entries].color = (uint16_t)i;
+			entries[num_entries].count = histogram[i];
+			num_entries++;
+		}
+	}
+
+	free(histogram);
+
+	PaletteBox boxes[PALETTE_COLORS];
+	int num_boxes = 0;
+
+	if (num_entries > 0)
+	{
+		boxes[0].start = 0;
+		boxes[0].end = num_entries;
+		PaletteBox_Shrink(&boxes[0], entries);
+		num_boxes = 1;
+	}
+
+	//split the box with the widest color range at its median
+	while (num_boxes < PALETTE_COLORS)
+	{
+		int split = -1;
+
+		for (int i = 0; i < num_boxes; i++)
+		{
+			if (boxes[i].end - boxes[i].start < 2 || boxes[i].range <= 0)
+			{
+				continue;
+			}
+			if (split == -1 || boxes[i].range > boxes[split].range)
+			{
+				split = i;
+			}
+		}
+
+		if (split == -1)
+		{
+			break;
+		}
+
+		PaletteBox* box = &boxes[split];
+
+		s_sortAxis = box->longest_axis;
+		qsort(entries + box->start, box->end - box->start, sizeof(PaletteEntry), Palette_CompareEntries);
+
+		uint64_t total = 0;
+
+		for (int i = box->start; i < box->end; i++)
+		{
+			total += entries[i].count;
+		}
+
+		uint64_t half = 0;
+		int median = box->start + 1;
+
+		for (int i = box->start; i < box->end - 1; i++)
+		{
+			half += entries[i].count;
+			median = i + 1;
+
+			if (half * 2 >= total)
+			{
+				break;
+			}
+		}
+
+		PaletteBox* new_box = &boxes[num_boxes++];
+
+		new_box->start = median;
+		new_box->end = box->end;
+		box->end = median;
+
+		PaletteBox_Shrink(box, entries);
+		PaletteBox_Shrink(new_box, entries);
+	}
+
+	memset(s_palette, 0, sizeof(s_palette));
+
+	//weighted average of every box
+	for (int i = 0; i < num_boxes; i++)
+	{
+		uint64_t sum[3] = { 0, 0, 0 };
+		uint64_t count = 0;
+
+		for (int k = boxes[i].start; k < boxes[i].end; k++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				sum[axis] += (uint64_t)Palette_Expand(Palette_Channel(entries[k].color, axis)) * entries[k].count;
+			}
+			count += entries[k].count;
+		}
+
+		s_palette[i] = Palette_MakeColor(sum[0] / count, sum[1] / count, sum[2] / count);
+	}
+
+	//pad unused entries with black
+	for (int i = num_boxes; i < PALETTE_COLORS; i++)
+	{
+		s_palette[i] = Palette_MakeColor(0, 0, 0);
+	}
+
+	s_palette[PALETTE_TRANSPARENT] = Palette_MakeColor(0, 0, 0);
+
+	free(entries);
+
+	return true;
+}
+
+static void Palette_Quantize(Image* img)
+{
+	if (img->indices)
+	{
+		free(img->indices);
+		img->indices = NULL;
+	}
+
+	int num_pixels = img->width * img->height;
+
+	unsigned char* indices = malloc(num_pixels);
+
+	if (!indices)
+	{
+		return;
+	}
+
+	//same layout as data, so the pixel index can be used directly
+	for (int k = 0; k < num_pixels; k++)
+	{
+		unsigned char* c = img->data + k * img->numChannels;
+
+		if (img->numChannels >= 4 && c[3] < 128)
+		{
+			indices[k] = PALETTE_TRANSPARENT;
+		}
+		else
+		{
+			indices[k] = Palette_Lookup(c[0], c[1], c[2]);
+		}
+	}
+
+	img->indices = indices;
+
+	for (int i = 0; i < img->num_mipmaps; i++)
+	{
+		Palette_Quantize((Image*)img->mipmaps[i]);
+	}
+}
+
+bool Video_BuildPalette(Image** images, int num_images)
+{
+	s_hasPalette = false;
+
+	if (!s_inverseLut)
+	{
+		s_inverseLut = malloc(PALETTE_LUT_SIZE);
+
+		if (!s_inverseLut)
+		{
+			return false;
+		}
+	}
+
+	if (!Palette_MedianCut(images, num_images))
+	{
+		return false;
+	}
+
+	//nearest palette color for every 5:5:5 color
+	for (int i = 0; i < PALETTE_LUT_SIZE; i++)
+	{
+		int r = Palette_Channel((uint16_t)i, 0) << (8 - PALETTE_BITS);
+		int g = Palette_Channel((uint16_t)i, 1) << (8 - PALETTE_BITS);
+		int b = Palette_Channel((uint16_t)i, 2) << (8 - PALETTE_BITS);
+
+		//sample the center of the cell
+		r |= 1 << (7 - PALETTE_BITS);
+		g |= 1 << (7 - PALETTE_BITS);
+		b |= 1 << (7 - PALETTE_BITS);
+
+		s_inverseLut[i] = Palette_FindNearest(r, g, b);
+	}
+
+	for (int level = 0; level < COLORMAP_LEVELS; level++)
+	{
+		int light = (level * 255) / (COLORMAP_LEVELS - 1);
+
+		for (int i = 0; i < PALETTE_COLORS; i++)
+		{
+			unsigned char* c = (unsigned char*)&s_palette[i];
+
+			s_colormap[level][i] = Palette_Lookup(Video_Light(c[0], light), Video_Light(c[1], light), Video_Light(c[2], light));
+		}
+
+		s_colormap[level][PALETTE_TRANSPARENT] = PALETTE_TRANSPARENT;
+	}
+
+	for (int i = 0; i < num_images; i++)
+	{
+		if (images[i] && images[i]->data && images[i]->numChannels >= 3)
+		{
+			Palette_Quantize(images[i]);
+		}
+	}
+
+	s_hasPalette = true;
+
+	return true;
+}
+
+void Video_DestroyPalette()
+{
+	if (s_inverseLut)
+	{
+		free(s_inverseLut);
+		s_inverseLut = NULL;
+	}
+
+	s_hasPalette = false;
+}
+
+bool Video_HasPalette()
+{
+	return s_hasPalette;
+}
+
+const unsigned char* Video_GetColormap(int light)
+{
+	if (light < 0) light = 0;
+	else if (light > 255) light = 255;
+
+	return s_colormap[(light * (COLORMAP_LEVELS - 1) + 127) / 255];
+}
+
+/*
+	Same walk as Video_TransposeColumns, but the source is a column major image of palette indices
+*/
+void Video_ExpandColumns(Image* dst, const Image* src, int x_start, int x_end)
+{
+	const int width = dst->width;
+	const int height = dst->height;
+
+	const unsigned char* src_data = src->data;
+	uint32_t* dst_data = (uint32_t*)dst->data;
+
+	int block_end_x = x_start + ((x_end - x_start) & ~3);
+	int block_end_y = height & ~3;
+
+	for (int y = 0; y < block_end_y; y += 4)
+	{
+		int x = x_start;
+
+		//4x4 blocks, every row of the block is written with a single 16 byte copy
+		for (; x < block_end_x; x += 4)
+		{
+			const unsigned char* s = src_data + y + x * height;
+			uint32_t* d = dst_data + x + y * width;
+
+			for (int i = 0; i < 4; i++)
+			{
+				uint32_t row[4] = { s_palette[s[i]], s_palette[s[i + height]], s_palette[s[i + height * 2]], s_palette[s[i + height * 3]] };
+
+				memcpy(d + i * width, row, sizeof(row));
+			}
+		}
+
+		//leftover columns
+		for (; x < x_end; x++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				dst_data[x + (y + i) * width] = s_palette[src_data[(y + i) + x * height]];
+			}
+		}
+	}
+
+	//leftover rows
+	for (int y = block_end_y; y < height; y++)
+	{
+		for (int x = x_start; x < x_end; x++)
+		{
+			dst_data[x + y * width] = s_palette[src_data[y + x * height]];
+		}
+	}
+}
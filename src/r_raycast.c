@@ -0,0 +1,197 @@
+#include "r_common.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+/*
+	Per column ray setup for the DDA. The camera space x of every column only depends on the
+	resolution, so it is stored in a table that is rebuilt on resize. Every frame the table is
+	turned into ray directions, and the distances between grid lines are computed for several
+	neighbouring columns at once and stored in 16.16 fixed point for the DDA walk.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAY_X86
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define RAY_NEON
+#include <arm_neon.h>
+#endif
+
+//largest distance between grid lines, in tiles. A ray parallel to an axis never crosses it
+#define RAY_MAX_DIST ((float)(RAY_MAX_DELTA >> RAY_FRAC_BITS))
+
+bool Video_CreateRayTable(RayTable* table, int width)
+{
+	if (width < 1)
+	{
+		width = 1;
+	}
+
+	float* cam_x = malloc(sizeof(float) * width);
+
+	if (!cam_x)
+	{
+		return false;
+	}
+
+	for (int x = 0; x < width; x++)
+	{
+		cam_x[x] = 2.0 * x / (double)width - 1.0;
+	}
+
+	Video_DestroyRayTable(table);
+
+	table->cam_x = cam_x;
+	table->width = width;
+
+	return true;
+}
+
+void Video_DestroyRayTable(RayTable* table)
+{
+	if (table->cam_x)
+	{
+		free(table->cam_x);
+	}
+
+	table->cam_x = NULL;
+	table->width = 0;
+}
+
+static inline int32_t Ray_ToFixed(float dist)
+{
+	if (dist > RAY_MAX_DIST)
+	{
+		dist = RAY_MAX_DIST;
+	}
+
+	return (int32_t)(dist * (1 << RAY_FRAC_BITS));
+}
+
+static void Video_SetupRay(Ray* ray, float cam_x, float frac_x, float frac_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
+{
+	ray->dir_x = p_dirX + p_planeX * cam_x;
+	ray->dir_y = p_dirY + p_planeY * cam_x;
+
+	float delta_x = (ray->dir_x == 0) ? RAY_MAX_DIST : fabsf(1.0f / ray->dir_x);
+	float delta_y = (ray->dir_y == 0) ? RAY_MAX_DIST : fabsf(1.0f / ray->dir_y);
+
+	ray->delta_x = Ray_ToFixed(delta_x);
+	ray->delta_y = Ray_ToFixed(delta_y);
+
+	ray->side_x = Ray_ToFixed(((ray->dir_x < 0) ? frac_x : 1.0f - frac_x) * delta_x);
+	ray->side_y = Ray_ToFixed(((ray->dir_y < 0) ? frac_y : 1.0f - frac_y) * delta_y);
+}
+
+void Video_SetupRays(const RayTable* table, int x, int count, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY, Ray* r_rays)
+{
+	const float* cam_x = table->cam_x + x;
+
+	//distance from the view to the lower grid line
+	float frac_x = p_x - floorf(p_x);
+	float frac_y = p_y - floorf(p_y);
+
+	int i = 0;
+
+#if defined(RAY_X86)
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 max_dist = _mm_set1_ps(RAY_MAX_DIST);
+	const __m128 to_fixed = _mm_set1_ps((float)(1 << RAY_FRAC_BITS));
+	const __m128 fx = _mm_set1_ps(frac_x);
+	const __m128 fy = _mm_set1_ps(frac_y);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cam = _mm_loadu_ps(cam_x + i);
+
+		__m128 dir_x = _mm_add_ps(_mm_set1_ps(p_dirX), _mm_mul_ps(_mm_set1_ps(p_planeX), cam));
+		__m128 dir_y = _mm_add_ps(_mm_set1_ps(p_dirY), _mm_mul_ps(_mm_set1_ps(p_planeY), cam));
+
+		//1 / 0 is inf, the min clamps it
+		__m128 delta_x = _mm_min_ps(_mm_div_ps(one, _mm_andnot_ps(sign_mask, dir_x)), max_dist);
+		__m128 delta_y = _mm_min_ps(_mm_div_ps(one, _mm_andnot_ps(sign_mask, dir_y)), max_dist);
+
+		__m128 neg_x = _mm_cmplt_ps(dir_x, _mm_setzero_ps());
+		__m128 neg_y = _mm_cmplt_ps(dir_y, _mm_setzero_ps());
+
+		__m128 to_side_x = _mm_or_ps(_mm_and_ps(neg_x, fx), _mm_andnot_ps(neg_x, _mm_sub_ps(one, fx)));
+		__m128 to_side_y = _mm_or_ps(_mm_and_ps(neg_y, fy), _mm_andnot_ps(neg_y, _mm_sub_ps(one, fy)));
+
+		__m128 side_x = _mm_min_ps(_mm_mul_ps(to_side_x, delta_x), max_dist);
+		__m128 side_y = _mm_min_ps(_mm_mul_ps(to_side_y, delta_y), max_dist);
+
+		float dirs_x[4], dirs_y[4];
+		int32_t deltas_x[4], deltas_y[4], sides_x[4], sides_y[4];
+
+		_mm_storeu_ps(dirs_x, dir_x);
+		_mm_storeu_ps(dirs_y, dir_y);
+		_mm_storeu_si128((__m128i*)deltas_x, _mm_cvttps_epi32(_mm_mul_ps(delta_x, to_fixed)));
+		_mm_storeu_si128((__m128i*)deltas_y, _mm_cvttps_epi32(_mm_mul_ps(delta_y, to_fixed)));
+		_mm_storeu_si128((__m128i*)sides_x, _mm_cvttps_epi32(_mm_mul_ps(side_x, to_fixed)));
+		_mm_storeu_si128((__m128i*)sides_y, _mm_cvttps_epi32(_mm_mul_ps(side_y, to_fixed)));
+
+		for (int k = 0; k < 4; k++)
+		{
+			Ray* ray = &r_rays[i + k];
+
+			ray->dir_x = dirs_x[k];
+			ray->dir_y = dirs_y[k];
+			ray->delta_x = deltas_x[k];
+			ray->delta_y = deltas_y[k];
+			ray->side_x = sides_x[k];
+			ray->side_y = sides_y[k];
+		}
+	}
+#elif defined(RAY_NEON)
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	const float32x4_t max_dist = vdupq_n_f32(RAY_MAX_DIST);
+	const float32x4_t fx = vdupq_n_f32(frac_x);
+	const float32x4_t fy = vdupq_n_f32(frac_y);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t cam = vld1q_f32(cam_x + i);
+
+		float32x4_t dir_x = vmlaq_n_f32(vdupq_n_f32(p_dirX), cam, p_planeX);
+		float32x4_t dir_y = vmlaq_n_f32(vdupq_n_f32(p_dirY), cam, p_planeY);
+
+		float32x4_t delta_x = vminq_f32(vdivq_f32(one, vabsq_f32(dir_x)), max_dist);
+		float32x4_t delta_y = vminq_f32(vdivq_f32(one, vabsq_f32(dir_y)), max_dist);
+
+		float32x4_t to_side_x = vbslq_f32(vcltzq_f32(dir_x), fx, vsubq_f32(one, fx));
+		float32x4_t to_side_y = vbslq_f32(vcltzq_f32(dir_y), fy, vsubq_f32(one, fy));
+
+		float32x4_t side_x = vminq_f32(vmulq_f32(to_side_x, delta_x), max_dist);
+		float32x4_t side_y = vminq_f32(vmulq_f32(to_side_y, delta_y), max_dist);
+
+		float dirs_x[4], dirs_y[4];
+		int32_t deltas_x[4], deltas_y[4], sides_x[4], sides_y[4];
+
+		vst1q_f32(dirs_x, dir_x);
+		vst1q_f32(dirs_y, dir_y);
+		vst1q_s32(deltas_x, vcvtq_n_s32_f32(delta_x, RAY_FRAC_BITS));
+		vst1q_s32(deltas_y, vcvtq_n_s32_f32(delta_y, RAY_FRAC_BITS));
+		vst1q_s32(sides_x, vcvtq_n_s32_f32(side_x, RAY_FRAC_BITS));
+		vst1q_s32(sides_y, vcvtq_n_s32_f32(side_y, RAY_FRAC_BITS));
+
+		for (int k = 0; k < 4; k++)
+		{
+			Ray* ray = &r_rays[i + k];
+
+			ray->dir_x = dirs_x[k];
+			ray->dir_y = dirs_y[k];
+			ray->delta_x = deltas_x[k];
+			ray->delta_y = deltas_y[k];
+			ray->side_x = sides_x[k];
+			ray->side_y = sides_y[k];
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		Video_SetupRay(&r_rays[i], cam_x[i], frac_x, frac_y, p_dirX, p_dirY, p_planeX, p_planeY);
+	}
+}
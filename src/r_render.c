@@ -6,10 +6,13 @@
 #include <glad/glad.h>
 #include "g_common.h"
 #include <main.h>
-#include <windows.h>
+#include "u_sys.h"
+#include "u_math.h"
 
-#define NUM_RENDER_THREADS 8
-#define MAX_DRAWSPRITES 1024
+#define MAX_RENDER_THREADS 64
+#define RENDER_THREAD_SPIN_COUNT 1024
+#define RENDER_BAND_WIDTH 32
+#define MAX_DRAWSPRITES 4096
 #define MAX_SCREENSPRITES 10
 #define MAX_SCREENTEXTS 10
 
@@ -47,46 +50,93 @@ static const char* FRAGMENT_SHADER_SOURCE[] =
 	"}\n"
 };
 
-typedef enum
-{
-	TS__NONE,
-	TS__SLEEPING,
-	TS__WORKING,
-} ThreadState;
-
 typedef enum
 {
 	TWT__NONE,
 
 	TWT__SHADER,
-	TWT__DRAW_LEVEL
+	TWT__DRAW_LEVEL,
+	TWT__TRANSPOSE,
+	TWT__PARALLEL_FOR
 } ThreadWorkType;
 
 typedef struct
 {
-	ThreadState state;
-	ThreadWorkType work_type;
+	int x_start, x_end;
 
-	HANDLE thread_handle;
+	//run of band_sprite_indices, the sorted sprites that reach into the band
+	int first_sprite;
+	int num_sprites;
 
-	CRITICAL_SECTION mutex;
-	HANDLE start_work_event;
-	HANDLE active_event;
-	HANDLE finished_work_event;
+	double cost;
+} RenderBand;
 
-	int x_start, x_end;
+typedef struct
+{
+	//band deque packed as head | tail << 32, the owner pops from the head and thieves take from the tail
+	volatile int64_t deque;
+	char pad[CACHE_LINE_SIZE - sizeof(int64_t)];
+
+	Thread thread;
+
+	int index;
 
-	bool shutdown;
+	int32_t seen_generation;
+	double work_time;
+	int num_steals;
 } RenderThread;
 
+/*
+	Workers sleep on a condition variable and are woken by bumping a generation counter.
+	The last worker to finish wakes the dispatcher. A job runs while job_mutex is held,
+	so taking job_mutex keeps the workers out of any shared state.
+
+	The screen is split into bands of RENDER_BAND_WIDTH columns. Each job hands every thread
+	a contiguous run of bands, a thread that runs out steals bands from the busiest thread.
+	The dispatching thread takes part as the last slot.
+*/
+typedef struct
+{
+	RenderThread threads[MAX_RENDER_THREADS + 1];
+	int num_threads;
+
+	RenderBand* bands;
+	int num_bands;
+
+	Mutex job_mutex;
+	Mutex mutex;
+	CondVar wake_cv;
+	CondVar done_cv;
+
+	ThreadWorkType work_type;
+
+	//Render_ParallelFor jobs, items are taken in batches from a shared counter
+	ParallelForFun for_fun;
+	void* for_data;
+	int for_count;
+	int for_batch;
+	volatile int32_t for_next;
+
+	volatile int32_t generation;
+	volatile int32_t pending;
+	volatile int32_t shutdown;
+} RenderPool;
+
 typedef struct
 {
 	GLuint gl_texture, gl_vao, gl_vbo, gl_shader;
 
 	Image framebuffer;
 
+	//column major, the world is drawn here and transposed into the framebuffer
+	Image world_buffer;
+
 	DrawSpan* draw_spans;
 
+	//camera space x of every column
+	RayTable ray_table;
+
+	//same layout as world_buffer
 	float* depth_buffer;
 
 	int w, h;
@@ -101,7 +151,14 @@ typedef struct
 
 	FontData font_data;
 
-	RenderThread threads[NUM_RENDER_THREADS];
+	RenderPool pool;
+	int thread_count_override;
+
+	RenderStats stats;
+	bool draw_stats;
+
+	//draw the world as palette indices when a palette is loaded
+	bool use_palette;
 
 	Sprite* draw_sprites[MAX_DRAWSPRITES];
 	int num_draw_sprites;
@@ -109,6 +166,10 @@ typedef struct
 	int sorted_draw_sprite_indices[MAX_DRAWSPRITES];
 	int num_sorted_draw_sprites;
 
+	//sorted sprite indices binned by band, in draw order
+	int* band_sprite_indices;
+	int band_sprite_capacity;
+
 	Sprite* screen_sprites[MAX_SCREENSPRITES];
 	int num_screen_sprites;
 
@@ -117,16 +178,18 @@ typedef struct
 
 	ShaderFun fullscreen_shader_fun;
 
-	CRITICAL_SECTION object_mutex;
-	CRITICAL_SECTION main_thread_mutex;
-	CONDITION_VARIABLE main_thread_cv;
-	HANDLE main_thread_active_event;
-	HANDLE main_thread_standby_event;
-	HANDLE main_thread_handle;
+	Mutex object_mutex;
+	Mutex main_thread_mutex;
+	CondVar main_thread_cv;
+	Thread main_thread;
 
 	bool stall_main_thread;
+	bool main_thread_standby;
 	bool size_changed;
 	bool main_thread_shutdown;
+
+	//no gl context and no main render thread, frames are drawn by calling Render_View directly
+	bool headless;
 } RenderCore;
 
 static RenderCore s_renderCore;
@@ -161,23 +224,14 @@ static bool Shader_checkCompileErrors(unsigned int p_object, const char* p_type)
 
 static void Render_SizeChanged()
 {
-	EnterCriticalSection(&s_renderCore.main_thread_mutex);
+	Mutex_Lock(&s_renderCore.main_thread_mutex);
 
 	s_renderCore.size_changed = true;
 
-	LeaveCriticalSection(&s_renderCore.main_thread_mutex);
+	Mutex_Unlock(&s_renderCore.main_thread_mutex);
 }
 
-static void Render_ThreadMutexLock(RenderThread* thread)
-{
-	EnterCriticalSection(&thread->mutex);
-}
-static void Render_ThreadMutexUnlock(RenderThread* thread)
-{
-	LeaveCriticalSection(&thread->mutex);
-}
-
-static void Render_MainThreadLoop()
+static void Render_MainThreadLoop(void* arg)
 {
 	GLFWwindow* window = Engine_GetWindow();
 
@@ -190,8 +244,6 @@ static void Render_MainThreadLoop()
 	float view_plane_x = 0;
 	float view_plane_y = 0;
 
-	SetEvent(s_renderCore.main_thread_active_event);
-
 	while (!glfwWindowShouldClose(window) || !s_renderCore.main_thread_shutdown)
 	{
 		float aspect = Render_GetWindowAspect();
@@ -210,7 +262,7 @@ static void Render_MainThreadLoop()
 			break;
 		}
 
-		EnterCriticalSection(&s_renderCore.main_thread_mutex);
+		Mutex_Lock(&s_renderCore.main_thread_mutex);
 		if (s_renderCore.size_changed)
 		{
 			glViewport(0, 0, s_renderCore.win_w, s_renderCore.win_h);
@@ -222,132 +274,346 @@ static void Render_MainThreadLoop()
 		{
 			if (s_renderCore.stall_main_thread)
 			{
-				ResetEvent(s_renderCore.main_thread_active_event);
-				SetEvent(s_renderCore.main_thread_standby_event);
+				s_renderCore.main_thread_standby = true;
+				CondVar_Broadcast(&s_renderCore.main_thread_cv);
 
 				while (s_renderCore.stall_main_thread)
 				{
-					SleepConditionVariableCS(&s_renderCore.main_thread_cv, &s_renderCore.main_thread_mutex, INFINITE);
+					CondVar_Wait(&s_renderCore.main_thread_cv, &s_renderCore.main_thread_mutex);
 				}
 
 				//resume
-				ResetEvent(s_renderCore.main_thread_standby_event);
-				SetEvent(s_renderCore.main_thread_active_event);
+				s_renderCore.main_thread_standby = false;
+				CondVar_Broadcast(&s_renderCore.main_thread_cv);
 			}
 		}
-		LeaveCriticalSection(&s_renderCore.main_thread_mutex);
+		Mutex_Unlock(&s_renderCore.main_thread_mutex);
 	}
 }
 
-static void Render_ThreadLoop(RenderThread* thread)
+#define BAND_DEQUE_PACK(head, tail) (((int64_t)(tail) << 32) | (int64_t)(uint32_t)(head))
+#define BAND_DEQUE_HEAD(deque) ((int32_t)((deque) & 0xffffffff))
+#define BAND_DEQUE_TAIL(deque) ((int32_t)((deque) >> 32))
+
+static bool Render_PopBand(RenderThread* thread, int* r_band)
 {
-	GameAssets* assets = Game_GetAssets();
+	while (true)
+	{
+		int64_t deque = Atomic_Load64(&thread->deque);
 
-	SetEvent(thread->finished_work_event);
+		int head = BAND_DEQUE_HEAD(deque);
+		int tail = BAND_DEQUE_TAIL(deque);
 
-	while (!thread->shutdown)
-	{
-		//wait for work
-		WaitForSingleObject(thread->start_work_event, INFINITE);
+		if (head >= tail)
+		{
+			return false;
+		}
+
+		if (Atomic_CompareExchange64(&thread->deque, deque, BAND_DEQUE_PACK(head + 1, tail)))
+		{
+			*r_band = head;
+			return true;
+		}
+	}
+}
 
-		//set active state
-		ResetEvent(thread->finished_work_event);
-		ResetEvent(thread->start_work_event);
+static bool Render_StealBand(RenderThread* thread, int* r_band)
+{
+	RenderPool* pool = &s_renderCore.pool;
 
-		SetEvent(thread->active_event);
-		thread->state = TS__WORKING;
+	int num_slots = pool->num_threads + 1;
 
-		//do the work
-		Render_ThreadMutexLock(thread);
+	while (true)
+	{
+		//pick the thread with the most bands left
+		RenderThread* victim = NULL;
+		int64_t victim_deque = 0;
+		int victim_count = 0;
 
-		switch (thread->work_type)
+		for (int i = 1; i < num_slots; i++)
 		{
-		case TWT__SHADER:
+			RenderThread* other = &pool->threads[(thread->index + i) % num_slots];
+
+			int64_t deque = Atomic_Load64(&other->deque);
+			int count = BAND_DEQUE_TAIL(deque) - BAND_DEQUE_HEAD(deque);
+
+			if (count > victim_count)
+			{
+				victim = other;
+				victim_deque = deque;
+				victim_count = count;
+			}
+		}
+
+		if (!victim)
 		{
-			Video_Shade(&s_renderCore.framebuffer, s_renderCore.fullscreen_shader_fun, thread->x_start, 0, thread->x_end, s_renderCore.h);
-			break;
+			return false;
 		}
-		case TWT__DRAW_LEVEL:
+
+		int head = BAND_DEQUE_HEAD(victim_deque);
+		int tail = BAND_DEQUE_TAIL(victim_deque);
+
+		if (Atomic_CompareExchange64(&victim->deque, victim_deque, BAND_DEQUE_PACK(head, tail - 1)))
 		{
-			Video_RaycastMap(&s_renderCore.framebuffer, &assets->wall_textures, s_renderCore.depth_buffer, s_renderCore.draw_spans, thread->x_start, thread->x_end, s_renderCore.view_x, s_renderCore.view_y, s_renderCore.dir_x, s_renderCore.dir_y, s_renderCore.plane_x, s_renderCore.plane_y);
+			thread->num_steals++;
+			*r_band = tail - 1;
+			return true;
+		}
+	}
+}
 
-			for (int i = 0; i < s_renderCore.num_sorted_draw_sprites; i++)
-			{
-				int sprite_index = s_renderCore.sorted_draw_sprite_indices[i];
-				Sprite* sprite = s_renderCore.draw_sprites[sprite_index];
+static void Render_DrawBand(ThreadWorkType work_type, const RenderBand* band)
+{
+	GameAssets* assets = Game_GetAssets();
 
-				if (!sprite)
-				{
-					continue;
-				}
+	const int x_start = band->x_start;
+	const int x_end = band->x_end;
+
+	switch (work_type)
+	{
+	case TWT__SHADER:
+	{
+		Video_Shade(&s_renderCore.framebuffer, s_renderCore.fullscreen_shader_fun, x_start, 0, x_end, s_renderCore.h);
+		break;
+	}
+	case TWT__DRAW_LEVEL:
+	{
+		Video_RaycastMap(&s_renderCore.world_buffer, &assets->wall_textures, s_renderCore.depth_buffer, s_renderCore.draw_spans, &s_renderCore.ray_table, x_start, x_end, s_renderCore.view_x, s_renderCore.view_y, s_renderCore.dir_x, s_renderCore.dir_y, s_renderCore.plane_x, s_renderCore.plane_y);
 
-				Video_SpriteClipAndDraw(&s_renderCore.framebuffer, sprite, s_renderCore.depth_buffer, thread->x_start, thread->x_end);
+		for (int i = 0; i < band->num_sprites; i++)
+		{
+			int sprite_index = s_renderCore.band_sprite_indices[band->first_sprite + i];
+			Sprite* sprite = s_renderCore.draw_sprites[sprite_index];
+
+			//walls are drawn, skip the sprites that are hidden behind them in every column
+			if (!sprite || Video_IsSpriteOccluded(sprite, s_renderCore.draw_spans, x_start, x_end))
+			{
+				continue;
 			}
 
-			break;
+			Video_SpriteClipAndDraw(&s_renderCore.world_buffer, sprite, s_renderCore.depth_buffer, x_start, x_end);
 		}
 
-		default:
-			break;
+		break;
+	}
+	case TWT__TRANSPOSE:
+	{
+		if (s_renderCore.world_buffer.numChannels == 1)
+		{
+			Video_ExpandColumns(&s_renderCore.framebuffer, &s_renderCore.world_buffer, x_start, x_end);
+		}
+		else
+		{
+			Video_TransposeColumns(&s_renderCore.framebuffer, &s_renderCore.world_buffer, x_start, x_end);
 		}
+		break;
+	}
 
-		Render_ThreadMutexUnlock(thread);
+	default:
+		break;
+	}
+}
 
-		//set inactive state
-		ResetEvent(thread->active_event);
-		SetEvent(thread->finished_work_event);
+static void Render_DoParallelFor(RenderPool* pool)
+{
+	while (true)
+	{
+		int start = Atomic_Add(&pool->for_next, pool->for_batch) - pool->for_batch;
+
+		if (start >= pool->for_count)
+		{
+			break;
+		}
 
-		thread->state = TS__SLEEPING;
+		pool->for_fun(start, min(start + pool->for_batch, pool->for_count), pool->for_data);
 	}
 }
 
-static void Render_WaitForThread(RenderThread* thread)
+static void Render_DoWork(RenderThread* thread, ThreadWorkType work_type)
 {
-	WaitForSingleObject(thread->finished_work_event, INFINITE);
+	RenderPool* pool = &s_renderCore.pool;
+
+	//not a screen pass, leave the band stats alone
+	if (work_type == TWT__PARALLEL_FOR)
+	{
+		Render_DoParallelFor(pool);
+		return;
+	}
+
+	thread->work_time = 0;
+	thread->num_steals = 0;
+
+	int band_index = 0;
+
+	while (Render_PopBand(thread, &band_index) || Render_StealBand(thread, &band_index))
+	{
+		RenderBand* band = &pool->bands[band_index];
+
+		double start_time = Sys_GetTime();
+
+		Render_DrawBand(work_type, band);
+
+		band->cost = Sys_GetTime() - start_time;
+		thread->work_time += band->cost;
+	}
 }
 
-static void Render_WaitForAllThreads()
+static void Render_ThreadLoop(void* arg)
 {
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
+	RenderThread* thread = arg;
+	RenderPool* pool = &s_renderCore.pool;
+
+	int32_t seen_generation = thread->seen_generation;
+
+	while (true)
 	{
-		RenderThread* thr = &s_renderCore.threads[i];
+		//jobs are usually dispatched back to back, so spin for a bit before going to sleep
+		int32_t generation = Atomic_Load(&pool->generation);
 
-		Render_WaitForThread(thr);
+		for (int i = 0; i < RENDER_THREAD_SPIN_COUNT && generation == seen_generation; i++)
+		{
+			Sys_CpuRelax();
+			generation = Atomic_Load(&pool->generation);
+		}
+
+		if (generation == seen_generation)
+		{
+			Mutex_Lock(&pool->mutex);
+			while ((generation = Atomic_Load(&pool->generation)) == seen_generation)
+			{
+				CondVar_Wait(&pool->wake_cv, &pool->mutex);
+			}
+			Mutex_Unlock(&pool->mutex);
+		}
+
+		seen_generation = generation;
+
+		if (Atomic_Load(&pool->shutdown))
+		{
+			break;
+		}
+
+		Render_DoWork(thread, pool->work_type);
+
+		//the last thread to finish wakes up the dispatcher
+		if (Atomic_Add(&pool->pending, -1) == 0)
+		{
+			Mutex_Lock(&pool->mutex);
+			CondVar_Signal(&pool->done_cv);
+			Mutex_Unlock(&pool->mutex);
+		}
 	}
 }
 
-static void Render_SetWorkStateForAllThreads(ThreadWorkType work_type)
+static void Render_WaitForAllThreads()
+{
+	//jobs are dispatched synchronously, so just make sure nobody is in one
+	Mutex_Lock(&s_renderCore.pool.job_mutex);
+	Mutex_Unlock(&s_renderCore.pool.job_mutex);
+}
+
+static void Render_DispatchWork(ThreadWorkType work_type)
 {
-	//set start work event for all threads
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
+	RenderPool* pool = &s_renderCore.pool;
+
+	Mutex_Lock(&pool->job_mutex);
+
+	//hand out the bands, the dispatching thread gets the last run
+	int num_slots = (work_type == TWT__PARALLEL_FOR) ? 0 : pool->num_threads + 1;
+
+	for (int i = 0; i < num_slots; i++)
 	{
-		RenderThread* thr = &s_renderCore.threads[i];
+		int head = (pool->num_bands * i) / num_slots;
+		int tail = (pool->num_bands * (i + 1)) / num_slots;
 
-		Render_ThreadMutexLock(thr);
+		Atomic_Store64(&pool->threads[i].deque, BAND_DEQUE_PACK(head, tail));
+	}
 
-		thr->work_type = work_type;
+	pool->work_type = work_type;
+	Atomic_Store(&pool->pending, pool->num_threads);
 
-		SetEvent(thr->start_work_event);
+	Mutex_Lock(&pool->mutex);
+	Atomic_Add(&pool->generation, 1);
+	CondVar_Broadcast(&pool->wake_cv);
+	Mutex_Unlock(&pool->mutex);
 
-		WaitForSingleObject(thr->active_event, INFINITE);
+	Render_DoWork(&pool->threads[pool->num_threads], work_type);
 
-		Render_ThreadMutexUnlock(thr);
+	Mutex_Lock(&pool->mutex);
+	while (Atomic_Load(&pool->pending) > 0)
+	{
+		CondVar_Wait(&pool->done_cv, &pool->mutex);
 	}
+	Mutex_Unlock(&pool->mutex);
+
+	Mutex_Unlock(&pool->job_mutex);
+}
+
+static void Render_UpdateLoadStats()
+{
+	RenderPool* pool = &s_renderCore.pool;
+	RenderStats* stats = &s_renderCore.stats;
+
+	int num_slots = pool->num_threads + 1;
+
+	double total_time = 0;
+	double max_time = 0;
+	double max_band_time = 0;
+	int steals = 0;
+
+	for (int i = 0; i < num_slots; i++)
+	{
+		RenderThread* thr = &pool->threads[i];
+
+		total_time += thr->work_time;
+		max_time = max(max_time, thr->work_time);
+		steals += thr->num_steals;
+	}
+	for (int i = 0; i < pool->num_bands; i++)
+	{
+		max_band_time = max(max_band_time, pool->bands[i].cost);
+	}
+
+	//1 means every thread was busy for the same amount of time
+	stats->imbalance = (total_time > 0) ? (max_time * num_slots) / total_time : 1;
+	stats->max_band_ms = max_band_time * 1000.0;
+	stats->num_bands = pool->num_bands;
+	stats->num_steals = steals;
 }
 
 static void Render_StallMainThread()
 {
+	//nothing to stall
+	if (s_renderCore.headless)
+	{
+		return;
+	}
+
+	Mutex_Lock(&s_renderCore.main_thread_mutex);
+
 	s_renderCore.stall_main_thread = true;
 
-	WaitForSingleObject(s_renderCore.main_thread_standby_event, INFINITE);
+	while (!s_renderCore.main_thread_standby)
+	{
+		CondVar_Wait(&s_renderCore.main_thread_cv, &s_renderCore.main_thread_mutex);
+	}
+
+	Mutex_Unlock(&s_renderCore.main_thread_mutex);
 }
 
 static void Render_ResumeMainThread()
 {
+	Mutex_Lock(&s_renderCore.main_thread_mutex);
+
 	s_renderCore.stall_main_thread = false;
-	WakeConditionVariable(&s_renderCore.main_thread_cv);
+	CondVar_Broadcast(&s_renderCore.main_thread_cv);
 
-	WaitForSingleObject(s_renderCore.main_thread_active_event, INFINITE);
+	while (s_renderCore.main_thread_standby)
+	{
+		CondVar_Wait(&s_renderCore.main_thread_cv, &s_renderCore.main_thread_mutex);
+	}
+
+	Mutex_Unlock(&s_renderCore.main_thread_mutex);
 }
 
 static bool Render_CheckForRedraw(float x, float y, float dir_x, float dir_y, float plane_x, float plane_y)
@@ -379,24 +645,137 @@ static bool Render_CheckForRedraw(float x, float y, float dir_x, float dir_y, fl
 	return false;
 }
 
-static void Render_SetThreadsStartAndEnd(int width)
+static bool Render_SetupBands(int width)
 {
-	float num_threads = NUM_RENDER_THREADS;
-	int slice = ceil((float)width / num_threads);
+	RenderPool* pool = &s_renderCore.pool;
 
-	int x_start = 0;
-	int x_end = slice;
+	int num_bands = (width + RENDER_BAND_WIDTH - 1) / RENDER_BAND_WIDTH;
 
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
+	if (pool->bands)
 	{
-		RenderThread* thr = &s_renderCore.threads[i];
+		free(pool->bands);
+	}
 
-		thr->x_start = x_start;
-		thr->x_end = x_end;
+	pool->num_bands = 0;
+	pool->bands = malloc(sizeof(RenderBand) * num_bands);
 
-		x_start = x_end;
-		x_end += slice;
+	if (!pool->bands)
+	{
+		return false;
 	}
+
+	for (int i = 0; i < num_bands; i++)
+	{
+		RenderBand* band = &pool->bands[i];
+
+		band->x_start = i * RENDER_BAND_WIDTH;
+		band->x_end = min(band->x_start + RENDER_BAND_WIDTH, width);
+		band->first_sprite = 0;
+		band->num_sprites = 0;
+		band->cost = 0;
+	}
+
+	pool->num_bands = num_bands;
+
+	return true;
+}
+
+static bool Render_CreateWorldBuffer(int width, int height, int channels)
+{
+	if (s_renderCore.world_buffer.data)
+	{
+		Image_Destruct(&s_renderCore.world_buffer);
+	}
+
+	if (!Image_Create(&s_renderCore.world_buffer, width, height, channels))
+	{
+		return false;
+	}
+
+	s_renderCore.world_buffer.column_major = true;
+
+	return true;
+}
+
+static int Render_GetDesiredThreadCount()
+{
+	int count = s_renderCore.thread_count_override;
+
+	if (count <= 0)
+	{
+		count = Sys_GetNumCores();
+	}
+
+	if (count < 1)
+	{
+		count = 1;
+	}
+	else if (count > MAX_RENDER_THREADS)
+	{
+		count = MAX_RENDER_THREADS;
+	}
+
+	return count;
+}
+
+static bool Render_StartThreads(int num_threads)
+{
+	RenderPool* pool = &s_renderCore.pool;
+
+	Atomic_Store(&pool->shutdown, 0);
+	Atomic_Store(&pool->pending, 0);
+
+	pool->num_threads = 0;
+
+	for (int i = 0; i < num_threads; i++)
+	{
+		RenderThread* thr = &pool->threads[i];
+
+		memset(thr, 0, sizeof(RenderThread));
+		thr->index = i;
+		thr->seen_generation = Atomic_Load(&pool->generation);
+
+		if (!Thread_Create(&thr->thread, Render_ThreadLoop, thr))
+		{
+			printf("Failed to create render thread %i\n", i);
+			break;
+		}
+
+		pool->num_threads++;
+	}
+
+	//the dispatching thread uses the slot after the workers
+	RenderThread* dispatcher = &pool->threads[pool->num_threads];
+
+	memset(dispatcher, 0, sizeof(RenderThread));
+	dispatcher->index = pool->num_threads;
+
+	s_renderCore.stats.num_threads = pool->num_threads;
+
+	return pool->num_threads > 0;
+}
+
+static void Render_StopThreads()
+{
+	RenderPool* pool = &s_renderCore.pool;
+
+	Mutex_Lock(&pool->job_mutex);
+
+	//this will exit the thread loops
+	Mutex_Lock(&pool->mutex);
+	Atomic_Store(&pool->shutdown, 1);
+	Atomic_Add(&pool->generation, 1);
+	CondVar_Broadcast(&pool->wake_cv);
+	Mutex_Unlock(&pool->mutex);
+
+	for (int i = 0; i < pool->num_threads; i++)
+	{
+		Thread_Join(&pool->threads[i].thread);
+	}
+
+	pool->num_threads = 0;
+
+	Mutex_Unlock(&pool->job_mutex);
 }
 
 static bool Render_SetupGL(int width, int height)
@@ -407,7 +786,7 @@ static bool Render_SetupGL(int width, int height)
 	{
 		GLuint vertex_id, frag_id;
 		vertex_id = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex_id, 1, &VERTEX_SHADER_SOURCE, NULL);
+		glShaderSource(vertex_id, 1, VERTEX_SHADER_SOURCE, NULL);
 		glCompileShader(vertex_id);
 
 		if (!Shader_checkCompileErrors(vertex_id, "Vertex"))
@@ -415,7 +794,7 @@ static bool Render_SetupGL(int width, int height)
 			return false;
 		}
 		frag_id = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(frag_id, 1, &FRAGMENT_SHADER_SOURCE, NULL);
+		glShaderSource(frag_id, 1, FRAGMENT_SHADER_SOURCE, NULL);
 		glCompileShader(frag_id);
 
 		if (!Shader_checkCompileErrors(frag_id, "Fragment"))
@@ -505,7 +884,7 @@ bool Render_Init(int width, int height)
 
 	if (!Render_SetupGL(width, height))
 	{
-		return;
+		return false;
 	}
 
 	if (!Text_LoadFont("assets/font/font.json", "assets/font/font.png", &s_renderCore.font_data))
@@ -517,31 +896,33 @@ bool Render_Init(int width, int height)
 	{
 		return false;
 	}
+	if (!Render_CreateWorldBuffer(width, height, 4))
+	{
+		return false;
+	}
 
 	glfwMakeContextCurrent(NULL);
 
 	s_renderCore.win_w = width;
 	s_renderCore.win_h = height;
 
-	DWORD render_thread_id = 0;
-	s_renderCore.main_thread_handle = CreateThread(NULL, 0, Render_MainThreadLoop, NULL, 0, &render_thread_id);
+	Mutex_Init(&s_renderCore.object_mutex);
+	Mutex_Init(&s_renderCore.main_thread_mutex);
+	CondVar_Init(&s_renderCore.main_thread_cv);
 
-	InitializeCriticalSection(&s_renderCore.object_mutex);
-	InitializeCriticalSection(&s_renderCore.main_thread_mutex);
-	InitializeConditionVariable(&s_renderCore.main_thread_cv);
-	s_renderCore.main_thread_active_event = CreateEvent(NULL, TRUE, FALSE, NULL);
-	s_renderCore.main_thread_standby_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	Mutex_Init(&s_renderCore.pool.job_mutex);
+	Mutex_Init(&s_renderCore.pool.mutex);
+	CondVar_Init(&s_renderCore.pool.wake_cv);
+	CondVar_Init(&s_renderCore.pool.done_cv);
 
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
+	if (!Render_StartThreads(Render_GetDesiredThreadCount()))
 	{
-		RenderThread* thr = &s_renderCore.threads[i];
-
-		InitializeCriticalSection(&thr->mutex);
-		thr->start_work_event = CreateEvent(NULL, TRUE, FALSE, NULL);
-		thr->finished_work_event = CreateEvent(NULL, TRUE, FALSE, NULL);
-		thr->active_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		return false;
+	}
 
-		thr->thread_handle = CreateThread(NULL, 0, Render_ThreadLoop, thr, 0, &render_thread_id);
+	if (!Thread_Create(&s_renderCore.main_thread, Render_MainThreadLoop, NULL))
+	{
+		return false;
 	}
 
 	Render_ResizeWindow(width, height);
@@ -549,72 +930,102 @@ bool Render_Init(int width, int height)
 	return true;
 }
 
-void Render_ShutDown()
+bool Render_InitHeadless(int width, int height)
 {
-	//wait for main thread to exit
-	s_renderCore.main_thread_shutdown = true;
-	WaitForSingleObject(s_renderCore.main_thread_handle, INFINITE);
-	CloseHandle(s_renderCore.main_thread_handle);
+	memset(&s_renderCore, 0, sizeof(RenderCore));
 
-	//shut down render threads
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
+	s_renderCore.headless = true;
+
+	Video_Setup();
+
+	if (!Text_LoadFont("assets/font/font.json", "assets/font/font.png", &s_renderCore.font_data))
 	{
-		RenderThread* thr = &s_renderCore.threads[i];
+		return false;
+	}
 
-		//this will exit the thread loop
-		thr->shutdown = true;
-		SetEvent(thr->start_work_event);
+	if (!Image_Create(&s_renderCore.framebuffer, width, height, 4))
+	{
+		return false;
+	}
+	if (!Render_CreateWorldBuffer(width, height, 4))
+	{
+		return false;
+	}
+
+	s_renderCore.win_w = width;
+	s_renderCore.win_h = height;
+
+	Mutex_Init(&s_renderCore.object_mutex);
+	Mutex_Init(&s_renderCore.main_thread_mutex);
+	CondVar_Init(&s_renderCore.main_thread_cv);
 
-		WaitForSingleObject(thr->thread_handle, INFINITE);
+	Mutex_Init(&s_renderCore.pool.job_mutex);
+	Mutex_Init(&s_renderCore.pool.mutex);
+	CondVar_Init(&s_renderCore.pool.wake_cv);
+	CondVar_Init(&s_renderCore.pool.done_cv);
 
-		DeleteCriticalSection(&thr->mutex);
-		CloseHandle(thr->thread_handle);
-		CloseHandle(thr->active_event);
-		CloseHandle(thr->finished_work_event);
-		CloseHandle(thr->start_work_event);
+	if (!Render_StartThreads(Render_GetDesiredThreadCount()))
+	{
+		return false;
 	}
 
-	DeleteCriticalSection(&s_renderCore.main_thread_mutex);
-	DeleteCriticalSection(&s_renderCore.object_mutex);
-	CloseHandle(s_renderCore.main_thread_active_event);
-	CloseHandle(s_renderCore.main_thread_standby_event);
+	Render_ResizeWindow(width, height);
+
+	return true;
+}
+
+void Render_ShutDown()
+{
+	//wait for main thread to exit
+	if (!s_renderCore.headless)
+	{
+		s_renderCore.main_thread_shutdown = true;
+		Thread_Join(&s_renderCore.main_thread);
+	}
+
+	//shut down render threads
+	Render_StopThreads();
+
+	Mutex_Destroy(&s_renderCore.pool.job_mutex);
+	Mutex_Destroy(&s_renderCore.pool.mutex);
+	CondVar_Destroy(&s_renderCore.pool.wake_cv);
+	CondVar_Destroy(&s_renderCore.pool.done_cv);
+
+	Mutex_Destroy(&s_renderCore.main_thread_mutex);
+	Mutex_Destroy(&s_renderCore.object_mutex);
+	CondVar_Destroy(&s_renderCore.main_thread_cv);
 
 	Image_Destruct(&s_renderCore.framebuffer);
+	Image_Destruct(&s_renderCore.world_buffer);
 	Image_Destruct(&s_renderCore.font_data.font_image);
 
 	free(s_renderCore.depth_buffer);
 	free(s_renderCore.draw_spans);
+	free(s_renderCore.pool.bands);
+	free(s_renderCore.band_sprite_indices);
+
+	Video_DestroyRayTable(&s_renderCore.ray_table);
 }
 
 
 void Render_LockThreadsMutex()
 {
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
-	{
-		RenderThread* thr = &s_renderCore.threads[i];
-
-		Render_ThreadMutexLock(thr);
-	}
+	Mutex_Lock(&s_renderCore.pool.job_mutex);
 }
 
 void Render_UnlockThreadsMutex()
 {
-	for (int i = 0; i < NUM_RENDER_THREADS; i++)
-	{
-		RenderThread* thr = &s_renderCore.threads[i];
-
-		Render_ThreadMutexUnlock(thr);
-	}
+	Mutex_Unlock(&s_renderCore.pool.job_mutex);
 }
 
 void Render_LockObjectMutex()
 {
-	EnterCriticalSection(&s_renderCore.object_mutex);
+	Mutex_Lock(&s_renderCore.object_mutex);
 }
 
 void Render_UnlockObjectMutex()
 {
-	LeaveCriticalSection(&s_renderCore.object_mutex);
+	Mutex_Unlock(&s_renderCore.object_mutex);
 }
 
 void Render_FinishAndStall()
@@ -635,6 +1046,99 @@ void Render_Resume()
 	Render_ResumeMainThread();
 }
 
+/*
+	Runs fun over [0, count) on the render threads, batch items at a time, and returns when all are done.
+	The threads are shared with the renderer, so this waits for a frame job that is in flight to finish first.
+	The calling thread works too, with no threads everything runs on it.
+*/
+void Render_ParallelFor(int count, int batch, ParallelForFun fun, void* data)
+{
+	RenderPool* pool = &s_renderCore.pool;
+
+	if (count <= 0)
+	{
+		return;
+	}
+	if (batch < 1)
+	{
+		batch = 1;
+	}
+
+	if (pool->num_threads <= 0 || count <= batch)
+	{
+		fun(0, count, data);
+		return;
+	}
+
+	//the workers only read these in a parallel for job, and the dispatch publishes them
+	pool->for_fun = fun;
+	pool->for_data = data;
+	pool->for_count = count;
+	pool->for_batch = batch;
+	Atomic_Store(&pool->for_next, 0);
+
+	Render_DispatchWork(TWT__PARALLEL_FOR);
+}
+
+void Render_SetThreadCount(int count)
+{
+	if (count < 0)
+	{
+		count = 0;
+	}
+
+	s_renderCore.thread_count_override = count;
+
+	int desired = Render_GetDesiredThreadCount();
+
+	if (desired == s_renderCore.pool.num_threads)
+	{
+		return;
+	}
+
+	Render_FinishAndStall();
+
+	Render_StopThreads();
+	Render_StartThreads(desired);
+
+	Render_Resume();
+}
+
+int Render_GetThreadCount()
+{
+	return s_renderCore.thread_count_override;
+}
+
+Image* Render_GetFramebuffer()
+{
+	return &s_renderCore.framebuffer;
+}
+
+const RenderStats* Render_GetStats()
+{
+	return &s_renderCore.stats;
+}
+
+void Render_SetShowStats(bool show)
+{
+	s_renderCore.draw_stats = show;
+}
+
+bool Render_GetShowStats()
+{
+	return s_renderCore.draw_stats;
+}
+
+void Render_SetPaletteMode(bool enable)
+{
+	s_renderCore.use_palette = enable;
+}
+
+bool Render_GetPaletteMode()
+{
+	return s_renderCore.use_palette;
+}
+
 void Render_AddSpriteToQueue(Sprite* sprite)
 {
 	if (s_renderCore.num_draw_sprites >= MAX_DRAWSPRITES)
@@ -674,9 +1178,9 @@ void Render_RedrawSprites()
 void Render_ResizeWindow(int width, int height)
 {
 	Render_FinishAndStall();
-	Render_SetThreadsStartAndEnd(width);
 
 	Image_Resize(&s_renderCore.framebuffer, width, height);
+	Image_Resize(&s_renderCore.world_buffer, width, height);
 
 	if (s_renderCore.depth_buffer)
 	{
@@ -706,9 +1210,16 @@ void Render_ResizeWindow(int width, int height)
 
 	memset(s_renderCore.draw_spans, 0, sizeof(DrawSpan) * width);
 
+	if (!Video_CreateRayTable(&s_renderCore.ray_table, width))
+	{
+		return;
+	}
+
 	s_renderCore.w = width;
 	s_renderCore.h = height;
 
+	Render_SetupBands(width);
+
 	Render_RedrawSprites();
 	Render_RedrawWalls();
 
@@ -717,11 +1228,119 @@ void Render_ResizeWindow(int width, int height)
 	Render_Resume();
 }
 
+/*
+	Opaque sprites are drawn front to back, the depth test then rejects the pixels behind them before their texels
+	are read. Translucent sprites blend with what is under them, so they come last and back to front.
+	Sprites at the same depth keep their queue order, the first one drawn wins the depth test like before.
+*/
+static int CompareSpriteDepths(const void* a, const void* b)
+{
+	int index_a = *(const int*)a;
+	int index_b = *(const int*)b;
+
+	const Sprite* sprite_a = s_renderCore.draw_sprites[index_a];
+	const Sprite* sprite_b = s_renderCore.draw_sprites[index_b];
+
+	bool translucent_a = sprite_a->transparency > 0;
+	bool translucent_b = sprite_b->transparency > 0;
+
+	if (translucent_a != translucent_b)
+	{
+		return (translucent_a) ? 1 : -1;
+	}
+
+	float depth_a = sprite_a->r_transform_y;
+	float depth_b = sprite_b->r_transform_y;
+
+	if (depth_a != depth_b)
+	{
+		return ((depth_a < depth_b) != translucent_a) ? -1 : 1;
+	}
+
+	return index_a - index_b;
+}
+
+/*
+	Every band gets the sorted sprites that reach into it, so a thread only walks the sprites of its own band.
+	The bins are filled in draw order, a count pass sizes them first.
+*/
+static void Render_BinSprites()
+{
+	RenderPool* pool = &s_renderCore.pool;
+
+	for (int i = 0; i < pool->num_bands; i++)
+	{
+		pool->bands[i].num_sprites = 0;
+	}
+
+	int total = 0;
+
+	for (int i = 0; i < s_renderCore.num_sorted_draw_sprites; i++)
+	{
+		const Sprite* sprite = s_renderCore.draw_sprites[s_renderCore.sorted_draw_sprite_indices[i]];
+
+		int first_band = sprite->r_draw_start_x / RENDER_BAND_WIDTH;
+		int last_band = min((sprite->r_draw_end_x - 1) / RENDER_BAND_WIDTH, pool->num_bands - 1);
+
+		for (int band = first_band; band <= last_band; band++)
+		{
+			pool->bands[band].num_sprites++;
+		}
+
+		total += max(last_band - first_band + 1, 0);
+	}
+
+	if (total > s_renderCore.band_sprite_capacity)
+	{
+		int* indices = realloc(s_renderCore.band_sprite_indices, sizeof(int) * total);
+
+		if (!indices)
+		{
+			for (int i = 0; i < pool->num_bands; i++)
+			{
+				pool->bands[i].num_sprites = 0;
+			}
+			return;
+		}
+
+		s_renderCore.band_sprite_indices = indices;
+		s_renderCore.band_sprite_capacity = total;
+	}
+
+	int first_sprite = 0;
+
+	for (int i = 0; i < pool->num_bands; i++)
+	{
+		pool->bands[i].first_sprite = first_sprite;
+		first_sprite += pool->bands[i].num_sprites;
+
+		pool->bands[i].num_sprites = 0;
+	}
+
+	for (int i = 0; i < s_renderCore.num_sorted_draw_sprites; i++)
+	{
+		int sprite_index = s_renderCore.sorted_draw_sprite_indices[i];
+		const Sprite* sprite = s_renderCore.draw_sprites[sprite_index];
+
+		int first_band = sprite->r_draw_start_x / RENDER_BAND_WIDTH;
+		int last_band = min((sprite->r_draw_end_x - 1) / RENDER_BAND_WIDTH, pool->num_bands - 1);
+
+		for (int band = first_band; band <= last_band; band++)
+		{
+			RenderBand* bin = &pool->bands[band];
+
+			s_renderCore.band_sprite_indices[bin->first_sprite + bin->num_sprites++] = sprite_index;
+		}
+	}
+}
+
 void Render_View(float x, float y, float dir_x, float dir_y, float plane_x, float plane_y)
 {
-	GameAssets* assets = Game_GetAssets();
 	GameState game_state = Game_GetState();
 
+	double frame_start = Sys_GetTime();
+	double world_time = 0;
+
 	//store view information
 	s_renderCore.view_x = x;
 	s_renderCore.view_y = y;
@@ -730,14 +1349,22 @@ void Render_View(float x, float y, float dir_x, float dir_y, float plane_x, floa
 	s_renderCore.plane_x = plane_x;
 	s_renderCore.plane_y = plane_y;
 
-	//clear image to black
-	Image_Clear(&s_renderCore.framebuffer, 0);
-
 	if (game_state == GS__LEVEL)
 	{
+		//switch the world buffer between rgba and palette indices
+		int world_channels = (s_renderCore.use_palette && Video_HasPalette()) ? 1 : 4;
+
+		if (s_renderCore.world_buffer.numChannels != world_channels)
+		{
+			Render_CreateWorldBuffer(s_renderCore.w, s_renderCore.h, world_channels);
+		}
+
+		//clear image to black, the transpose fills the whole framebuffer
+		Image_Clear(&s_renderCore.world_buffer, 0);
+
 		Render_LockObjectMutex();
 
-		Game_Draw(&s_renderCore.framebuffer, &s_renderCore.font_data, s_renderCore.depth_buffer, s_renderCore.draw_spans, x, y, dir_x, dir_y, plane_x, plane_y);
+		Game_Draw(&s_renderCore.world_buffer, &s_renderCore.font_data, s_renderCore.depth_buffer, s_renderCore.draw_spans, x, y, dir_x, dir_y, plane_x, plane_y);
 
 		//setup world draw sprites
 		int index = 0;
@@ -746,7 +1373,7 @@ void Render_View(float x, float y, float dir_x, float dir_y, float plane_x, floa
 		{
 			Sprite* sprite = s_renderCore.draw_sprites[i];
 
-			if (Video_SpriteSetup(&s_renderCore.framebuffer, sprite, s_renderCore.depth_buffer, x, y, dir_x, dir_y, plane_x, plane_y))
+			if (Video_SpriteSetup(&s_renderCore.world_buffer, sprite, s_renderCore.depth_buffer, x, y, dir_x, dir_y, plane_x, plane_y))
 			{
 				s_renderCore.sorted_draw_sprite_indices[index++] = i;
 			}
@@ -754,37 +1381,57 @@ void Render_View(float x, float y, float dir_x, float dir_y, float plane_x, floa
 
 		s_renderCore.num_sorted_draw_sprites = index;
 
+		qsort(s_renderCore.sorted_draw_sprite_indices, index, sizeof(int), CompareSpriteDepths);
+
+		Render_BinSprites();
+
 		//clear wall depth buffer
 		memset(s_renderCore.depth_buffer, (int)DEPTH_CLEAR, sizeof(float) * s_renderCore.w * s_renderCore.h);
 
-		//set work state for all thread
-		Render_SetWorkStateForAllThreads(TWT__DRAW_LEVEL);
+		//draw the world on all threads and wait for it to finish
+		double world_start = Sys_GetTime();
+
+		Render_DispatchWork(TWT__DRAW_LEVEL);
 
-		//wait for it to finish
-		Render_WaitForAllThreads();
+		world_time = Sys_GetTime() - world_start;
+
+		Render_UpdateLoadStats();
 
 		Render_UnlockObjectMutex();
 
+		Render_DispatchWork(TWT__TRANSPOSE);
+
 		Game_DrawHud(&s_renderCore.framebuffer, &s_renderCore.font_data);
 	}
 	else
 	{
+		//clear image to black
+		Image_Clear(&s_renderCore.framebuffer, 0);
+
 		Game_Draw(&s_renderCore.framebuffer, &s_renderCore.font_data, s_renderCore.depth_buffer, s_renderCore.draw_spans, x, y, dir_x, dir_y, plane_x, plane_y);
 	}
 	if (s_renderCore.fullscreen_shader_fun)
 	{
-		Render_WaitForAllThreads();
-
-		Render_SetWorkStateForAllThreads(TWT__SHADER);
+		Render_DispatchWork(TWT__SHADER);
+	}
 
-		Render_WaitForAllThreads();
+	if (s_renderCore.draw_stats)
+	{
+		Text_Draw(&s_renderCore.framebuffer, &s_renderCore.font_data, 0.01, 0.01, 0.5, 0.5, "FRAME %.2f MS WORLD %.2f MS THREADS %i", s_renderCore.stats.frame_ms, s_renderCore.stats.world_ms, s_renderCore.stats.num_threads);
+		Text_Draw(&s_renderCore.framebuffer, &s_renderCore.font_data, 0.01, 0.05, 0.5, 0.5, "IMBALANCE %.2f MAX BAND %.2f MS STEALS %i", s_renderCore.stats.imbalance, s_renderCore.stats.max_band_ms, s_renderCore.stats.num_steals);
 	}
 
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s_renderCore.w, s_renderCore.h, GL_RGBA, GL_UNSIGNED_BYTE, s_renderCore.framebuffer.data);
+	if (!s_renderCore.headless)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s_renderCore.w, s_renderCore.h, GL_RGBA, GL_UNSIGNED_BYTE, s_renderCore.framebuffer.data);
+
+		//render fullscreen quad
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	}
 
-	//render fullscreen quad
-	glClear(GL_COLOR_BUFFER_BIT);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	s_renderCore.stats.frame_ms = (Sys_GetTime() - frame_start) * 1000.0;
+	s_renderCore.stats.world_ms = world_time * 1000.0;
 
 	//reset stuff
 	s_renderCore.num_draw_sprites = 0;
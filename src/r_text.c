@@ -27,7 +27,7 @@ bool Text_LoadFont(const char* filename, const char* image_path, FontData* font_
 	}
 
 	//we can free the raw char data
-	free(filestr);
+	free((void*)filestr);
 	filestr = NULL;
 
 	font_data->atlas_data.distance_range = 2;
@@ -191,7 +191,7 @@ bool Text_LoadFont(const char* filename, const char* image_path, FontData* font_
 	return Image_CreateFromPath(&font_data->font_image, image_path);
 }
 
-FontGlyphData* FontData_GetGlyphData(const FontData* font_data, char ch)
+const FontGlyphData* FontData_GetGlyphData(const FontData* font_data, char ch)
 {
 	//glyphs start with unicode 32 and so that means that 0 index of the array is 32
 	//so we subtract the unicode of the char with 32 to get the index of our array
@@ -9,6 +9,8 @@
 
 static const float PI = 3.14159265359;
 static unsigned char LIGHT_LUT[256][256];
+static bool s_useMipmaps = true;
+static bool s_useSpriteOcclusion = true;
 
 static void SWAP_INT(int* a, int* b)
 {
@@ -25,16 +27,26 @@ void Video_Setup()
 	{
 		for (int k = 0; k < 256; k++)
 		{
-			float light = (float)k / 255.0f;
-			
-			int l = (float)i * light;
-
-			if (l < 0) l = 0;
-			else if (l > 255) l = 255;
-
-			LIGHT_LUT[i][k] = (unsigned char)l;		
+			LIGHT_LUT[i][k] = Video_Light(i, k);
 		}
 	}
+
+	Video_SetupColumnKernels();
+}
+
+void Video_SetMipmaps(bool enable)
+{
+	s_useMipmaps = enable;
+}
+
+bool Video_GetMipmaps()
+{
+	return s_useMipmaps;
+}
+
+void Video_SetSpriteOcclusion(bool enable)
+{
+	s_useSpriteOcclusion = enable;
 }
 
 void Video_DrawLine(Image* image, int x0, int y0, int x1, int y1, unsigned char* color)
@@ -111,8 +123,70 @@ void Video_DrawRectangle(Image* image, int p_x, int p_y, int p_w, int p_h, unsig
 	}
 }
 
-static void Video_DrawFloor2(Image* image, Image* texture, float* depth_buffer, DrawSpan* draw_spans, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
+/*
+	Floors and ceilings are drawn row by row. Every row of the floor has a constant distance, so the map position
+	steps by a constant amount per pixel. The position is kept in 16.16 fixed point map units, so the tile is the
+	integer part and the texel is the top bits of the fraction. Tile and texture column are only looked up
+	when the tile changes. The lightmap is sampled about once per lightmap cell along the row and the light is
+	stepped linearly between the samples. Pixels already covered by walls or doors keep their depth and are skipped.
+*/
+#define FLOOR_FRAC_BITS 16
+#define FLOOR_TEXEL_SHIFT (FLOOR_FRAC_BITS - 6) //TILE_SIZE is 64
+
+//the lightmap cell is the bits of the fraction below the tile and the next 8 bits blend its corner samples
+#define FLOOR_LIGHT_CELL_SHIFT (FLOOR_FRAC_BITS - LIGHTMAP_SHIFT)
+#define FLOOR_LIGHT_WEIGHT_SHIFT (FLOOR_LIGHT_CELL_SHIFT - 8)
+#define FLOOR_LIGHT_MIN_SPAN 8
+#define FLOOR_LIGHT_MAX_SPAN 32
+
+static inline int Video_SampleFloorLight(const LightTile* light_tile, int32_t fx, int32_t fy)
 {
+	int cell_x = (fx >> FLOOR_LIGHT_CELL_SHIFT) & (LIGHTMAP_CELLS - 1);
+	int cell_y = (fy >> FLOOR_LIGHT_CELL_SHIFT) & (LIGHTMAP_CELLS - 1);
+	int weight_x = (fx >> FLOOR_LIGHT_WEIGHT_SHIFT) & 255;
+	int weight_y = (fy >> FLOOR_LIGHT_WEIGHT_SHIFT) & 255;
+
+	const uint8_t* samples = light_tile->floor + cell_x + cell_y * LIGHTMAP_SAMPLES;
+
+	int top = (samples[0] << 8) + (samples[1] - samples[0]) * weight_x;
+	int bottom = (samples[LIGHTMAP_SAMPLES] << 8) + (samples[LIGHTMAP_SAMPLES + 1] - samples[LIGHTMAP_SAMPLES]) * weight_x;
+
+	return ((top << 8) + (bottom - top) * weight_y) >> 16;
+}
+
+//temp lights are added to the sample, so they are blended as well
+static inline int Video_SampleMapLight(int32_t fx, int32_t fy)
+{
+	int tile_x = fx >> FLOOR_FRAC_BITS;
+	int tile_y = fy >> FLOOR_FRAC_BITS;
+
+	int light = Video_SampleFloorLight(Map_GetLightTile(tile_x, tile_y), fx, fy) + Map_GetTempLight(tile_x, tile_y);
+
+	return (light > 255) ? 255 : light;
+}
+
+//wall_x is where along the edge, from 0 to 1
+static inline int Video_SampleEdgeLight(const uint8_t* samples, int stride, float wall_x)
+{
+	int position = (int)(wall_x * (LIGHTMAP_CELLS << 8));
+
+	if (position < 0) position = 0;
+	else if (position > (LIGHTMAP_CELLS << 8) - 1) position = (LIGHTMAP_CELLS << 8) - 1;
+
+	samples += (position >> 8) * stride;
+
+	int weight = position & 255;
+
+	return ((samples[0] << 8) + (samples[stride] - samples[0]) * weight) >> 8;
+}
+
+static void Video_DrawFloorSpans(Image* image, Image* texture, float* depth_buffer, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
+{
+	if (x_start >= x_end)
+	{
+		return;
+	}
+
 	float ray_dirX0 = p_dirX - p_planeX;
 	float ray_dirY0 = p_dirY - p_planeY;
 	float ray_dirX1 = p_dirX + p_planeX;
@@ -123,6 +197,18 @@ static void Video_DrawFloor2(Image* image, Image* texture, float* depth_buffer,
 
 	float cam_z = 0.5 * image->height;
 
+	//palette indices when drawing into an 8 bit image
+	const bool indexed = (image->numChannels == 1);
+	const int bytes_per_pixel = image->numChannels;
+
+	const int x_stride = Image_XStride(image);
+	const int tex_channels = (indexed) ? 1 : texture->numChannels;
+
+	if (indexed && !texture->indices)
+	{
+		return;
+	}
+
 	for (int y = 0; y < image->height; ++y)
 	{
 		bool is_floor = y > image->half_height;
@@ -140,169 +226,124 @@ static void Video_DrawFloor2(Image* image, Image* texture, float* depth_buffer,
 		float floor_step_x = row_distance * (x_dir) / image->width;
 		float floor_step_y = row_distance * (y_dir) / image->width;
 
-		if (floor_step_x == 0 || floor_step_y == 0)
+		//texels per pixel along the row picks the mip level
+		int level = 0;
+
+		if (s_useMipmaps)
 		{
-			continue;
+			level = Image_SelectMipLevel(texture, max(fabsf(floor_step_x), fabsf(floor_step_y)) * TILE_SIZE);
 		}
 
-		float floor_x = p_x + row_distance * ray_dirX0;
-		float floor_y = p_y + row_distance * ray_dirY0;
+		Image* mip = Image_GetMipLevel(texture, level);
 
-		floor_x += (x_start * floor_step_x);
-		floor_y += (x_start * floor_step_y);
+		const unsigned char* tex_data = (indexed) ? mip->indices : mip->data;
 
-		for (int x = x_start; x < x_end; ++x)
+		if (!tex_data)
 		{
-			int tile_x = (int)(floor_x);
-			int tile_y = (int)(floor_y);
+			continue;
+		}
 
-			TileID tile = 0;
+		const int tex_x_stride = Image_XStride(mip);
+		const int tex_y_stride = Image_YStride(mip);
+		const int tex_last_x = mip->width - 1;
+		const int tex_size = TILE_SIZE >> level;
+		const int texel_shift = FLOOR_TEXEL_SHIFT + level;
 
-			if (is_floor)
-			{
-				tile = Map_GetFloorTile(tile_x, tile_y);
-			}
-			else
-			{
-				tile = Map_GetCeilTile(tile_x, tile_y);
-			}
+		float floor_x = p_x + row_distance * ray_dirX0 + x_start * floor_step_x;
+		float floor_y = p_y + row_distance * ray_dirY0 + x_start * floor_step_y;
 
-			LightTile* light_tile = Map_GetLightTile(tile_x, tile_y);
+		int32_t fx = (int32_t)(floor_x * (1 << FLOOR_FRAC_BITS));
+		int32_t fy = (int32_t)(floor_y * (1 << FLOOR_FRAC_BITS));
+		int32_t step_x = (int32_t)(floor_step_x * (1 << FLOOR_FRAC_BITS));
+		int32_t step_y = (int32_t)(floor_step_y * (1 << FLOOR_FRAC_BITS));
 
-			int light = light_tile->light;
+		int pixel = Image_PixelIndex(image, x_start, y);
 
-			light += light_tile->temp_light;
+		//force a lookup on the first pixel
+		int tile_x = (fx >> FLOOR_FRAC_BITS) + 1;
+		int tile_y = 0;
+		int tile_column = 0;
+		int light = -1;
+		const unsigned char* colormap = NULL;
 
-			if (light > 255) light = 255;
+		//the lightmap is sampled about once per lightmap cell and stepped linearly in between
+		float cell_pixels = 1.0f / (max(fabsf(floor_step_x), fabsf(floor_step_y)) * LIGHTMAP_CELLS);
+		int light_span = (cell_pixels > FLOOR_LIGHT_MAX_SPAN) ? FLOOR_LIGHT_MAX_SPAN : (cell_pixels < FLOOR_LIGHT_MIN_SPAN) ? FLOOR_LIGHT_MIN_SPAN : (int)cell_pixels;
 
-			// get the texture coordinate from the fractional part
-			int tx = (int)(TILE_SIZE * (floor_x - tile_x)) & (TILE_SIZE - 1);
-			int ty = (int)(TILE_SIZE * (floor_y - tile_y)) & (TILE_SIZE - 1);
+		int32_t next_light_fixed = Video_SampleMapLight(fx, fy) << 16;
 
-			unsigned char* sample = Image_Get(texture, tx + (TILE_SIZE * (tile - 1)), ty);
-			unsigned char color[4] = { LIGHT_LUT[sample[0]][light], LIGHT_LUT[sample[1]][light], LIGHT_LUT[sample[2]][light], 255 };
+		for (int x = x_start; x < x_end;)
+		{
+			int span_end = min(x + light_span, x_end);
+			int count = span_end - x;
 
-			float local_x_pos = floor_x;
-			float local_y_pos = floor_y;
-			int local_tx = tx;
-			int local_ty = ty;
+			int32_t light_fixed = next_light_fixed;
+			next_light_fixed = Video_SampleMapLight(fx + step_x * count, fy + step_y * count) << 16;
 
-			int x_steps = 0;
+			int32_t light_step = (next_light_fixed - light_fixed) / count;
 
-			while (local_tx == tx && local_ty == ty && (x + x_steps) < x_end)
+			for (; x < span_end; x++, pixel += x_stride, fx += step_x, fy += step_y, light_fixed += light_step)
 			{
-				float depth = depth_buffer[(x + x_steps) + y * image->width];
-
 				//depth is set by other tile
-				if (depth < (int)DEPTH_CLEAR)
+				if (depth_buffer[pixel] < DEPTH_CLEAR)
 				{
-					break;
+					continue;
 				}
 
-				Image_Set2(image, x + x_steps, y, color);
-				//depth_buffer[(x + x_steps) + y * image->width] = row_distance;
+				int current_tile_x = fx >> FLOOR_FRAC_BITS;
+				int current_tile_y = fy >> FLOOR_FRAC_BITS;
 
-				local_x_pos += floor_step_x;
-				local_y_pos += floor_step_y;
-				local_tx = (int)(TILE_SIZE * (local_x_pos - (int)local_x_pos)) & (TILE_SIZE - 1);
-				local_ty = (int)(TILE_SIZE * (local_y_pos - (int)local_y_pos)) & (TILE_SIZE - 1);
-				x_steps++;
-			}
+				if (current_tile_x != tile_x || current_tile_y != tile_y)
+				{
+					tile_x = current_tile_x;
+					tile_y = current_tile_y;
 
-			if (x_steps == 0)
-			{
-				x_steps = 1;
-			}
+					TileID tile = (is_floor) ? Map_GetFloorTile(tile_x, tile_y) : Map_GetCeilTile(tile_x, tile_y);
 
-			x += x_steps - 1;
+					tile_column = tex_size * (tile - 1);
+				}
 
-			floor_x += (x_steps * floor_step_x);
-			floor_y += (x_steps * floor_step_y);
-		}
-	}
-}
+				int tx = (fx >> texel_shift) & (tex_size - 1);
+				int ty = (fy >> texel_shift) & (tex_size - 1);
 
-void Video_RaycastFloorCeilling(Image* image, Image* texture, float* depth_buffer, int x, int spans, int draw_start, int draw_end, float floor_x, float floor_y, float wall_dist, float p_x, float p_y, int doors_drawn, bool is_floor)
-{
-	//adapted from https://lodev.org/cgtutor/raycasting2.html
+				int column = tile_column + tx;
 
-	int height = image->half_height;
-	int h0 = image->height + 2;
-	int h1 = image->height - 2;
+				if (column < 0) column = 0;
+				else if (column > tex_last_x) column = tex_last_x;
 
-	int y = (is_floor) ? draw_end + 2 : 0;
-	int end = (is_floor) ? image->height : draw_start;
+				const unsigned char* sample = tex_data + (column * tex_x_stride + ty * tex_y_stride) * tex_channels;
+				unsigned char* dst = image->data + pixel * bytes_per_pixel;
 
-	bool cheap = true;
+				if (indexed)
+				{
+					//neighbouring pixels mostly share a light level
+					if ((light_fixed >> 16) != light)
+					{
+						light = light_fixed >> 16;
+						colormap = Video_GetColormap(light);
+					}
 
-	for (y; y < end; y++)
-	{
-		float depth = depth_buffer[x + y * image->width];
+					dst[0] = colormap[sample[0]];
+				}
+				else
+				{
+					light = light_fixed >> 16;
 
-		//depth is set by other tile
-		if (depth < (int)DEPTH_CLEAR)
-		{
-			if (is_floor)
-			{
-				continue;
-			}
-			else
-			{
-				break;
+					dst[0] = LIGHT_LUT[sample[0]][light];
+					dst[1] = LIGHT_LUT[sample[1]][light];
+					dst[2] = LIGHT_LUT[sample[2]][light];
+					dst[3] = 255;
+				}
 			}
 		}
-
-		float current_dist = 0;
-
-		if (is_floor)
-		{
-			current_dist = (h0) / (2.0 * (y) - image->height);
-		}
-		else
-		{
-			current_dist = (h1) / (image->height - 2.0 * (y));
-		}
-
-		float weight = (current_dist) / (wall_dist);
-
-		float current_floor_x = weight * floor_x + (1.0 - weight) * p_x;
-		float current_floor_y = weight * floor_y + (1.0 - weight) * p_y;
-
-		int floor_tile_x = (int)current_floor_x;
-		int floor_tile_y = (int)current_floor_y;
-
-		TileID tile = Map_GetFloorTile(floor_tile_x, floor_tile_y);
-
-		LightTile* light_tile = Map_GetLightTile(floor_tile_x, floor_tile_y);
-
-		int light = (int)light_tile->light + (int)light_tile->temp_light;
-
-		if (light > 255)
-		{
-			light = 255;
-		}
-
-		int tx = (int)(current_floor_x * 64) & (64 - 1);
-		int ty = (int)(current_floor_y * 64) & (64 - 1);
-
-		unsigned char* tile_color = Image_Get(texture, tx + (TILE_SIZE * (tile - 1)), ty);
-
-		unsigned char color[4] = { LIGHT_LUT[tile_color[0]][light], LIGHT_LUT[tile_color[1]][light], LIGHT_LUT[tile_color[2]][light], 255 };
-
-		for (int span = 0; span < spans; span++)
-		{
-			Image_Set2(image, x + span, y, color);
-		}
-		
 	}
-
 }
 
-static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer, DrawSpan* draw_spans, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY, bool draw_floor_ceilling, int* r_doors_drawn)
+static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer, DrawSpan* draw_spans, const RayTable* ray_table, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY, bool draw_floor_ceilling, int* r_doors_drawn)
 {
 	const int max_tiles = Map_GetTotalNonEmptyTiles();
 
-	const int map_width, map_height;
+	int map_width, map_height;
 	Map_GetSize(&map_width, &map_height);
 
 	int prev_side = -1;
@@ -313,6 +354,9 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 
 	bool expensive_lighting = true;
 
+	//ray directions and grid distances are set up for a batch of columns at a time
+	Ray rays[RAY_BATCH];
+
 	for (int x = x_start; x < x_end; x++)
 	{
 		DrawSpan* span = &draw_spans[x];
@@ -320,51 +364,36 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 		span->width = 0;
 		span->pointer_index = -1;
 
-		double cam_x = 2.0 * x / (double)image->width - 1.0;
+		int batch_index = (x - x_start) % RAY_BATCH;
+
+		if (batch_index == 0)
+		{
+			Video_SetupRays(ray_table, x, min(RAY_BATCH, x_end - x), p_x, p_y, p_dirX, p_dirY, p_planeX, p_planeY, rays);
+		}
+
+		const Ray* ray = &rays[batch_index];
+
+		float ray_dir_x = ray->dir_x;
+		float ray_dir_y = ray->dir_y;
 
-		//calc raydir
-		float ray_dir_x = p_dirX + p_planeX * cam_x;
-		float ray_dir_y = p_dirY + p_planeY * cam_x;
+		//16.16 length of ray from one x or y-side to next x or y-side
+		int32_t delta_dist_x = ray->delta_x;
+		int32_t delta_dist_y = ray->delta_y;
 
-		//length of ray from one x or y-side to next x or y-side
-		float delta_dist_x = (ray_dir_x == 0) ? 1e30 : fabs(1.0 / ray_dir_x);
-		float delta_dist_y = (ray_dir_y == 0) ? 1e30 : fabs(1.0 / ray_dir_y);
+		//16.16 length of ray from current position to next x or y-side
+		int32_t side_dist_x = ray->side_x;
+		int32_t side_dist_y = ray->side_y;
 
 		float wall_dist = 0;
 
-		int step_x = 0;
-		int step_y = 0;
+		int step_x = (ray_dir_x < 0) ? -1 : 1;
+		int step_y = (ray_dir_y < 0) ? -1 : 1;
 
 		int side = 0; //was a NS or a EW wall hit?
 
 		int map_x = (int)p_x;
 		int map_y = (int)p_y;
 
-		//length of ray from current position to next x or y-side
-		float side_dist_x;
-		float side_dist_y;
-
-		if (ray_dir_x < 0)
-		{
-			step_x = -1;
-			side_dist_x = (p_x - map_x) * delta_dist_x;
-		}
-		else
-		{
-			step_x = 1;
-			side_dist_x = (map_x + 1.0 - p_x) * delta_dist_x;
-		}
-		if (ray_dir_y < 0)
-		{
-			step_y = -1;
-			side_dist_y = (p_y - map_y) * delta_dist_y;
-		}
-		else
-		{
-			step_y = 1;
-			side_dist_y = (map_y + 1.0 - p_y) * delta_dist_y;
-		}
-
 		TileID tile = EMPTY_TILE;
 
 		//perform DDA
@@ -383,7 +412,8 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 				side = 1;
 			}
 
-			if ((map_x < 0 && map_y < 0) || (map_x >= map_width && map_y >= map_height))
+			//a ray that left the map never comes back
+			if (map_x < 0 || map_y < 0 || map_x >= map_width || map_y >= map_height)
 			{
 				break;
 			}
@@ -392,6 +422,8 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 
 			tile = Map_GetTile(map_x, map_y);
 
+			bool on_open_tile = (tile == EMPTY_TILE);
+
 			//no tile found?
 			if (tile == EMPTY_TILE)
 			{
@@ -450,11 +482,11 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 
 			if (side == 0)
 			{
-				wall_dist = (side_dist_x - delta_dist_x);
+				wall_dist = (side_dist_x - delta_dist_x) * (1.0f / (1 << RAY_FRAC_BITS));
 			}
 			else
 			{
-				wall_dist = (side_dist_y - delta_dist_y);
+				wall_dist = (side_dist_y - delta_dist_y) * (1.0f / (1 << RAY_FRAC_BITS));
 			}
 
 			//calculate value of wallX
@@ -538,40 +570,42 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 
 			if (light_tile)
 			{
-				span->light = light_tile->light;
+				LightFace face = LIGHT_FACE__WEST;
 
 				if (side == 0)
 				{
-					if (ray_dir_x < 0)
-					{
-						span->light = light_tile->light_east;
-					}
-					else
-					{
-						span->light = light_tile->light_west;
-					}
+					face = (ray_dir_x < 0) ? LIGHT_FACE__EAST : LIGHT_FACE__WEST;
 				}
-				else if (side == 1)
+				else
 				{
-					if (ray_dir_y < 0)
-					{
-						span->light = light_tile->light_south;
-					}
-					else
+					face = (ray_dir_y < 0) ? LIGHT_FACE__SOUTH : LIGHT_FACE__NORTH;
+				}
+
+				int l = 0;
+
+				//doors and switches stand on open tiles, those use the floor samples along the edge
+				if (on_open_tile)
+				{
+					switch (face)
 					{
-						span->light = light_tile->light_north;
+					case LIGHT_FACE__WEST: l = Video_SampleEdgeLight(light_tile->floor, LIGHTMAP_SAMPLES, wall_x); break;
+					case LIGHT_FACE__EAST: l = Video_SampleEdgeLight(light_tile->floor + LIGHTMAP_CELLS, LIGHTMAP_SAMPLES, wall_x); break;
+					case LIGHT_FACE__NORTH: l = Video_SampleEdgeLight(light_tile->floor, 1, wall_x); break;
+					default: l = Video_SampleEdgeLight(light_tile->floor + LIGHTMAP_CELLS * LIGHTMAP_SAMPLES, 1, wall_x); break;
 					}
 				}
+				else
+				{
+					l = Video_SampleEdgeLight(light_tile->faces[face], 1, wall_x);
+				}
 
-				int l = (int)span->light + (int)light_tile->temp_light;
+				l += Map_GetTempLight(map_x, map_y);
 				
 				if (l > 255) l = 255;
 
 				span->light = l;
 			}
 
-			
-
 			prev_side = side;
 			prev_tile = tile;
 			prev_tile_x = map_x;
@@ -600,7 +634,7 @@ static void Video_SetupSpans(Image* image, Image *texture, float* depth_buffer,
 }
 
 
-void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpan* draw_spans, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
+void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpan* draw_spans, const RayTable* ray_table, int x_start, int x_end, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
 {
 	int doors_drawn = 0;
 
@@ -608,10 +642,16 @@ void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpa
 
 	draw_floor_ceilling = true;
 
-	Video_SetupSpans(image, texture, depth_buffer, draw_spans,x_start, x_end, p_x, p_y, p_dirX, p_dirY, p_planeX, p_planeY, draw_floor_ceilling, &doors_drawn);
+	Video_SetupSpans(image, texture, depth_buffer, draw_spans, ray_table, x_start, x_end, p_x, p_y, p_dirX, p_dirY, p_planeX, p_planeY, draw_floor_ceilling, &doors_drawn);
 
 	int floors_drawn = 0;
 
+	for (int x = x_start; x < x_end; x++)
+	{
+		draw_spans[x].occluder_top = 0;
+		draw_spans[x].occluder_bottom = 0;
+	}
+
 	for (int x = x_start; x < x_end; x++)
 	{
 		DrawSpan* span = &draw_spans[x];
@@ -628,10 +668,20 @@ void Video_RaycastMap(Image* image, Image* texture, float* depth_buffer, DrawSpa
 		{
 			continue;
 		}
+
+		//the whole span is drawn with the depth of its first column
+		for (int i = 0; i < span->width; i++)
+		{
+			DrawSpan* covered = &draw_spans[x + i];
+
+			covered->occluder_dist = span->wall_dist;
+			covered->occluder_top = draw_start;
+			covered->occluder_bottom = draw_end;
+		}
 	
 		x += span->width - 1;
 	}
-	Video_DrawFloor2(image, texture, depth_buffer, draw_spans, x_start, x_end, p_x, p_y, p_dirX, p_dirY, p_planeX, p_planeY);
+	Video_DrawFloorSpans(image, texture, depth_buffer, x_start, x_end, p_x, p_y, p_dirX, p_dirY, p_planeX, p_planeY);
 }
 
 bool Video_DrawCollumn(Image* image, Image* texture, int x, float size, float* depth_buffer, int tex_x, float wall_dist, unsigned char light, int tile, int spans, int doors_drawn, int* r_draw_start, int* r_draw_end)
@@ -680,81 +730,84 @@ bool Video_DrawCollumn(Image* image, Image* texture, int x, float size, float* d
 	// Starting texture coordinate
 	float tex_pos = (draw_start - image->height / 2 + collumn_height / 2) * (step * size);
 
-	int i_tex_pos = (int)tex_pos;
+	//palette indices when drawing into an 8 bit image
+	const bool indexed = (image->numChannels == 1);
+	const int bytes_per_pixel = image->numChannels;
 
-	int tx = tex_x + (TILE_SIZE * (tile - 1));
+	//one mip level down for every doubling of texels per pixel
+	int level = (s_useMipmaps) ? Image_SelectMipLevel(texture, step) : 0;
 
-	//draw the vertical collumn
-	for (int y = draw_start; y < draw_end; y++)
+	texture = Image_GetMipLevel(texture, level);
+
+	if (indexed && !texture->indices)
 	{
-		float depth = depth_buffer[x + y * image->width];
+		return false;
+	}
 
-		//depth is set by other tile
-		if (depth < (int)DEPTH_CLEAR)
-		{
-			break;
-		}
+	int tx = (tex_x + (TILE_SIZE * (tile - 1))) >> level;
 
-		if (light > 0)
-		{
-			// Cast the texture coordinate to integer, and mask with (texHeight - 1) in case of overflow
-			int tex_y = i_tex_pos & (TILE_SIZE - 1);
-			tex_pos += step;
-			i_tex_pos = (int)tex_pos;
-
-			//get tile color
-			unsigned char* tile_color = Image_Get(texture, tx, tex_y);
-
-			unsigned char color[4] = { LIGHT_LUT[tile_color[0]][light], LIGHT_LUT[tile_color[1]][light], LIGHT_LUT[tile_color[2]][light], 255 };
-			
-			//try to draw as many pixels in a row as possible
-			float local_tex_pos = tex_pos;
-			
-			while (y < draw_end)
-			{
-				for (int span = 0; span < spans; span++)
-				{
-					int xs = x + span;
+	if (tx < 0) tx = 0;
+	else if (tx >= texture->width) tx = texture->width - 1;
 
-					Image_SetFast(image, xs, y, color);
-					depth_buffer[xs + y * image->width] = wall_dist;
-				}
+	const float level_scale = 1.0f / (1 << level);
 
-				local_tex_pos += step;
-				
-				if ((int)local_tex_pos != i_tex_pos)
-				{
-					break;
-				}
+	//draw the vertical collumn
+	ColumnDraw col;
+	col.dst = image->data + Image_PixelIndex(image, x, draw_start) * bytes_per_pixel;
+	col.depth = depth_buffer + Image_PixelIndex(image, x, draw_start);
+	col.stride = Image_YStride(image);
+	col.count = draw_end - draw_start;
+	col.tex_mask = (TILE_SIZE >> level) - 1;
+	col.v = (uint32_t)(int)(tex_pos * level_scale * 65536.0f);
+	col.v_step = (uint32_t)(int)(step * level_scale * 65536.0f);
+	col.light = light;
+	col.colormap = NULL;
+	col.wall_dist = wall_dist;
+
+	int drawn = 0;
+
+	if (indexed)
+	{
+		col.tex = texture->indices + Image_PixelIndex(texture, tx, 0);
+		col.tex_stride = Image_YStride(texture);
+		col.colormap = Video_GetColormap(light);
 
-				y++;
-			}
+		drawn = Video_DrawColumnIndexed(&col);
+	}
+	else
+	{
+		col.tex = texture->data + Image_PixelIndex(texture, tx, 0) * texture->numChannels;
+		col.tex_stride = Image_YStride(texture) * texture->numChannels;
 
-			tex_pos = local_tex_pos - step;
-			
-		}
-		else
+		//simd kernels load whole rgba texels
+		ColumnKernel kernel = (texture->numChannels == 4) ? Video_GetColumnKernel() : COLUMN_KERNEL__SCALAR;
+
+		drawn = Video_DrawColumnWith(kernel, &col);
+	}
+
+	//the rest of the span uses the same texels
+	if (spans > 1)
+	{
+		const int x_stride = Image_XStride(image);
+
+		for (int y = draw_start; y < draw_start + drawn; y++)
 		{
-			unsigned char color[4] = { 0, 0, 0, 255 };
+			int pixel = Image_PixelIndex(image, x, y);
 
-			while (y < draw_end)
-			{
-				for (int span = 0; span < spans; span++)
-				{
-					int xs = x + span;
+			unsigned char* src = image->data + pixel * bytes_per_pixel;
+			float* depth = depth_buffer + pixel;
 
-					Image_SetFast(image, xs, y, color);
-					depth_buffer[xs + y * image->width] = wall_dist;
-				}
-				
-				y++;
+			for (int span = 1; span < spans; span++)
+			{
+				memcpy(src + span * x_stride * bytes_per_pixel, src, bytes_per_pixel);
+				depth[span * x_stride] = wall_dist;
 			}
 		}
-		
 	}
 
+	//only the rows that were drawn, a door in front stops the column early
 	if(r_draw_start) *r_draw_start = draw_start;
-	if(r_draw_end) *r_draw_end = draw_end;
+	if(r_draw_end) *r_draw_end = draw_start + drawn;
 
 	return true;
 }
@@ -850,10 +903,10 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 	int safe_end_y = (draw_end_y >= image->height) ? draw_end_y - 1 : draw_end_y;
 
 	//all depth edges of a sprite rectangle
-	float d0 = depth_buffer[draw_start_x + draw_start_y * image->width]; //top left edge
-	float d1 = depth_buffer[safe_end_x + draw_start_y * image->width]; //top right edge
-	float d2 = depth_buffer[draw_start_x + safe_end_y * image->width]; //bottom left edge
-	float d3 = depth_buffer[safe_end_x + safe_end_y * image->width]; //bottom right edge
+	float d0 = depth_buffer[Image_PixelIndex(image, draw_start_x, draw_start_y)]; //top left edge
+	float d1 = depth_buffer[Image_PixelIndex(image, safe_end_x, draw_start_y)]; //top right edge
+	float d2 = depth_buffer[Image_PixelIndex(image, draw_start_x, safe_end_y)]; //bottom left edge
+	float d3 = depth_buffer[Image_PixelIndex(image, safe_end_x, safe_end_y)]; //bottom right edge
 
 	float t0 = inv_det * (-p_planeY * (local_sprite_x - sprite_half_width) + p_planeX * (local_sprite_y - sprite_half_height));
 	float t1 = inv_det * (-p_planeY * (local_sprite_x + sprite_half_width) + p_planeX * (local_sprite_y - sprite_half_height));
@@ -872,7 +925,7 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 	int light = light_tile->light;
 
 	light += sprite_light;
-	light += light_tile->temp_light;
+	light += Map_GetTempLight((int)sprite->x, (int)sprite->y);
 
 	if (light > 255)
 	{
@@ -949,6 +1002,12 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 			tex_x = -tex_x;
 		}
 
+		//walk the texture column with a stride instead of looking up every texel
+		unsigned char* tex_column = Image_Get(sprite->img, tex_x + (sprite_offset_x * sprite_rect_width), 0);
+		const int tex_stride = Image_YStride(sprite->img) * sprite->img->numChannels;
+		const int tex_offset_y = sprite_offset_y * sprite_rect_height;
+		const int tex_last_y = sprite->img->height - 1;
+
 		bool next_tex_valid = false;
 		int next_tex_y = -1;
 		int next_d = -1;
@@ -975,7 +1034,12 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 				break;
 			}
 
-			unsigned char* tex_color = Image_Get(sprite->img, tex_x + (sprite_offset_x * sprite_rect_width), tex_y + (sprite_offset_y * sprite_rect_height));
+			int row = tex_y + tex_offset_y;
+
+			if (row < 0) row = 0;
+			else if (row > tex_last_y) row = tex_last_y;
+
+			unsigned char* tex_color = tex_column + row * tex_stride;
 
 			//alpha discard if possible
 			if (sprite->img->numChannels >= 4)
@@ -999,7 +1063,7 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 						old_color[k] = (old_color[k] / transparency) + (tex_color[k] / 2);
 					}
 
-					depth_buffer[(stripe + l) + y * image->width] = transform_y;
+					depth_buffer[Image_PixelIndex(image, stripe + l, y)] = transform_y;
 				}
 			}
 			else
@@ -1015,13 +1079,13 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 					{
 						int sl = (stripe + l);
 
-						if (transform_y >= depth_buffer[sl + y * image->width])
+						if (transform_y >= depth_buffer[Image_PixelIndex(image, sl, y)])
 						{
 							continue;
 						}
 
 						Image_Set2(image, sl, y, color);
-						depth_buffer[sl + y * image->width] = transform_y;
+						depth_buffer[Image_PixelIndex(image, sl, y)] = transform_y;
 					}
 
 					next_d = ((y + 1) - v_move_screen) * 256 - image->height * 128 + sprite_height * 128;
@@ -1044,6 +1108,25 @@ void Video_DrawSprite(Image* image, Sprite* sprite, float* depth_buffer, float p
 	}
 }
 
+//true when nothing in the columns is behind depth, a pixel at depth would fail every depth test there
+static inline bool Video_IsDepthCovered(const float* depth_buffer, int x_stride, int y_stride, int columns, int rows, float depth)
+{
+	for (int x = 0; x < columns; x++)
+	{
+		const float* column = depth_buffer + x * x_stride;
+
+		for (int y = 0; y < rows; y++)
+		{
+			if (column[y * y_stride] > depth)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
 bool Video_SpriteSetup(Image* image, Sprite* sprite, float* depth_buffer, float p_x, float p_y, float p_dirX, float p_dirY, float p_planeX, float p_planeY)
 {
 	if (!depth_buffer)
@@ -1118,10 +1201,10 @@ bool Video_SpriteSetup(Image* image, Sprite* sprite, float* depth_buffer, float
 	int safe_end_y = (draw_end_y >= image->height) ? draw_end_y - 1 : draw_end_y;
 
 	//all depth edges of a sprite rectangle
-	float d0 = depth_buffer[draw_start_x + draw_start_y * image->width]; //top left edge
-	float d1 = depth_buffer[safe_end_x + draw_start_y * image->width]; //top right edge
-	float d2 = depth_buffer[draw_start_x + safe_end_y * image->width]; //bottom left edge
-	float d3 = depth_buffer[safe_end_x + safe_end_y * image->width]; //bottom right edge
+	float d0 = depth_buffer[Image_PixelIndex(image, draw_start_x, draw_start_y)]; //top left edge
+	float d1 = depth_buffer[Image_PixelIndex(image, safe_end_x, draw_start_y)]; //top right edge
+	float d2 = depth_buffer[Image_PixelIndex(image, draw_start_x, safe_end_y)]; //bottom left edge
+	float d3 = depth_buffer[Image_PixelIndex(image, safe_end_x, safe_end_y)]; //bottom right edge
 
 	//big bias for occlusion testing
 	//since otherwise we get incorrect culling
@@ -1145,7 +1228,7 @@ bool Video_SpriteSetup(Image* image, Sprite* sprite, float* depth_buffer, float
 	int light = light_tile->light;
 
 	light += sprite_light;
-	light += light_tile->temp_light;
+	light += Map_GetTempLight((int)sprite->x, (int)sprite->y);
 
 	if (light > 255)
 	{
@@ -1223,7 +1306,8 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 		sprite_offset_x += 1;
 	}
 
-	float transparency = (sprite->transparency > 0) ? (1.0 / min(sprite->transparency, 1)) : 0;
+	//translucent sprites are drawn after the opaque ones and blend with what is under them
+	float opacity = 1.0f - min(sprite->transparency, 1);
 
 	int min_x = (sprite_flip_h) ? ((sprite_rect_width)-(frame_info->max_real_x)) : frame_info->min_real_x;
 	int max_x = (sprite_flip_h) ? ((sprite_rect_width)-(frame_info->min_real_x)) : frame_info->max_real_x;
@@ -1234,6 +1318,25 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 		max_x += 1;
 	}
 
+	const int x_stride = Image_XStride(image);
+
+	//palette indices when drawing into an 8 bit image
+	const bool indexed = (image->numChannels == 1);
+	const int texel_size = (indexed) ? 1 : sprite->img->numChannels;
+	const unsigned char* colormap = (indexed) ? Video_GetColormap(light) : NULL;
+
+	//frames keep their layout in every mip level, so texel coordinates are just shifted down
+	int level = (s_useMipmaps) ? Image_SelectMipLevel(sprite->img, (float)sprite_rect_height / (float)sprite_height) : 0;
+
+	Image* mip = Image_GetMipLevel(sprite->img, level);
+
+	unsigned char* tex_data = (indexed) ? mip->indices : mip->data;
+
+	if (!tex_data)
+	{
+		return;
+	}
+
 	float x_tex_step = (256 * (float)sprite_rect_width / (float)sprite_width) / 256.0;
 
 	for (int stripe = draw_start_x; stripe < draw_end_x; stripe++)
@@ -1268,6 +1371,13 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 			x_steps++;
 		}
 
+		//opaque sprites are drawn front to back, a stripe the nearer sprites and the walls cover is skipped
+		if (Video_IsDepthCovered(depth_buffer + Image_PixelIndex(image, stripe, draw_start_y), x_stride, Image_YStride(image), x_steps, draw_end_y - draw_start_y, transform_y))
+		{
+			stripe += x_steps - 1;
+			continue;
+		}
+
 		int y_min = (sprite_flip_v) ? (sprite_rect_height - (span->max)) : span->min;
 		int y_max = (sprite_flip_v) ? (sprite_rect_height - (span->min)) : span->max;
 
@@ -1282,6 +1392,17 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 			tex_x = -tex_x;
 		}
 
+		int column_x = (tex_x + (sprite_offset_x * sprite_rect_width)) >> level;
+
+		if (column_x < 0) column_x = 0;
+		else if (column_x >= mip->width) column_x = mip->width - 1;
+
+		//walk the texture column with a stride instead of looking up every texel
+		unsigned char* tex_column = tex_data + Image_PixelIndex(mip, column_x, 0) * texel_size;
+		const int tex_stride = Image_YStride(mip) * texel_size;
+		const int tex_offset_y = sprite_offset_y * sprite_rect_height;
+		const int tex_last_y = mip->height - 1;
+
 		bool next_tex_valid = false;
 		int next_tex_y = -1;
 		int next_d = -1;
@@ -1308,35 +1429,86 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 				break;
 			}
 
-			unsigned char* tex_color = Image_Get(sprite->img, tex_x + (sprite_offset_x * sprite_rect_width), tex_y + (sprite_offset_y * sprite_rect_height));
+			//no texel fetch for a row that is already covered
+			if (Video_IsDepthCovered(depth_buffer + Image_PixelIndex(image, stripe, y), x_stride, 0, x_steps, 1, transform_y))
+			{
+				continue;
+			}
 
-			//alpha discard if possible
-			if (sprite->img->numChannels >= 4)
+			int row = (tex_y + tex_offset_y) >> level;
+
+			if (row < 0) row = 0;
+			else if (row > tex_last_y) row = tex_last_y;
+
+			unsigned char* tex_color = tex_column + row * tex_stride;
+			unsigned char color[4];
+
+			if (indexed)
 			{
-				if (tex_color[3] < 128)
+				if (*tex_color == PALETTE_TRANSPARENT)
 				{
 					continue;
 				}
+
+				color[0] = colormap[*tex_color];
 			}
+			else
+			{
+				//alpha discard if possible
+				if (sprite->img->numChannels >= 4)
+				{
+					if (tex_color[3] < 128)
+					{
+						continue;
+					}
+				}
 
-			unsigned char color[4] = { LIGHT_LUT[tex_color[0]][light], LIGHT_LUT[tex_color[1]][light], LIGHT_LUT[tex_color[2]][light], 255 };
+				color[0] = LIGHT_LUT[tex_color[0]][light];
+				color[1] = LIGHT_LUT[tex_color[1]][light];
+				color[2] = LIGHT_LUT[tex_color[2]][light];
+				color[3] = 255;
+			}
 
 			next_d = d;
 			next_tex_y = tex_y;
 
 			while (y < draw_end_y)
 			{
-				for (int l = 0; l < x_steps; l++)
+				int pixel = Image_PixelIndex(image, stripe, y);
+
+				for (int l = 0; l < x_steps; l++, pixel += x_stride)
 				{
-					int sl = (stripe + l);
+					if (transform_y >= depth_buffer[pixel])
+					{
+						continue;
+					}
 
-					if (transform_y >= depth_buffer[sl + y * image->width])
+					//the depth is left alone, so translucent sprites behind still blend
+					if (opacity < 1)
 					{
+						unsigned char* dst = image->data + pixel * image->numChannels;
+
+						if (indexed)
+						{
+							//palette indices can't be blended, every other pixel is drawn instead
+							if (!((stripe + l + y) & 1))
+							{
+								dst[0] = color[0];
+							}
+						}
+						else
+						{
+							for (int k = 0; k < 3; k++)
+							{
+								dst[k] = (unsigned char)(dst[k] + (color[k] - dst[k]) * opacity);
+							}
+						}
+
 						continue;
 					}
 
-					Image_Set2(image, sl, y, color);
-					depth_buffer[sl + y * image->width] = transform_y;
+					memcpy(image->data + pixel * image->numChannels, color, image->numChannels);
+					depth_buffer[pixel] = transform_y;
 				}
 
 				next_d = ((y + 1) - v_move_screen) * 256 - image->height * 128 + sprite_height * 128;
@@ -1358,6 +1530,31 @@ void Video_SpriteClipAndDraw(Image* image, Sprite* sprite, float* depth_buffer,
 	}
 }
 
+//true when every column of the sprite in x_start to x_end is behind the wall drawn there,
+//the sprite would fail the depth test on every pixel
+bool Video_IsSpriteOccluded(const Sprite* sprite, const DrawSpan* draw_spans, int x_start, int x_end)
+{
+	if (!s_useSpriteOcclusion)
+	{
+		return false;
+	}
+
+	int draw_start_x = max(sprite->r_draw_start_x, x_start);
+	int draw_end_x = min(sprite->r_draw_end_x, x_end);
+
+	for (int x = draw_start_x; x < draw_end_x; x++)
+	{
+		const DrawSpan* span = &draw_spans[x];
+
+		if (span->occluder_top > sprite->r_draw_start_y || span->occluder_bottom < sprite->r_draw_end_y || sprite->r_transform_y < span->occluder_dist)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void Video_DrawScreenTexture(Image* image, Image* texture, float p_x, float p_y, float p_scaleX, float p_scaleY)
 {
 	if (p_scaleX <= 0 || p_scaleY <= 0)
@@ -4,6 +4,7 @@
 #include "miniaudio/miniaudio.h"
 
 #include "game_info.h"
+#include "u_math.h"
 
 typedef struct
 {
@@ -0,0 +1,270 @@
+#include "u_json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_NUMBER_LENGTH 63
+
+void Json_InitReader(JsonReader* reader, const char* text, size_t length)
+{
+	reader->cur = text;
+	reader->end = text + length;
+}
+
+static inline bool Json_IsSeparator(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' || c == ':';
+}
+
+static inline bool Json_IsNumberChar(char c)
+{
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static bool Json_ReadLiteral(JsonReader* reader, const char* literal, JsonTokenType type, JsonToken* r_token)
+{
+	size_t length = strlen(literal);
+
+	if ((size_t)(reader->end - reader->cur) < length || memcmp(reader->cur, literal, length))
+	{
+		r_token->type = JSON_TOKEN__ERROR;
+		return false;
+	}
+
+	reader->cur += length;
+	r_token->type = type;
+
+	return true;
+}
+
+static bool Json_ReadNumber(JsonReader* reader, JsonToken* r_token)
+{
+	const char* start = reader->cur;
+	const char* cur = start;
+
+	bool negative = false;
+	bool integer = true;
+	double value = 0;
+
+	if (cur < reader->end && *cur == '-')
+	{
+		negative = true;
+		cur++;
+	}
+
+	//tile data is all integers, so parse those without strtod
+	for (; cur < reader->end && Json_IsNumberChar(*cur); cur++)
+	{
+		if (*cur >= '0' && *cur <= '9')
+		{
+			value = value * 10 + (*cur - '0');
+		}
+		else
+		{
+			integer = false;
+		}
+	}
+
+	int length = (int)(cur - start);
+
+	if (length == 0 || (negative && length == 1))
+	{
+		r_token->type = JSON_TOKEN__ERROR;
+		return false;
+	}
+
+	if (!integer)
+	{
+		//the text is not null terminated
+		char buffer[JSON_MAX_NUMBER_LENGTH + 1];
+
+		if (length > JSON_MAX_NUMBER_LENGTH)
+		{
+			r_token->type = JSON_TOKEN__ERROR;
+			return false;
+		}
+
+		memcpy(buffer, start, length);
+		buffer[length] = 0;
+
+		char* parse_end = NULL;
+		value = strtod(buffer, &parse_end);
+
+		if (parse_end != buffer + length)
+		{
+			r_token->type = JSON_TOKEN__ERROR;
+			return false;
+		}
+	}
+	else if (negative)
+	{
+		value = -value;
+	}
+
+	reader->cur = cur;
+
+	r_token->type = JSON_TOKEN__NUMBER;
+	r_token->number = value;
+
+	return true;
+}
+
+static bool Json_ReadString(JsonReader* reader, JsonToken* r_token)
+{
+	//skip the opening quote
+	const char* start = ++reader->cur;
+	const char* cur = start;
+
+	while (cur < reader->end && *cur != '"')
+	{
+		//escaped char, can be a quote
+		if (*cur == '\\')
+		{
+			cur++;
+		}
+		cur++;
+	}
+
+	if (cur >= reader->end)
+	{
+		r_token->type = JSON_TOKEN__ERROR;
+		return false;
+	}
+
+	r_token->type = JSON_TOKEN__STRING;
+	r_token->str = start;
+	r_token->length = (int)(cur - start);
+
+	//skip the closing quote
+	reader->cur = cur + 1;
+
+	return true;
+}
+
+bool Json_Next(JsonReader* reader, JsonToken* r_token)
+{
+	while (reader->cur < reader->end && Json_IsSeparator(*reader->cur))
+	{
+		reader->cur++;
+	}
+
+	if (reader->cur >= reader->end)
+	{
+		r_token->type = JSON_TOKEN__END;
+		return false;
+	}
+
+	switch (*reader->cur)
+	{
+	case '{':
+	{
+		reader->cur++;
+		r_token->type = JSON_TOKEN__OBJECT_START;
+		return true;
+	}
+	case '}':
+	{
+		reader->cur++;
+		r_token->type = JSON_TOKEN__OBJECT_END;
+		return true;
+	}
+	case '[':
+	{
+		reader->cur++;
+		r_token->type = JSON_TOKEN__ARRAY_START;
+		return true;
+	}
+	case ']':
+	{
+		reader->cur++;
+		r_token->type = JSON_TOKEN__ARRAY_END;
+		return true;
+	}
+	case '"':
+	{
+		return Json_ReadString(reader, r_token);
+	}
+	case 't':
+	{
+		return Json_ReadLiteral(reader, "true", JSON_TOKEN__TRUE, r_token);
+	}
+	case 'f':
+	{
+		return Json_ReadLiteral(reader, "false", JSON_TOKEN__FALSE, r_token);
+	}
+	case 'n':
+	{
+		return Json_ReadLiteral(reader, "null", JSON_TOKEN__NULL, r_token);
+	}
+	default:
+		break;
+	}
+
+	return Json_ReadNumber(reader, r_token);
+}
+
+//skips the rest of the value that starts with token, nested objects and arrays included
+bool Json_SkipValue(JsonReader* reader, const JsonToken* token)
+{
+	if (token->type != JSON_TOKEN__OBJECT_START && token->type != JSON_TOKEN__ARRAY_START)
+	{
+		return token->type != JSON_TOKEN__ERROR && token->type != JSON_TOKEN__END;
+	}
+
+	int depth = 1;
+
+	JsonToken next;
+
+	while (depth > 0)
+	{
+		if (!Json_Next(reader, &next))
+		{
+			return false;
+		}
+
+		if (next.type == JSON_TOKEN__OBJECT_START || next.type == JSON_TOKEN__ARRAY_START)
+		{
+			depth++;
+		}
+		else if (next.type == JSON_TOKEN__OBJECT_END || next.type == JSON_TOKEN__ARRAY_END)
+		{
+			depth--;
+		}
+	}
+
+	return true;
+}
+
+bool Json_TokenEquals(const JsonToken* token, const char* str)
+{
+	if (token->type != JSON_TOKEN__STRING)
+	{
+		return false;
+	}
+
+	size_t length = strlen(str);
+
+	return (size_t)token->length == length && !memcmp(token->str, str, length);
+}
+
+void Json_CopyString(const JsonToken* token, char* r_buffer, size_t size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	size_t length = (token->type == JSON_TOKEN__STRING) ? (size_t)token->length : 0;
+
+	if (length > size - 1)
+	{
+		length = size - 1;
+	}
+
+	if (length > 0)
+	{
+		memcpy(r_buffer, token->str, length);
+	}
+
+	r_buffer[length] = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef U_JSON_H
+#define U_JSON_H
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+	Streaming json reader. Tokens are pulled one at a time straight from the text,
+	nothing is allocated. Strings point into the text and keep their escapes.
+	Commas and colons are skipped, the caller knows where keys and values are.
+*/
+
+typedef enum
+{
+	JSON_TOKEN__ERROR,
+	JSON_TOKEN__END,
+	JSON_TOKEN__OBJECT_START,
+	JSON_TOKEN__OBJECT_END,
+	JSON_TOKEN__ARRAY_START,
+	JSON_TOKEN__ARRAY_END,
+	JSON_TOKEN__STRING,
+	JSON_TOKEN__NUMBER,
+	JSON_TOKEN__TRUE,
+	JSON_TOKEN__FALSE,
+	JSON_TOKEN__NULL
+} JsonTokenType;
+
+typedef struct
+{
+	JsonTokenType type;
+	const char* str; //string contents without the quotes
+	int length;
+	double number;
+} JsonToken;
+
+typedef struct
+{
+	const char* cur;
+	const char* end;
+} JsonReader;
+
+void Json_InitReader(JsonReader* reader, const char* text, size_t length);
+bool Json_Next(JsonReader* reader, JsonToken* r_token);
+bool Json_SkipValue(JsonReader* reader, const JsonToken* token);
+bool Json_TokenEquals(const JsonToken* token, const char* str);
+void Json_CopyString(const JsonToken* token, char* r_buffer, size_t size);
+
+#endif
@@ -7,6 +7,13 @@
 #include <math.h>
 #include <stdbool.h>
 
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 #define Math_PI 3.1415926535897932384626433833
 #define CMP_EPSILON 0.00001
 
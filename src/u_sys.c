@@ -0,0 +1,292 @@
+//clock_gettime, mmap and the rest of posix are hidden in strict c11 otherwise
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "u_sys.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI Thread_Start(LPVOID arg)
+{
+	Thread* thread = arg;
+
+	thread->fun(thread->arg);
+
+	return 0;
+}
+#else
+static void* Thread_Start(void* arg)
+{
+	Thread* thread = arg;
+
+	thread->fun(thread->arg);
+
+	return NULL;
+}
+#endif
+
+bool Thread_Create(Thread* thread, ThreadFun fun, void* arg)
+{
+	thread->fun = fun;
+	thread->arg = arg;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, Thread_Start, thread, 0, NULL);
+
+	return thread->handle != NULL;
+#else
+	return pthread_create(&thread->handle, NULL, Thread_Start, thread) == 0;
+#endif
+}
+
+void Thread_Join(Thread* thread)
+{
+#ifdef _WIN32
+	if (!thread->handle)
+	{
+		return;
+	}
+
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+	thread->handle = NULL;
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+}
+
+void Mutex_Init(Mutex* mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+}
+
+void Mutex_Destroy(Mutex* mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_destroy(&mutex->mutex);
+#endif
+}
+
+void Mutex_Lock(Mutex* mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+void Mutex_Unlock(Mutex* mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+void CondVar_Init(CondVar* cv)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(&cv->cv);
+#else
+	pthread_cond_init(&cv->cond, NULL);
+#endif
+}
+
+void CondVar_Destroy(CondVar* cv)
+{
+#ifdef _WIN32
+	//nothing to free
+#else
+	pthread_cond_destroy(&cv->cond);
+#endif
+}
+
+void CondVar_Wait(CondVar* cv, Mutex* mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(&cv->cv, &mutex->cs, INFINITE);
+#else
+	pthread_cond_wait(&cv->cond, &mutex->mutex);
+#endif
+}
+
+void CondVar_Signal(CondVar* cv)
+{
+#ifdef _WIN32
+	WakeConditionVariable(&cv->cv);
+#else
+	pthread_cond_signal(&cv->cond);
+#endif
+}
+
+void CondVar_Broadcast(CondVar* cv)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&cv->cv);
+#else
+	pthread_cond_broadcast(&cv->cond);
+#endif
+}
+
+int Sys_GetNumCores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (count > 0) ? (int)count : 1;
+#endif
+}
+
+double Sys_GetTime()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER counter;
+
+	if (freq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&counter);
+
+	return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+//last modification time, only useful for comparing two files
+bool Sys_GetFileTime(const char* path, int64_t* r_time)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+
+	*r_time = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+	{
+		return false;
+	}
+
+	*r_time = (int64_t)st.st_mtime;
+#endif
+
+	return true;
+}
+
+bool Sys_MapFile(MappedFile* file, const char* path)
+{
+	memset(file, 0, sizeof(MappedFile));
+
+#ifdef _WIN32
+	file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file->file == INVALID_HANDLE_VALUE)
+	{
+		file->file = NULL;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file->file, &size) || size.QuadPart == 0)
+	{
+		Sys_UnmapFile(file);
+		return false;
+	}
+
+	file->mapping = CreateFileMappingA(file->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	if (!file->mapping)
+	{
+		Sys_UnmapFile(file);
+		return false;
+	}
+
+	file->data = MapViewOfFile(file->mapping, FILE_MAP_COPY, 0, 0, 0);
+
+	if (!file->data)
+	{
+		Sys_UnmapFile(file);
+		return false;
+	}
+
+	file->size = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	//the mapping keeps its own reference to the file
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+
+	file->data = data;
+	file->size = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void Sys_UnmapFile(MappedFile* file)
+{
+#ifdef _WIN32
+	if (file->data) UnmapViewOfFile(file->data);
+	if (file->mapping) CloseHandle(file->mapping);
+	if (file->file) CloseHandle(file->file);
+#else
+	if (file->data) munmap(file->data, file->size);
+#endif
+
+	memset(file, 0, sizeof(MappedFile));
+}
@@ -0,0 +1,181 @@
+#ifndef U_SYS_H
+#define U_SYS_H
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+	Small os layer for threads, locks, atomics and timing.
+	Win32 is used on windows and pthreads everywhere else
+*/
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#define CACHE_LINE_SIZE 64
+
+typedef void (*ThreadFun)(void* arg);
+
+typedef struct
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	ThreadFun fun;
+	void* arg;
+} Thread;
+
+typedef struct
+{
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+} Mutex;
+
+typedef struct
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE cv;
+#else
+	pthread_cond_t cond;
+#endif
+} CondVar;
+
+//read only view of a whole file, pages are copy on write
+typedef struct
+{
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	void* data;
+	size_t size;
+} MappedFile;
+
+bool Thread_Create(Thread* thread, ThreadFun fun, void* arg);
+void Thread_Join(Thread* thread);
+
+void Mutex_Init(Mutex* mutex);
+void Mutex_Destroy(Mutex* mutex);
+void Mutex_Lock(Mutex* mutex);
+void Mutex_Unlock(Mutex* mutex);
+
+void CondVar_Init(CondVar* cv);
+void CondVar_Destroy(CondVar* cv);
+void CondVar_Wait(CondVar* cv, Mutex* mutex);
+void CondVar_Signal(CondVar* cv);
+void CondVar_Broadcast(CondVar* cv);
+
+int Sys_GetNumCores();
+double Sys_GetTime();
+
+bool Sys_GetFileTime(const char* path, int64_t* r_time);
+bool Sys_MapFile(MappedFile* file, const char* path);
+void Sys_UnmapFile(MappedFile* file);
+
+//Atomics, all of them are sequentially consistent
+static inline int32_t Atomic_Load(volatile int32_t* v)
+{
+#ifdef _MSC_VER
+	return (int32_t)_InterlockedOr((volatile long*)v, 0);
+#else
+	return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void Atomic_Store(volatile int32_t* v, int32_t value)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange((volatile long*)v, value);
+#else
+	__atomic_store_n(v, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+//returns the new value
+static inline int32_t Atomic_Add(volatile int32_t* v, int32_t add)
+{
+#ifdef _MSC_VER
+	return (int32_t)_InterlockedExchangeAdd((volatile long*)v, add) + add;
+#else
+	return __atomic_add_fetch(v, add, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline int64_t Atomic_Load64(volatile int64_t* v)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange64(v, 0, 0);
+#else
+	return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void Atomic_Store64(volatile int64_t* v, int64_t value)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange64(v, value);
+#else
+	__atomic_store_n(v, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline bool Atomic_CompareExchange64(volatile int64_t* v, int64_t expected, int64_t desired)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange64(v, desired, expected) == expected;
+#else
+	return __atomic_compare_exchange_n(v, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void* Atomic_LoadPtr(void* volatile* v)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchangePointer(v, NULL, NULL);
+#else
+	return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void Atomic_StorePtr(void* volatile* v, void* value)
+{
+#ifdef _MSC_VER
+	_InterlockedExchangePointer(v, value);
+#else
+	__atomic_store_n(v, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+//hint for spin loops
+static inline void Sys_CpuRelax()
+{
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#endif
@@ -4,6 +4,12 @@
 
 #include <stdio.h>
 
+#ifndef _WIN32
+#include <errno.h>
+#define fopen_s(pp_file, filename, mode) ((*(pp_file) = fopen((filename), (mode))) ? 0 : errno)
+#define fread_s(buffer, buffer_size, element_size, count, file) fread((buffer), (element_size), (count), (file))
+#endif
+
 int File_GetLength(FILE* p_file);
 unsigned char* File_Parse(const char* p_filePath, int* r_length);
 